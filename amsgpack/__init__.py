@@ -1,22 +1,43 @@
+from collections.abc import Mapping, Sequence
+
 from ._amsgpack import (
     Timestamp,
     Ext,
     Raw,
     Packer,
+    CompiledPacker,
+    PackBuffer,
     Unpacker,
     FileUnpacker,
+    LazyMap,
+    LazyArray,
     packb,
     unpackb,
+    extract,
+    scan,
+    validate,
     __version__,
 )
+from .mapped_file import MappedFile
 
 __all__ = [
     "Timestamp",
     "Ext",
     "Raw",
     "Packer",
+    "CompiledPacker",
+    "PackBuffer",
     "Unpacker",
     "FileUnpacker",
+    "LazyMap",
+    "LazyArray",
     "packb",
     "unpackb",
+    "extract",
+    "scan",
+    "validate",
+    "MappedFile",
 ]
+
+Mapping.register(LazyMap)
+Sequence.register(LazyArray)
@@ -8,7 +8,13 @@ from typing import (
     Generic,
     Sequence,
     Mapping,
+    Iterable,
+    Iterator,
+    Literal,
+    overload,
+    TypedDict,
 )
+from collections.abc import Buffer
 from datetime import datetime
 
 __version__: str
@@ -32,7 +38,7 @@ class Timestamp(ComparableAndHashable):
 class Ext:
     code: Final[int]
     data: Final[bytes]
-    def __init__(self, code: int, data: bytes) -> None: ...
+    def __init__(self, code: int, data: Buffer) -> None: ...
     def is_timestamp(self) -> bool: ...
     def default(self) -> Ext | datetime: ...
     def to_timestamp(self) -> Timestamp: ...
@@ -44,7 +50,7 @@ class Ext:
 @final
 class Raw(ComparableAndHashable):
     data: Final[bytes]
-    def __init__(self, data: bytes) -> None: ...
+    def __init__(self, data: Buffer) -> None: ...
 
 Immutable: TypeAlias = (
     str | int | float | bool | bytes | Ext | Raw | datetime | Timestamp | None
@@ -53,33 +59,163 @@ Value: TypeAlias = (
     Mapping[Immutable, Value] | Sequence[Value] | Immutable | bytearray
 )
 
+class BinaryWriteStream(Protocol):
+    def write(self, data: memoryview, /) -> int | None: ...
+
+@final
+class PackBuffer:
+    def __init__(self, capacity: int = 1024) -> None: ...
+    def __len__(self) -> int: ...
+    def __buffer__(self, flags: int, /) -> memoryview: ...
+    def clear(self) -> None: ...
+    def view(self) -> memoryview: ...
+
 TP = TypeVar("TP", default=Value)
 
+@final
+class CompiledPacker:
+    @property
+    def length(self) -> int: ...
+    def pack(self, *values: object) -> bytes: ...
+
 @final
 class Packer(Generic[TP]):
     def __init__(
-        self, default: Callable[[TP], Value] | None = None
+        self,
+        default: Callable[[TP], Value] | None = None,
+        *,
+        structs: Literal["map", "array"] | None = None,
+        typed_arrays: Literal["array"] | int | None = None,
+        presize: bool = False,
+        compact_floats: bool | Literal["int"] = False,
     ) -> None: ...
     def packb(self, obj: Value | TP) -> bytes: ...
+    @overload
+    def packb_many(
+        self,
+        iterable: Iterable[Value | TP],
+        /,
+        *,
+        concat: Literal[False] = False,
+        offsets: Literal[False] = False,
+    ) -> list[bytes]: ...
+    @overload
+    def packb_many(
+        self,
+        iterable: Iterable[Value | TP],
+        /,
+        *,
+        concat: Literal[True],
+        offsets: Literal[False] = False,
+    ) -> bytes: ...
+    @overload
+    def packb_many(
+        self,
+        iterable: Iterable[Value | TP],
+        /,
+        *,
+        concat: Literal[False] = False,
+        offsets: Literal[True],
+    ) -> tuple[list[bytes], list[int]]: ...
+    @overload
+    def packb_many(
+        self,
+        iterable: Iterable[Value | TP],
+        /,
+        *,
+        concat: Literal[True],
+        offsets: Literal[True],
+    ) -> tuple[bytes, list[int]]: ...
+    def packb_iov(
+        self, obj: Value | TP, /, *, threshold: int = 4096
+    ) -> list[Buffer]: ...
+    def packb_with_digest(
+        self, obj: Value | TP, /, *, seed: int = 0
+    ) -> tuple[bytes, int]: ...
+    def packed_size(
+        self, obj: Value | TP, /, *, max_size: int | None = None
+    ) -> int: ...
+    def compile(self, template: object, /) -> CompiledPacker: ...
+    def dump(
+        self,
+        obj: Value | TP,
+        file: BinaryWriteStream | int,
+        chunk_size: int = 65536,
+    ) -> int: ...
+    def pack_into(
+        self,
+        buffer: PackBuffer | bytearray | memoryview,
+        obj: Value | TP,
+        offset: int | None = None,
+    ) -> int: ...
 
 TU = TypeVar("TU", default=Ext)
 
 @final
+class KeyCacheInfo(TypedDict):
+    size: int
+    ways: int
+    key_length: int
+    pinned: int
+    hits: int
+    misses: int
+    evictions: int
+
 class Unpacker(Generic[TU]):
     def __init__(
         self,
         *,
         tuple: bool = False,
         ext_hook: Callable[[Ext], TU] | None = None,
+        typed_arrays: int | None = None,
+        bin_type: Literal["bytes", "memoryview"] = "bytes",
+        cache_size: int | None = None,
+        cache_ways: Literal[1, 2, 4] = 1,
+        cache_key_length: int = 16,
+        keys: Iterable[str] | None = None,
+        cache_values: bool = False,
+        lazy: bool = False,
+        raw: bool = False,
     ) -> None: ...
-    def feed(self, data: bytes) -> None: ...
+    def feed(self, data: Buffer) -> None: ...
     def reset(self) -> None: ...
-    def unpackb(self, obj: bytes | memoryview) -> Value | TU: ...
+    def skip(self, n: int = 1, /) -> int: ...
+    def cache_info(self) -> KeyCacheInfo: ...
+    def value_cache_info(self) -> KeyCacheInfo | None: ...
+    def unpackb(self, obj: Buffer) -> Value | TU: ...
+    def extract(
+        self,
+        data: Buffer,
+        paths: Sequence[Sequence[Immutable]],
+        /,
+        default: object = None,
+    ) -> tuple[Value | TU | object, ...]: ...
     def __iter__(self) -> "Unpacker": ...
     def __next__(self) -> Value | TU: ...
 
+@final
+class LazyMap(Mapping[Immutable, Value]):
+    def __getitem__(self, key: Immutable, /) -> Value: ...
+    def __len__(self) -> int: ...
+    def __iter__(self) -> Iterator[Immutable]: ...
+    def keys(self) -> list[Immutable]: ...  # type: ignore[override]
+    def values(self) -> list[Value]: ...  # type: ignore[override]
+    def items(  # type: ignore[override]
+        self,
+    ) -> list[tuple[Immutable, Value]]: ...
+    def materialize(self) -> dict[Immutable, Value]: ...
+
+@final
+class LazyArray(Sequence[Value]):
+    @overload
+    def __getitem__(self, index: int, /) -> Value: ...
+    @overload
+    def __getitem__(self, index: slice, /) -> list[Value]: ...
+    def __len__(self) -> int: ...
+    def materialize(self) -> list[Value]: ...
+
 class BinaryStream(Protocol):
-    def read(self, size: int = -1, /) -> bytes: ...
+    def read(self, size: int = -1, /) -> Buffer: ...
 
 @final
 class FileUnpacker(Generic[TU]):
@@ -91,9 +227,21 @@ class FileUnpacker(Generic[TU]):
         *,
         tuple: bool = False,
         ext_hook: Callable[[Ext], TU] | None = None,
+        typed_arrays: int | None = None,
+        bin_type: Literal["bytes", "memoryview"] = "bytes",
+        cache_size: int | None = None,
+        cache_ways: Literal[1, 2, 4] = 1,
+        cache_key_length: int = 16,
+        keys: Iterable[str] | None = None,
+        cache_values: bool = False,
+        raw: bool = False,
     ) -> None: ...
     def __iter__(self) -> FileUnpacker[TU]: ...
     def __next__(self) -> Value | TU: ...
 
 packb = Packer().packb
 unpackb = Unpacker().unpackb
+extract = Unpacker().extract
+
+def scan(data: Buffer, /, *, max_depth: int = 32) -> list[int]: ...
+def validate(data: Buffer, /, *, max_depth: int = 32) -> int: ...
@@ -0,0 +1,163 @@
+"""
+Random access to a file of concatenated MessagePack messages.
+"""
+
+from array import array
+from collections.abc import Iterator, Sequence
+from os import PathLike, fspath, replace
+from struct import Struct
+from sys import byteorder
+from typing import Any, overload
+import mmap
+
+from ._amsgpack import Unpacker, scan
+
+_INDEX_HEADER = Struct("<8sQ")  # magic and the number of messages
+_INDEX_MAGIC = b"AMSGIDX1"
+
+
+def _advise(mapped: mmap.mmap | None, name: str) -> None:
+    advice: int | None = getattr(mmap, name, None)
+    if mapped is not None and advice is not None:
+        mapped.madvise(advice)
+
+
+class MappedFile(Sequence[Any]):
+    """
+    Memory-mapped file of concatenated messages, like a log written with
+    ``packb``. Messages are found once with :func:`scan`, without unpacking
+    them, and ``file[n]`` unpacks only message ``n``. An incomplete message
+    at the end of the file is not included.
+
+    With *index_path* the end offsets are kept in a sidecar file. It is
+    loaded on the next open, and only messages appended since are scanned.
+    Remove the sidecar when the file is rewritten.
+
+    *unpacker* unpacks the messages, ``Unpacker()`` by default. Its
+    ``memoryview`` and lazy results reference the mapping, so they must
+    be released before :meth:`close`.
+    """
+
+    def __init__(
+        self,
+        path: str | PathLike[str],
+        *,
+        index_path: str | PathLike[str] | None = None,
+        unpacker: "Unpacker[Any] | None" = None,
+    ) -> None:
+        self._unpacker: "Unpacker[Any]" = (
+            Unpacker() if unpacker is None else unpacker
+        )
+        with open(path, "rb") as file:
+            try:
+                self._mmap: mmap.mmap | None = mmap.mmap(
+                    file.fileno(), 0, access=mmap.ACCESS_READ
+                )
+            except ValueError:  # an empty file can not be mapped
+                self._mmap = None
+        self._view = memoryview(self._mmap if self._mmap else b"")
+        ends = array("q")
+        if index_path is not None:
+            ends = self._load_index(fspath(index_path))
+        count = len(ends)
+        start = ends[-1] if ends else 0
+        _advise(self._mmap, "MADV_SEQUENTIAL")
+        with self._view[start:] as tail:
+            ends.extend(start + end for end in scan(tail))
+        _advise(self._mmap, "MADV_RANDOM")
+        self._ends = ends
+        if index_path is not None and len(ends) != count:
+            self._save_index(fspath(index_path))
+
+    def _load_index(self, index_path: str) -> "array[int]":
+        ends = array("q")
+        try:
+            with open(index_path, "rb") as file:
+                data = file.read()
+        except FileNotFoundError:
+            return ends
+        if len(data) < _INDEX_HEADER.size:
+            return ends
+        magic, count = _INDEX_HEADER.unpack_from(data)
+        size = _INDEX_HEADER.size + 8 * count
+        if magic != _INDEX_MAGIC or len(data) != size:
+            return ends
+        ends.frombytes(data[_INDEX_HEADER.size :])
+        if byteorder == "big":
+            ends.byteswap()
+        if ends:
+            # the last indexed message must still be a message
+            end = ends[-1]
+            start = ends[-2] if len(ends) > 1 else 0
+            if end > len(self._view):
+                return array("q")
+            with self._view[start:end] as last:
+                try:
+                    if scan(last) != [end - start]:
+                        return array("q")
+                except ValueError:
+                    return array("q")
+        return ends
+
+    def _save_index(self, index_path: str) -> None:
+        ends = array("q", self._ends)
+        if byteorder == "big":
+            ends.byteswap()
+        tmp_path = index_path + ".tmp"
+        with open(tmp_path, "wb") as file:
+            file.write(_INDEX_HEADER.pack(_INDEX_MAGIC, len(ends)))
+            file.write(ends.tobytes())
+        replace(tmp_path, index_path)
+
+    def _span(self, idx: int) -> tuple[int, int]:
+        return (self._ends[idx - 1] if idx else 0), self._ends[idx]
+
+    def __len__(self) -> int:
+        return len(self._ends)
+
+    @overload
+    def __getitem__(self, index: int) -> Any: ...
+
+    @overload
+    def __getitem__(self, index: slice) -> list[Any]: ...
+
+    def __getitem__(self, index: int | slice) -> Any:
+        if isinstance(index, slice):
+            return [self[idx] for idx in range(*index.indices(len(self)))]
+        if index < 0:
+            index += len(self._ends)
+        if not 0 <= index < len(self._ends):
+            raise IndexError("MappedFile index out of range")
+        start, end = self._span(index)
+        with self._view[start:end] as message:
+            return self._unpacker.unpackb(message)
+
+    def __iter__(self) -> Iterator[Any]:
+        _advise(self._mmap, "MADV_SEQUENTIAL")
+        try:
+            for idx in range(len(self._ends)):
+                yield self[idx]
+        finally:
+            _advise(self._mmap, "MADV_RANDOM")
+
+    def raw(self, index: int) -> bytes:
+        """
+        Returns ``bytes`` of message *index*, without unpacking it.
+        """
+        if index < 0:
+            index += len(self._ends)
+        if not 0 <= index < len(self._ends):
+            raise IndexError("MappedFile index out of range")
+        start, end = self._span(index)
+        return self._view[start:end].tobytes()
+
+    def close(self) -> None:
+        self._view.release()
+        if self._mmap is not None:
+            self._mmap.close()
+
+    def __enter__(self) -> "MappedFile":
+        return self
+
+    def __exit__(self, *args: object) -> None:
+        self.close()
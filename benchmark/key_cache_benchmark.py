@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""
+Key cache benchmark.
+
+Unpacks maps with a growing number of distinct keys, with the shared
+direct-mapped cache and with own caches of `Unpacker`, and prints
+the speed and the hit rate of every cache.
+"""
+from argparse import ArgumentParser
+from random import Random
+from time import perf_counter
+from typing import Any
+
+from amsgpack import Unpacker, packb
+
+PREFIXES = ("request", "response", "session", "user", "account", "device")
+SUFFIXES = ("correlation_id", "created_at", "updated_at", "status", "name")
+
+
+def make_keys(cardinality: int) -> list[str]:
+    return [
+        f"{PREFIXES[idx % len(PREFIXES)]}_{idx}_"
+        f"{SUFFIXES[idx % len(SUFFIXES)]}"
+        for idx in range(cardinality)
+    ]
+
+
+def make_data(keys: list[str], maps: int) -> bytes:
+    random = Random(0)
+    return packb(
+        [
+            {key: idx for key in random.sample(keys, min(len(keys), 16))}
+            for idx in range(maps)
+        ]
+    )
+
+
+def run(unpacker: "Unpacker[Any]", data: bytes, iterations: int) -> float:
+    start = perf_counter()
+    for _ in range(iterations):
+        unpacker.unpackb(data)
+    return perf_counter() - start
+
+
+def main() -> None:
+    parser = ArgumentParser(description=__doc__)
+    parser.add_argument("--iterations", type=int, default=50)
+    parser.add_argument("--maps", type=int, default=2000)
+    args = parser.parse_args()
+
+    caches: dict[str, dict[str, Any]] = {
+        "shared": {},
+        "512x1/40": {"cache_size": 512, "cache_key_length": 40},
+        "2048x2/40": {
+            "cache_size": 2048,
+            "cache_ways": 2,
+            "cache_key_length": 40,
+        },
+        "4096x4/40": {
+            "cache_size": 4096,
+            "cache_ways": 4,
+            "cache_key_length": 40,
+        },
+    }
+    print(f"{'keys':>6}", *(f"{name:>22}" for name in caches))
+    for cardinality in (16, 128, 512, 2048, 8192):
+        keys = make_keys(cardinality)
+        data = make_data(keys, args.maps)
+        cells: list[str] = []
+        for options in caches.values():
+            unpacker = Unpacker(**options)
+            unpacker.unpackb(data)  # warm up
+            before = unpacker.cache_info()
+            elapsed = run(unpacker, data, args.iterations)
+            info = unpacker.cache_info()
+            hits = info["hits"] - before["hits"]
+            misses = info["misses"] - before["misses"]
+            speed = args.iterations * len(data) / elapsed / 2**20
+            rate = hits / max(hits + misses, 1) * 100
+            cells.append(f"{speed:>8.1f} MiB/s {rate:>5.1f}%")
+        print(f"{cardinality:>6}", *(f"{cell:>22}" for cell in cells))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Multi-threaded `unpackb` benchmark.
+
+On a free-threaded build (python3.13t and later) the throughput should grow
+linearly with the number of threads, as every thread decodes with its own
+key cache. With the GIL it stays flat.
+"""
+from argparse import ArgumentParser
+from concurrent.futures import ThreadPoolExecutor
+from os import cpu_count
+import sys
+from threading import Barrier
+from time import perf_counter
+
+from amsgpack import packb, unpackb
+
+
+def make_data() -> bytes:
+    return packb(
+        [
+            {
+                "id": idx,
+                "name": f"user{idx}",
+                "active": idx % 2 == 0,
+                "score": idx / 7,
+                "tags": ["a", "b", "c"],
+            }
+            for idx in range(1000)
+        ]
+    )
+
+
+def run(threads: int, iterations: int, data: bytes) -> float:
+    barrier = Barrier(threads)
+
+    def work() -> None:
+        barrier.wait()
+        for _ in range(iterations):
+            unpackb(data)
+
+    with ThreadPoolExecutor(threads) as executor:
+        start = perf_counter()
+        futures = [executor.submit(work) for _ in range(threads)]
+        for future in futures:
+            future.result()
+        return perf_counter() - start
+
+
+def main() -> None:
+    parser = ArgumentParser(description=__doc__)
+    parser.add_argument("--iterations", type=int, default=200)
+    parser.add_argument("--max-threads", type=int, default=cpu_count() or 1)
+    args = parser.parse_args()
+
+    data = make_data()
+    gil_enabled = getattr(sys, "_is_gil_enabled", lambda: True)()
+    print(f"Python {sys.version.split()[0]}, GIL enabled: {gil_enabled}")
+    base = None
+    print(f"{'threads':>7} {'MiB/s':>10} {'scaling':>8}")
+    threads = 1
+    while threads <= args.max_threads:
+        elapsed = run(threads, args.iterations, data)
+        speed = threads * args.iterations * len(data) / elapsed / 2**20
+        if base is None:
+            base = speed
+        print(f"{threads:>7} {speed:>10.1f} {speed / base:>8.2f}")
+        threads *= 2
+
+
+if __name__ == "__main__":
+    main()
@@ -6,34 +6,51 @@
 #define EMPTY_TUPLE_IDX 0xc4
 #define EMPTY_STRING_IDX 0xa0
 
-// currently we only store fixstr keys in cache, so the size is 15 + 1
+// the shared key cache, `Unpacker(cache_size=...)` makes its own
 #define MAX_CACHE_LEN 16
 #define CACHE_TABLE_SIZE (1 << 9)
+// `Unpacker(cache_values=True)` cache of short string values
+#define VALUE_CACHE_SIZE (1 << 10)
+#define VALUE_CACHE_WAYS 2
+#define VALUE_CACHE_MAX_LEN 32
 
-typedef struct {
-  uint32_t hash;
-  uint16_t len;
-  PyObject* obj;
-  uint8_t data[MAX_CACHE_LEN];
-} CacheEntry;
+// without the GIL every thread has its own key cache, so the hit path
+// has no locks and no shared writes
+#if defined(Py_GIL_DISABLED) && !defined(A_PER_THREAD_CACHE)
+#define A_PER_THREAD_CACHE
+#endif
 
-static inline void reset_cache_entry(CacheEntry* entry) {
-  // reset, so that cache entry won't match after obj is destroyed
-  entry->hash = 0;
-  entry->len = 0xffff;
-  entry->obj = NULL;
-}
+#ifdef Py_GIL_DISABLED
+#define A_ATOMIC_LOAD_INT(ptr) _Py_atomic_load_int_relaxed(ptr)
+#define A_ATOMIC_INCREMENT_INT(ptr) _Py_atomic_add_int(ptr, 1)
+#else
+#define A_ATOMIC_LOAD_INT(ptr) (*(ptr))
+#define A_ATOMIC_INCREMENT_INT(ptr) (*(ptr) += 1)
+#endif
+
+#include "key_cache.h"
 
 typedef struct {
   PyObject* byte_object[256];
   PyTypeObject* ext_type;
   PyTypeObject* raw_type;
   PyTypeObject* packer_type;
+  PyTypeObject* compiled_packer_type;
+  PyTypeObject* pack_buffer_type;
   PyTypeObject* unpacker_type;
   PyTypeObject* file_unpacker_type;
+  PyTypeObject* lazy_map_type;
+  PyTypeObject* lazy_array_type;
   PyTypeObject* timestamp_type;
+  PyObject* array_type;  // `array.array` for typed arrays
+  uint32_t key_cache_seed;
+#ifdef A_PER_THREAD_CACHE
+  int gc_epoch;                // number of `amsgpack_traverse` calls
+  PyObject* thread_cache_key;  // `ThreadCache` capsule key in thread dict
+#else
   int_fast8_t gc_cycle;
-  CacheEntry unicode_cache[CACHE_TABLE_SIZE];
+  KeyCache* unicode_cache;
+#endif
 } AMsgPackState;
 
 static inline AMsgPackState* get_amsgpack_state(PyObject* module) {
@@ -53,6 +70,7 @@ static PyObject* AnyUnpacker_iter(PyObject* self) {
 #include "unpacker.h"
 // include unpacker before file_unpacker
 #include "file_unpacker.h"
+#include "scan.h"
 #define VERSION "0.4.0"
 
 /*
@@ -99,6 +117,36 @@ static int amsgpack_exec(PyObject* module) {
   if (amsgpack_init_state(state) != 0) {
     return -1;
   }
+  PyObject* array_module = PyImport_ImportModule("array");
+  if (array_module == NULL) {
+    return -1;
+  }
+  state->array_type = PyObject_GetAttrString(array_module, "array");
+  Py_DECREF(array_module);
+  if (state->array_type == NULL) {
+    return -1;
+  }
+  // hash of a constant `str` is random, unless PYTHONHASHSEED is set
+  PyObject* seed_str = PyUnicode_FromString("amsgpack.key_cache");
+  if (seed_str == NULL) {
+    return -1;
+  }
+  Py_hash_t const seed_hash = PyObject_Hash(seed_str);
+  Py_DECREF(seed_str);
+  state->key_cache_seed = (uint32_t)((uint64_t)seed_hash ^
+                                     ((uint64_t)seed_hash >> 32));
+#ifdef A_PER_THREAD_CACHE
+  state->thread_cache_key = PyUnicode_InternFromString("amsgpack.key_cache");
+  if (state->thread_cache_key == NULL) {
+    return -1;
+  }
+#else
+  state->unicode_cache = key_cache_new(CACHE_TABLE_SIZE, 1, MAX_CACHE_LEN,
+                                       state->key_cache_seed);
+  if (state->unicode_cache == NULL) {
+    return -1;
+  }
+#endif
 #define ADD_TYPE(TypeName, type_name)                                          \
   state->type_name##_type =                                                    \
       (PyTypeObject*)PyType_FromModuleAndSpec(module, &TypeName##_spec, NULL); \
@@ -114,8 +162,12 @@ static int amsgpack_exec(PyObject* module) {
   ADD_TYPE(Ext, ext);
   ADD_TYPE(Raw, raw);
   ADD_TYPE(Packer, packer);
+  ADD_TYPE(CompiledPacker, compiled_packer);
+  ADD_TYPE(PackBuffer, pack_buffer);
   ADD_TYPE(Unpacker, unpacker);
   ADD_TYPE(FileUnpacker, file_unpacker);
+  ADD_TYPE(LazyMap, lazy_map);
+  ADD_TYPE(LazyArray, lazy_array);
   ADD_TYPE(Timestamp, timestamp);
 #undef ADD_TYPE
   // create `unpackb`
@@ -124,10 +176,17 @@ static int amsgpack_exec(PyObject* module) {
     return -1;
   }
   PyObject* unpackb = PyObject_GetAttrString(unpacker, "unpackb");
+  PyObject* extract = PyObject_GetAttrString(unpacker, "extract");
   Py_DECREF(unpacker);
   if (PyModule_AddObjectRef(module, "unpackb", unpackb) < 0) {
     return -1;
   }
+  // create `extract`
+  int const extract_result = PyModule_AddObjectRef(module, "extract", extract);
+  Py_XDECREF(extract);
+  if (extract_result < 0) {
+    return -1;
+  }
   // create `packb`
   PyObject* packer = PyObject_CallNoArgs((PyObject*)state->packer_type);
   if A_UNLIKELY(packer == NULL) {
@@ -156,25 +215,21 @@ END_NO_PEDANTIC
 static int amsgpack_traverse(PyObject* module, visitproc Py_UNUSED(visit),
                              void* Py_UNUSED(arg)) {
   AMsgPackState* state = get_amsgpack_state(module);
+#ifdef A_PER_THREAD_CACHE
+  // thread caches are evicted by their threads, see `get_unicode_cache`
+  A_ATOMIC_INCREMENT_INT(&state->gc_epoch);
+#else
   state->gc_cycle++;
   // amsgpack_traverse is usually called two times in a row, so:
-  if ((state->gc_cycle & 1) == 1) {
+  // the cache is made in `amsgpack_exec`, the collector may run before
+  if ((state->gc_cycle & 1) == 1 && state->unicode_cache != NULL) {
     int_fast8_t clear_part = state->gc_cycle / 2;
     if (clear_part > 7) {
       clear_part = state->gc_cycle = 0;
     }
-    int const stride_el = CACHE_TABLE_SIZE / 8;
-    for (int i = clear_part * stride_el; i < clear_part * stride_el + stride_el;
-         ++i) {
-      PyObject* obj = state->unicode_cache[i].obj;
-      // Technically, another module can hold strings in its cache
-      // and we will never clear memory. Do not know what to do about it.
-      if (obj != NULL && Py_REFCNT(obj) == 1) {
-        Py_DECREF(obj);
-        reset_cache_entry(state->unicode_cache + i);
-      }
-    }
+    evict_cache_part(state->unicode_cache, clear_part);
   }
+#endif
   return 0;
 }
 
@@ -187,13 +242,21 @@ static void amsgpack_free(void* module) {
   Py_XDECREF(state->ext_type);
   Py_XDECREF(state->raw_type);
   Py_XDECREF(state->packer_type);
+  Py_XDECREF(state->compiled_packer_type);
+  Py_XDECREF(state->pack_buffer_type);
   Py_XDECREF(state->unpacker_type);
   Py_XDECREF(state->file_unpacker_type);
+  Py_XDECREF(state->lazy_map_type);
+  Py_XDECREF(state->lazy_array_type);
   Py_XDECREF(state->timestamp_type);
-  for (unsigned int i = 0; i < CACHE_TABLE_SIZE; ++i) {
-    Py_XDECREF(state->unicode_cache[i].obj);
-    reset_cache_entry(state->unicode_cache + i);  // as a good practice
-  }
+  Py_XDECREF(state->array_type);
+#ifdef A_PER_THREAD_CACHE
+  // thread caches are released with their thread states
+  Py_XDECREF(state->thread_cache_key);
+#else
+  key_cache_free(state->unicode_cache);
+  state->unicode_cache = NULL;
+#endif
 }
 
 PyDoc_STRVAR(amsgpack_doc,
@@ -205,10 +268,19 @@ PyDoc_STRVAR(amsgpack_doc,
              "   >>> unpackb(b'\\x82\\xa7compact\\xc3\\xa6schema\\x00')\n"
              "   {'compact': True, 'schema': 0}\n");
 
+static PyMethodDef amsgpack_methods[] = {
+    {"scan", (PyCFunction)(void (*)(void))amsgpack_scan,
+     METH_VARARGS | METH_KEYWORDS, amsgpack_scan_doc},
+    {"validate", (PyCFunction)(void (*)(void))amsgpack_validate,
+     METH_VARARGS | METH_KEYWORDS, amsgpack_validate_doc},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
 static struct PyModuleDef amsgpack_module = {.m_base = PyModuleDef_HEAD_INIT,
                                              .m_name = "_amsgpack",
                                              .m_doc = amsgpack_doc,
                                              .m_size = sizeof(AMsgPackState),
+                                             .m_methods = amsgpack_methods,
                                              .m_slots = amsgpack_slots,
                                              .m_traverse = amsgpack_traverse,
                                              .m_free = amsgpack_free};
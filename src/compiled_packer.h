@@ -0,0 +1,371 @@
+#include <Python.h>
+
+/*
+  `Packer.compile` result. Map and array headers, keys and constants of the
+  template are encoded once, `pack` copies them as is and packs only the
+  values in between. Values of the compiled exact type are packed inline,
+  any other value goes through `packb_write`, so it is packed as usual.
+*/
+
+enum CompiledSlot {
+  SLOT_ANY,
+  SLOT_INT,
+  SLOT_FLOAT,
+  SLOT_STR,
+  SLOT_BYTES,
+  SLOT_BOOL,
+  SLOT_END  // trailing encoded bytes, no value
+};
+
+typedef struct {
+  Py_ssize_t literal_size;  // number of encoded bytes before the value
+  enum CompiledSlot slot;
+} CompiledOp;
+
+typedef struct {
+  PyObject_HEAD
+  Packer* packer;
+  Py_ssize_t size_hint;  // the same as `Packer.size_hint`
+  Py_ssize_t length;     // number of `pack` values
+  char* literal;         // encoded bytes of every operation back-to-back
+  CompiledOp* ops;       // `length + 1` operations, the last is SLOT_END
+} CompiledPacker;
+
+// writes length header to `dst` that has at least 5 bytes, `fix_max` is the
+// maximal length of the fix form, `header8` is 0 when there is no 8 bit form
+// returns: number of written bytes or 0, when `length` is out of range
+static inline Py_ssize_t put_length_header(char* dst, Py_ssize_t length,
+                                           char fix, Py_ssize_t fix_max,
+                                           char header8, char header16,
+                                           char header32) {
+  if (length <= fix_max) {
+    *dst = fix + (char)length;
+    return 1;
+  } else if (header8 != 0 && length <= 0xff) {
+    put2(dst, header8, (char)length);
+    return 2;
+  } else if (length <= 0xffff) {
+    put3(dst, header16, (uint16_t)length);
+    return 3;
+  } else if (length <= 0xffffffff) {
+    put5(dst, header32, (uint32_t)length);
+    return 5;
+  }
+  return 0;
+}
+
+typedef struct {
+  Packer* packer;
+  PackbWriter literal;  // `CompiledPacker.literal`
+  Py_ssize_t literal_start;  // `literal.size` after the last operation
+  CompiledOp* ops;
+  Py_ssize_t length;  // number of `ops`
+  Py_ssize_t ops_capacity;
+} CompiledBuilder;
+
+// returns: -1 - failure
+//           0 - success
+static int compiled_add_op(CompiledBuilder* builder, enum CompiledSlot slot) {
+  if (builder->length == builder->ops_capacity) {
+    Py_ssize_t const capacity = builder->ops_capacity * 2 + 8;
+    CompiledOp* ops = (CompiledOp*)PyMem_Realloc(
+        builder->ops, sizeof(CompiledOp) * (size_t)capacity);
+    if A_UNLIKELY(ops == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    builder->ops = ops;
+    builder->ops_capacity = capacity;
+  }
+  builder->ops[builder->length++] = (CompiledOp){
+      .literal_size = builder->literal.size - builder->literal_start,
+      .slot = slot};
+  builder->literal_start = builder->literal.size;
+  return 0;
+}
+
+// returns: -1 - failure
+//           0 - success
+static int compiled_add_header(CompiledBuilder* builder, Py_ssize_t length,
+                               int is_map) {
+  PackbWriter* literal = &builder->literal;
+  if (literal->capacity < literal->size + 5 &&
+      packb_reserve_mem(literal, 5) != 0) {
+    return -1;
+  }
+  Py_ssize_t const written =
+      is_map ? put_length_header(literal->data + literal->size, length,
+                                 '\x80', 0xf, 0, '\xde', '\xdf')
+             : put_length_header(literal->data + literal->size, length,
+                                 '\x90', 0xf, 0, '\xdc', '\xdd');
+  if A_UNLIKELY(written == 0) {
+    PyErr_SetString(PyExc_ValueError, "Template is too long");
+    return -1;
+  }
+  literal->size += written;
+  return 0;
+}
+
+// adds `template` to `builder`: types become `pack` values, dicts, lists
+// and tuples are walked, other objects are encoded as constants
+// returns: -1 - failure
+//           0 - success
+static int compiled_add(CompiledBuilder* builder, PyObject* template) {
+  if (PyType_Check(template)) {
+    enum CompiledSlot slot = SLOT_ANY;
+    if (template == (PyObject*)&PyLong_Type) {
+      slot = SLOT_INT;
+    } else if (template == (PyObject*)&PyFloat_Type) {
+      slot = SLOT_FLOAT;
+    } else if (template == (PyObject*)&PyUnicode_Type) {
+      slot = SLOT_STR;
+    } else if (template == (PyObject*)&PyBytes_Type) {
+      slot = SLOT_BYTES;
+    } else if (template == (PyObject*)&PyBool_Type) {
+      slot = SLOT_BOOL;
+    }
+    return compiled_add_op(builder, slot);
+  }
+  int const is_map = PyDict_CheckExact(template);
+  if (!is_map && !PyList_CheckExact(template) &&
+      !PyTuple_CheckExact(template)) {
+    return packb_write(builder->packer, template, &builder->literal);
+  }
+  if A_UNLIKELY(Py_EnterRecursiveCall(" while compiling a template") != 0) {
+    return -1;
+  }
+  int result = compiled_add_header(builder, PyObject_Length(template), is_map);
+  if (is_map) {
+    Py_ssize_t pos = 0;
+    PyObject* key;
+    PyObject* value;
+    while (result == 0 && PyDict_Next(template, &pos, &key, &value)) {
+      result = packb_write(builder->packer, key, &builder->literal);
+      if A_LIKELY(result == 0) {
+        result = compiled_add(builder, value);
+      }
+    }
+  } else {
+    PyObject* const* items = PySequence_Fast_ITEMS(template);
+    Py_ssize_t const length = PySequence_Fast_GET_SIZE(template);
+    for (Py_ssize_t idx = 0; result == 0 && idx < length; ++idx) {
+      result = compiled_add(builder, items[idx]);
+    }
+  }
+  Py_LeaveRecursiveCall();
+  return result;
+}
+
+static PyObject* packer_compile(Packer* self, PyObject* template) {
+  CompiledBuilder builder = {.packer = self,
+                             .literal = {.data = NULL,
+                                         .size = 0,
+                                         .capacity = 0,
+                                         .reserve = packb_reserve_mem,
+                                         .payload = packb_payload_copy},
+                             .literal_start = 0,
+                             .ops = NULL,
+                             .length = 0,
+                             .ops_capacity = 0};
+  if A_UNLIKELY(compiled_add(&builder, template) != 0 ||
+                compiled_add_op(&builder, SLOT_END) != 0) {
+    goto error;
+  }
+  CompiledPacker* compiled =
+      PyObject_GC_New(CompiledPacker, self->state->compiled_packer_type);
+  if A_UNLIKELY(compiled == NULL) {
+    goto error;
+  }
+  Py_INCREF(self);
+  compiled->packer = self;
+  compiled->size_hint = 0;
+  compiled->length = builder.length - 1;
+  compiled->literal = builder.literal.data;
+  compiled->ops = builder.ops;
+  PyObject_GC_Track(compiled);
+  return (PyObject*)compiled;
+error:
+  PyMem_Free(builder.literal.data);
+  PyMem_Free(builder.ops);
+  return NULL;
+}
+
+static PyObject* CompiledPacker_pack(CompiledPacker* self, PyObject* args) {
+  Py_ssize_t const nargs = PyTuple_GET_SIZE(args);
+  if A_UNLIKELY(nargs != self->length) {
+    PyErr_Format(PyExc_TypeError, "pack() takes %zd values (%zd given)",
+                 self->length, nargs);
+    return NULL;
+  }
+  char scratch[PACKB_SCRATCH_SIZE];
+  PackbWriter packb_writer = {.data = scratch,
+                              .size = 0,
+                              .capacity = PACKB_SCRATCH_SIZE,
+                              .reserve = packb_reserve_bytes,
+                              .payload = packb_payload_copy,
+                              .buffer_py = NULL};
+  PackbWriter* writer = &packb_writer;
+  if A_UNLIKELY(packb_writer_use_size_hint(self->size_hint, writer) != 0) {
+    return NULL;
+  }
+  char* data = writer->data;
+  Py_ssize_t size = writer->size;
+  Py_ssize_t capacity = writer->capacity;
+  Packer* packer = self->packer;
+  char const* literal = self->literal;
+  PyObject* const* values = &PyTuple_GET_ITEM(args, 0);
+  for (CompiledOp const* op = self->ops;; ++op, ++values) {
+    AMSGPACK_PAYLOAD(literal, op->literal_size);
+    literal += op->literal_size;
+    if (op->slot == SLOT_END) {
+      break;
+    }
+    PyObject* value = *values;
+    switch (op->slot) {
+      case SLOT_INT:
+        if A_LIKELY(PyLong_CheckExact(value)) {
+          int overflow;
+          long long const number =
+              PyLong_AsLongLongAndOverflow(value, &overflow);
+          if A_LIKELY(overflow == 0) {
+            AMSGPACK_RESIZE(9);
+            size += put_long_long(data + size, number);
+            continue;
+          }
+        }
+        break;
+      case SLOT_FLOAT:
+        if A_LIKELY(PyFloat_CheckExact(value)) {
+          AMSGPACK_RESIZE(9);
+          if A_UNLIKELY(packer->compact_floats != COMPACT_FLOATS_DISABLED) {
+            size += put_compact_double(data + size, PyFloat_AS_DOUBLE(value),
+                                       packer->compact_floats);
+          } else {
+            put9_dbl(data + size, '\xcb', PyFloat_AS_DOUBLE(value));
+            size += 9;
+          }
+          continue;
+        }
+        break;
+      case SLOT_STR:
+        if A_LIKELY(PyUnicode_CheckExact(value) &&
+                    PyUnicode_IS_COMPACT_ASCII(value)) {
+          Py_ssize_t const length = ((PyASCIIObject*)value)->length;
+          AMSGPACK_RESIZE(5);
+          Py_ssize_t const written = put_length_header(
+              data + size, length, '\xa0', 0xf, '\xd9', '\xda', '\xdb');
+          if A_LIKELY(written != 0) {
+            size += written;
+            AMSGPACK_PAYLOAD((char const*)(((PyASCIIObject*)value) + 1),
+                             length);
+            continue;
+          }
+        }
+        break;
+      case SLOT_BYTES:
+        if A_LIKELY(PyBytes_CheckExact(value)) {
+          Py_ssize_t const length = PyBytes_GET_SIZE(value);
+          AMSGPACK_RESIZE(5);
+          Py_ssize_t const written = put_length_header(
+              data + size, length, 0, -1, '\xc4', '\xc5', '\xc6');
+          if A_LIKELY(written != 0) {
+            size += written;
+            AMSGPACK_PAYLOAD(PyBytes_AS_STRING(value), length);
+            continue;
+          }
+        }
+        break;
+      case SLOT_BOOL:
+        if A_LIKELY(value == Py_True || value == Py_False) {
+          AMSGPACK_RESIZE(1);
+          data[size] = value == Py_True ? '\xc3' : '\xc2';
+          size += 1;
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    // the value is not of the compiled type, pack it as usual
+    writer->size = size;
+    if A_UNLIKELY(packb_write(packer, value, writer) != 0) {
+      goto error;
+    }
+    data = writer->data;
+    size = writer->size;
+    capacity = writer->capacity;
+  }
+  writer->size = size;
+  update_size_hint(&self->size_hint, size);
+  return packb_writer_to_bytes(writer);
+error:
+  Py_XDECREF(writer->buffer_py);
+  return NULL;
+}
+
+static int CompiledPacker_traverse(CompiledPacker* self, visitproc visit,
+                                   void* arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->packer);
+  return 0;
+}
+
+// the packer `default` may reference the template
+static int CompiledPacker_clear(CompiledPacker* self) {
+  Py_CLEAR(self->packer);
+  return 0;
+}
+
+static void CompiledPacker_dealloc(CompiledPacker* self) {
+  PyObject_GC_UnTrack(self);
+  CompiledPacker_clear(self);
+  PyMem_Free(self->literal);
+  PyMem_Free(self->ops);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* CompiledPacker_get_length(CompiledPacker* self,
+                                           void* Py_UNUSED(closure)) {
+  return PyLong_FromSsize_t(self->length);
+}
+
+PyDoc_STRVAR(
+    CompiledPacker_pack_doc,
+    "pack($self, /, *values)\n--\n\n"
+    "Serialize the template with ``values`` in place of its types, in the "
+    "template order. Returns ``bytes`` equal to :meth:`Packer.packb` of the "
+    "filled template.");
+
+static PyMethodDef CompiledPacker_methods[] = {
+    {"pack", (PyCFunction)CompiledPacker_pack, METH_VARARGS,
+     CompiledPacker_pack_doc},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
+static PyGetSetDef CompiledPacker_getset[] = {
+    {"length", (getter)CompiledPacker_get_length, NULL,
+     "Number of :meth:`pack` values", NULL},
+    {NULL, NULL, NULL, NULL, NULL}  // Sentinel
+};
+
+PyDoc_STRVAR(CompiledPacker_doc,
+             "Message template returned by :meth:`Packer.compile`.");
+
+BEGIN_NO_PEDANTIC
+static PyType_Slot CompiledPacker_slots[] = {
+    {Py_tp_doc, (char*)CompiledPacker_doc},
+    {Py_tp_dealloc, (destructor)CompiledPacker_dealloc},
+    {Py_tp_traverse, CompiledPacker_traverse},
+    {Py_tp_clear, CompiledPacker_clear},
+    {Py_tp_methods, CompiledPacker_methods},
+    {Py_tp_getset, CompiledPacker_getset},
+    {0, NULL}};
+END_NO_PEDANTIC
+
+static PyType_Spec CompiledPacker_spec = {
+    .name = "amsgpack.CompiledPacker",
+    .basicsize = sizeof(CompiledPacker),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+             Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = CompiledPacker_slots,
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <Python.h>
+
+/*
+  Memory of `Ext` and `Raw` data. `bytes` are used as is, other bytes-like
+  objects, like `memoryview`, `bytearray` or `mmap`, are exported once, so
+  the packer writes straight from them without making `bytes` first.
+*/
+
+// returns: -1 - failure (exception is set)
+//           0 - success, `view->obj` is NULL for `bytes`
+static int data_view_init(Py_buffer* view, PyObject* data,
+                          char const* argument) {
+  if A_LIKELY(PyBytes_CheckExact(data)) {
+    view->buf = PyBytes_AS_STRING(data);
+    view->len = PyBytes_GET_SIZE(data);
+    view->obj = NULL;
+    return 0;
+  }
+  if A_UNLIKELY(!PyObject_CheckBuffer(data)) {
+    PyErr_Format(PyExc_TypeError, "%s must be bytes-like object, not %.100s",
+                 argument, Py_TYPE(data)->tp_name);
+    return -1;
+  }
+  // contiguous memory only, `memoryview` slices with steps are refused
+  return PyObject_GetBuffer(data, view, PyBUF_SIMPLE);
+}
+
+static inline void data_view_release(Py_buffer* view) {
+  if (view->obj != NULL) {
+    PyBuffer_Release(view);
+  }
+}
@@ -4,10 +4,14 @@
 
 /*
  double-ended queue
+
+ Nodes hold buffer exports of the fed objects (`bytes`, `bytearray`,
+ `memoryview`, `mmap`, ...), so nothing is copied, and the export is kept
+ until the node is consumed.
 */
 
 typedef struct BytesNode {
-  PyObject *bytes;
+  Py_buffer view;
   struct BytesNode *next;
 } BytesNode;
 
@@ -26,7 +30,7 @@ static inline void deque_pop_first(Deque *deque, Py_ssize_t size_first) {
   assert(deque->deque_first);
   assert(deque->deque_last);
   BytesNode *next = deque->deque_first->next;
-  Py_DECREF(deque->deque_first->bytes);
+  PyBuffer_Release(&deque->deque_first->view);
   PyMem_Free(deque->deque_first);
   if (next == NULL) {
     deque->deque_first = deque->deque_last = next;
@@ -34,8 +38,8 @@ static inline void deque_pop_first(Deque *deque, Py_ssize_t size_first) {
     // deque->size_first = 0;
   } else {
     deque->deque_first = next;
-    deque->deque_bytes = PyBytes_AS_STRING(next->bytes);
-    deque->size_first = PyBytes_GET_SIZE(next->bytes);
+    deque->deque_bytes = (char const *)next->view.buf;
+    deque->size_first = next->view.len;
   }
   deque->pos = 0;
   deque->size -= size_first;
@@ -50,26 +54,33 @@ static inline void deque_clean(Deque *deque) {
   deque->size_first = 0;
 }
 
-// returns: -1 - failure
+// returns: -1 - failure (exception is set)
 //           0 - success
 //           1 - no op, when bytes size is 0
-static inline int deque_append(Deque *deque, PyObject *bytes) {
-  Py_ssize_t const bytes_size = PyBytes_GET_SIZE(bytes);
-  if A_UNLIKELY(bytes_size == 0) {
-    return 1;
-  }
+static inline int deque_append(Deque *deque, PyObject *data) {
   BytesNode *new_node = (BytesNode *)PyMem_Malloc(sizeof(BytesNode));
   if A_UNLIKELY(new_node == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  // contiguous memory only, for `bytes` it is a pointer and an incref
+  if A_UNLIKELY(PyObject_GetBuffer(data, &new_node->view, PyBUF_SIMPLE) !=
+                0) {
+    PyMem_Free(new_node);
     return -1;
   }
-  Py_INCREF(bytes);
-  new_node->bytes = bytes;
+  Py_ssize_t const bytes_size = new_node->view.len;
+  if A_UNLIKELY(bytes_size == 0) {
+    PyBuffer_Release(&new_node->view);
+    PyMem_Free(new_node);
+    return 1;
+  }
   new_node->next = NULL;
   if (deque->deque_first == NULL) {
     // deque init
     assert(deque->deque_last == NULL);
     deque->deque_first = deque->deque_last = new_node;
-    deque->deque_bytes = PyBytes_AS_STRING(bytes);
+    deque->deque_bytes = (char const *)new_node->view.buf;
     deque->size_first = bytes_size;
   } else {
     // deque append
@@ -80,6 +91,36 @@ static inline int deque_append(Deque *deque, PyObject *bytes) {
   return 0;
 }
 
+// appends `size` bytes at `start` of `obj`, that is exported by the caller,
+// so `start` stays valid, used to unpack a part of a message
+// returns: -1 - failure (exception is set)
+//           0 - success
+static int deque_append_part(Deque *deque, PyObject *obj, char const *start,
+                             Py_ssize_t size) {
+  assert(size > 0);
+  assert(deque->deque_first == NULL);
+  BytesNode *new_node = (BytesNode *)PyMem_Malloc(sizeof(BytesNode));
+  if A_UNLIKELY(new_node == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  // own export, so payload views of `bin_type="memoryview"` work as usual
+  if A_UNLIKELY(PyObject_GetBuffer(obj, &new_node->view, PyBUF_SIMPLE) < 0) {
+    PyMem_Free(new_node);
+    return -1;
+  }
+  assert(start >= (char const *)new_node->view.buf &&
+         start + size <= (char const *)new_node->view.buf + new_node->view.len);
+  new_node->view.buf = (void *)start;
+  new_node->view.len = size;
+  new_node->next = NULL;
+  deque->deque_first = deque->deque_last = new_node;
+  deque->deque_bytes = start;
+  deque->size_first = size;
+  deque->size = size;
+  return 0;
+}
+
 static inline int deque_has_next_byte(Deque const *deque) {
   return deque->pos < deque->size;
 }
@@ -118,8 +159,8 @@ static char *deque_read_bytes(Deque *const deque,
   Py_ssize_t left_to_copy = requested_size - copy_size;
   assert(left_to_copy > 0);
   for (Py_ssize_t char_idx = copy_size; char_idx < requested_size;) {
-    Py_ssize_t const iter_size = PyBytes_GET_SIZE(deque->deque_first->bytes);
-    char const *iter_data = PyBytes_AS_STRING(deque->deque_first->bytes);
+    Py_ssize_t const iter_size = deque->deque_first->view.len;
+    char const *iter_data = (char const *)deque->deque_first->view.buf;
     Py_ssize_t copy_size = Py_MIN(iter_size, left_to_copy);
     memcpy(new_mem + char_idx, iter_data, copy_size);
     left_to_copy -= copy_size;
@@ -175,14 +216,14 @@ static inline Py_ssize_t deque_peek_size(Deque const *deque,
     start = deque->deque_bytes + pos;
   } else {
     Py_ssize_t copy_size = size_first - pos;
+    memcpy(ret, deque->deque_bytes + pos, copy_size);
     start = ret;
-    memcpy(&ret, start, copy_size);
     BytesNode *cur = deque->deque_first->next;
     Py_ssize_t left_to_copy = requested_size - copy_size;
     assert(left_to_copy > 0);
     for (Py_ssize_t char_idx = copy_size; char_idx < requested_size;) {
-      Py_ssize_t const iter_size = PyBytes_GET_SIZE(cur->bytes);
-      char const *iter_data = PyBytes_AS_STRING(cur->bytes);
+      Py_ssize_t const iter_size = cur->view.len;
+      char const *iter_data = (char const *)cur->view.buf;
       copy_size = Py_MIN(iter_size, left_to_copy);
       memcpy(ret + char_idx, iter_data, copy_size);
       left_to_copy -= copy_size;
@@ -233,7 +274,7 @@ static inline void deque_skip_size(Deque *deque, Py_ssize_t size) {
   deque_pop_first(deque, size_first);
   Py_ssize_t left_to_skip = size + 1 - skip_size;
   for (Py_ssize_t char_idx = skip_size; char_idx <= size;) {
-    Py_ssize_t const iter_size = PyBytes_GET_SIZE(deque->deque_first->bytes);
+    Py_ssize_t const iter_size = deque->deque_first->view.len;
     skip_size = Py_MIN(iter_size, left_to_skip);
     left_to_skip -= skip_size;
     if (skip_size == iter_size) {
@@ -244,3 +285,60 @@ static inline void deque_skip_size(Deque *deque, Py_ssize_t size) {
     char_idx += iter_size;
   }
 }
+
+// advances the deque by `size` bytes, that are in the deque
+static void deque_advance(Deque *deque, Py_ssize_t size) {
+  assert(deque->pos + size <= deque->size);
+  while (size != 0) {
+    Py_ssize_t const size_first = deque->size_first;
+    Py_ssize_t const room = size_first - deque->pos;
+    if (size < room) {
+      deque->pos += size;
+      return;
+    }
+    size -= room;
+    deque_pop_first(deque, size_first);
+  }
+}
+
+/*
+  Reading ahead without consuming, to find where a message ends
+*/
+
+typedef struct {
+  BytesNode const *node;  // NULL at the end of the deque
+  Py_ssize_t offset;      // in `node`
+} DequeCursor;
+
+// copies up to `size` bytes at `cursor` to `dst`
+// returns: number of copied bytes
+static Py_ssize_t deque_cursor_peek(DequeCursor cursor, char *dst,
+                                    Py_ssize_t size) {
+  Py_ssize_t copied = 0;
+  while (copied < size && cursor.node != NULL) {
+    Py_ssize_t const chunk =
+        Py_MIN(size - copied, cursor.node->view.len - cursor.offset);
+    memcpy(dst + copied, (char const *)cursor.node->view.buf + cursor.offset,
+           chunk);
+    copied += chunk;
+    cursor.node = cursor.node->next;
+    cursor.offset = 0;
+  }
+  return copied;
+}
+
+// returns: -1 - the deque ends before `size` bytes
+//           0 - success
+static int deque_cursor_advance(DequeCursor *cursor, Py_ssize_t size) {
+  while (cursor->node != NULL) {
+    Py_ssize_t const room = cursor->node->view.len - cursor->offset;
+    if (size < room) {
+      cursor->offset += size;
+      return 0;
+    }
+    size -= room;
+    cursor->node = cursor->node->next;
+    cursor->offset = 0;
+  }
+  return size == 0 ? 0 : -1;
+}
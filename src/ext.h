@@ -2,38 +2,49 @@
 #include <Python.h>
 #include <structmember.h>  // PyMemberDef
 
+#include "data_view.h"
 #include "timestamp.h"
 
 typedef struct {
   PyObject_HEAD
   char code;
   PyObject *data;
+  Py_buffer view;  // memory of `data`
 } Ext;
 
 static PyMemberDef Ext_members[] = {
     {"code", T_BYTE, offsetof(Ext, code), READONLY, "Ext code (int)"},
-    {"data", T_OBJECT_EX, offsetof(Ext, data), READONLY, "Ext data (bytes)"},
+    {"data", T_OBJECT_EX, offsetof(Ext, data), READONLY,
+     "Ext data (bytes-like object)"},
     {NULL, 0, 0, 0, NULL}  // Sentinel
 };
 
 static int Ext_init(Ext *self, PyObject *args, PyObject *kwargs) {
   int code = 0;
+  PyObject *data = NULL;
   static char *kwlist[] = {"code", "data", NULL};
-  if A_UNLIKELY(!PyArg_ParseTupleAndKeywords(args, kwargs, "iO!:Ext", kwlist,
-                                             &code, &PyBytes_Type,
-                                             &self->data)) {
+  if A_UNLIKELY(!PyArg_ParseTupleAndKeywords(args, kwargs, "iO:Ext", kwlist,
+                                             &code, &data)) {
     return -1;
   }
   if A_UNLIKELY(code < -128 || code > 127) {
     PyErr_SetString(PyExc_ValueError, "`code` must be between -128 and 127");
     return -1;
   }
+  Py_buffer view;
+  if A_UNLIKELY(data_view_init(&view, data, "Ext() argument 2") != 0) {
+    return -1;
+  }
+  data_view_release(&self->view);
+  Py_INCREF(data);
+  Py_XSETREF(self->data, data);
+  self->view = view;
   self->code = (char)code;
-  Py_INCREF(self->data);
   return 0;
 }
 
 static void Ext_dealloc(Ext *self) {
+  data_view_release(&self->view);
   Py_XDECREF(self->data);
   Py_TYPE(self)->tp_free((PyObject *)self);
 }
@@ -41,6 +52,9 @@ static void Ext_dealloc(Ext *self) {
 static Py_hash_t Ext_hash(Ext *self) {
   Py_hash_t const code_hash = (Py_hash_t)self->code;
   Py_hash_t const data_hash = PyObject_Hash(self->data);
+  if A_UNLIKELY(data_hash == -1 && PyErr_Occurred() != NULL) {
+    return -1;  // unhashable, like `bytearray`
+  }
   Py_hash_t const hash =
       code_hash ^ (data_hash + 0x9e3779b9 + ((Py_uhash_t)code_hash << 6) +
                    (code_hash >> 2));
@@ -92,9 +106,8 @@ static PyObject *Ext_to_timestamp(Ext *self, PyObject *Py_UNUSED(unused)) {
   if A_UNLIKELY(timestamp == NULL) {
     return NULL;  // GCOVR_EXCL_LINE
   }
-  if A_UNLIKELY(parse_timestamp(&timestamp->timestamp,
-                                PyBytes_AS_STRING(self->data),
-                                PyBytes_GET_SIZE(self->data)) != 0) {
+  if A_UNLIKELY(parse_timestamp(&timestamp->timestamp, self->view.buf,
+                                self->view.len) != 0) {
     Py_DECREF(timestamp);
     return NULL;  // exception is set in `parse_timestamp`
   }
@@ -103,8 +116,7 @@ static PyObject *Ext_to_timestamp(Ext *self, PyObject *Py_UNUSED(unused)) {
 
 static PyObject *Ext_to_datetime(Ext const *self, PyObject *Py_UNUSED(unused)) {
   MsgPackTimestamp ts;
-  if (parse_timestamp(&ts, PyBytes_AS_STRING(self->data),
-                      PyBytes_GET_SIZE(self->data)) != 0) {
+  if (parse_timestamp(&ts, self->view.buf, self->view.len) != 0) {
     return NULL;
   }
   return timestamp_to_datetime(ts);
@@ -116,7 +128,7 @@ static PyObject *Ext_to_datetime(Ext const *self, PyObject *Py_UNUSED(unused)) {
 */
 static PyObject *Ext_default(Ext *self, PyObject *Py_UNUSED(obj)) {
   if (self->code == -1) {
-    Py_ssize_t const length = PyBytes_GET_SIZE(self->data);
+    Py_ssize_t const length = self->view.len;
     if A_LIKELY(length == 8 || length == 4 || length == 12) {
       return Ext_to_datetime(self, NULL);
     }
@@ -129,7 +141,7 @@ static PyObject *Ext_is_timestamp(Ext *self, PyObject *Py_UNUSED(obj)) {
   if (self->code != -1) {
     Py_RETURN_FALSE;
   }
-  Py_ssize_t const length = PyBytes_GET_SIZE(self->data);
+  Py_ssize_t const length = self->view.len;
   if (length == 8 || length == 4 || length == 12) {
     Py_RETURN_TRUE;
   }
@@ -162,9 +174,8 @@ static PyObject *Ext_richcompare(Ext *self, PyObject *other, int op) {
   // Compare the 'data' fields using Python's equality
   int data_cmp = PyObject_RichCompareBool(self->data, other_ext->data, Py_EQ);
   if A_UNLIKELY(data_cmp == -1) {
-    // Exception occurred. It's not possible to reach this code, as
-    // `self->data` and `other_ext->data` are of the same type
-    return NULL;  // GCOVR_EXCL_LINE
+    // `data` may be any bytes-like object, its `__eq__` can raise
+    return NULL;
   }
   PyObject *result = NULL;
 
@@ -209,7 +220,11 @@ static PyMethodDef Ext_methods[] = {
 PyDoc_STRVAR(Ext_doc,
              "Ext(code, data)\n"
              "--\n\n"
-             "Ext type from MessagePack specification\n"
+             "Ext type from MessagePack specification. ``data`` is ``bytes`` "
+             "or any other bytes-like object, like ``memoryview`` or "
+             "``bytearray``, that is packed without copying it to ``bytes`` "
+             "first. Its buffer stays exported while :class:`Ext` lives, so "
+             "``bytearray`` can not be resized.\n"
              "\n"
              ">>> from amsgpack import Ext, packb\n"
              ">>> packb(Ext(code=95, data=b'amsgpack'))\n"
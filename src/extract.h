@@ -0,0 +1,205 @@
+#include <Python.h>
+
+#include "skip.h"
+
+/*
+  `Unpacker.extract`: unpacks values at the given paths of a message. Maps
+  and arrays on the way are walked with `msgpack_skip`, so only the
+  selected values become Python objects, string keys are compared as UTF-8
+  bytes and are not unpacked.
+*/
+
+#define EXTRACT_MISSING -4  // the path is not in the message
+#define EXTRACT_ERROR -5    // exception is set
+
+// returns: offset of the payload of the complete str at `pos`, `*length`
+//          is its size, or -1 when it is not a str
+static Py_ssize_t extract_str(uint8_t const* data, Py_ssize_t pos,
+                              Py_ssize_t* length) {
+  uint8_t const head = data[pos];
+  if (head >= 0xa0 && head <= 0xbf) {
+    *length = head & 0x1f;
+    return pos + 1;
+  }
+  if (head < 0xd9 || head > 0xdb) {
+    return -1;
+  }
+  int const size_size = 1 << (head - 0xd9);
+  *length = skip_load_size(data + pos + 1, size_size);
+  return pos + 1 + size_size;
+}
+
+// returns: offset of the value of map key or array index `step` in the
+//          container at `pos`, the last pair of a repeated key wins, like
+//          in `dict` made by `unpackb`
+//          EXTRACT_MISSING, EXTRACT_ERROR, SKIP_INCOMPLETE or SKIP_INVALID
+static Py_ssize_t extract_step(Unpacker* self, PyObject* obj,
+                               uint8_t const* data, Py_ssize_t pos,
+                               Py_ssize_t end, PyObject* step) {
+  uint8_t const head = data[pos];
+  if (!skip_is_container(head)) {
+    return EXTRACT_MISSING;
+  }
+  if A_UNLIKELY(head >= 0xdc && end - pos < 1 + (head & 0x01 ? 4 : 2)) {
+    return SKIP_INCOMPLETE;
+  }
+  Py_ssize_t length;
+  int is_map;
+  pos = lazy_header(data, pos, &length, &is_map);
+  if (!is_map) {
+    if (!PyLong_CheckExact(step)) {
+      return EXTRACT_MISSING;
+    }
+    Py_ssize_t idx = PyLong_AsSsize_t(step);
+    if (idx == -1 && PyErr_Occurred()) {
+      PyErr_Clear();  // too big to be an index
+      return EXTRACT_MISSING;
+    }
+    if (idx < 0) {
+      idx += length;
+    }
+    if (idx < 0 || idx >= length) {
+      return EXTRACT_MISSING;
+    }
+    for (; idx != 0 && pos >= 0; --idx) {
+      pos = msgpack_skip(data, pos, end);
+    }
+    return pos;
+  }
+  char const* step_str = NULL;
+  Py_ssize_t step_length = 0;
+  if (PyUnicode_CheckExact(step)) {
+    step_str = PyUnicode_AsUTF8AndSize(step, &step_length);
+    if A_UNLIKELY(step_str == NULL) {
+      return EXTRACT_ERROR;
+    }
+  }
+  Py_ssize_t value = EXTRACT_MISSING;
+  for (Py_ssize_t pair = 0; pair < length; ++pair) {
+    if A_UNLIKELY(pos >= end) {
+      return SKIP_INCOMPLETE;
+    }
+    Py_ssize_t const key_end = msgpack_skip(data, pos, end);
+    if A_UNLIKELY(key_end < 0) {
+      return key_end;
+    }
+    Py_ssize_t key_length;
+    Py_ssize_t const key_data = extract_str(data, pos, &key_length);
+    int found;
+    if (step_str != NULL) {
+      found = key_data >= 0 && key_length == step_length &&
+              memcmp(data + key_data, step_str, (size_t)step_length) == 0;
+    } else if (key_data >= 0) {
+      found = 0;  // a str is not equal to other keys
+    } else {
+      PyObject* key = unpacker_unpack_part(self, obj, (char const*)data + pos,
+                                           key_end - pos);
+      if A_UNLIKELY(key == NULL) {
+        return EXTRACT_ERROR;
+      }
+      found = PyObject_RichCompareBool(key, step, Py_EQ);
+      Py_DECREF(key);
+      if A_UNLIKELY(found < 0) {
+        return EXTRACT_ERROR;
+      }
+    }
+    if (found) {
+      value = key_end;
+    }
+    pos = msgpack_skip(data, key_end, end);
+    if A_UNLIKELY(pos < 0) {
+      return pos;
+    }
+  }
+  return value;
+}
+
+// returns new value at `path` in message `data` of `end` bytes, `default`
+// when it is missing, or NULL with exception set
+static PyObject* extract_path(Unpacker* self, PyObject* obj,
+                              uint8_t const* data, Py_ssize_t end,
+                              PyObject* path, PyObject* default_value) {
+  if A_UNLIKELY(!PyTuple_CheckExact(path) && !PyList_CheckExact(path)) {
+    PyErr_Format(PyExc_TypeError,
+                 "`paths` items must be tuple or list, not %.100s",
+                 Py_TYPE(path)->tp_name);
+    return NULL;
+  }
+  Py_ssize_t pos = 0;
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(path); ++i) {
+    pos = extract_step(self, obj, data, pos, end,
+                       PySequence_Fast_GET_ITEM(path, i));
+    if (pos == EXTRACT_MISSING) {
+      return Py_NewRef(default_value);
+    }
+    if A_UNLIKELY(pos < 0) {
+      goto error;
+    }
+    if A_UNLIKELY(pos >= end) {
+      pos = SKIP_INCOMPLETE;
+      goto error;
+    }
+  }
+  Py_ssize_t const value_end = msgpack_skip(data, pos, end);
+  if A_UNLIKELY(value_end < 0) {
+    pos = value_end;
+    goto error;
+  }
+  return unpacker_unpack_part(self, obj, (char const*)data + pos,
+                              value_end - pos);
+error:
+  if (pos == SKIP_INVALID) {
+    PyErr_SetString(PyExc_ValueError, "amsgpack: 0xc1 byte must not be used");
+  } else if (pos == SKIP_INCOMPLETE) {
+    PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
+  }
+  return NULL;
+}
+
+static PyObject* unpacker_extract(Unpacker* self, PyObject* args,
+                                  PyObject* kwargs) {
+  static char* keywords[] = {"", "", "default", NULL};
+  PyObject* obj;
+  PyObject* paths;
+  PyObject* default_value = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|O:extract", keywords,
+                                   &obj, &paths, &default_value)) {
+    return NULL;
+  }
+  Py_buffer buffer;
+  if A_UNLIKELY(PyObject_GetBuffer(obj, &buffer, PyBUF_SIMPLE) < 0) {
+    return NULL;
+  }
+  PyObject* ret = NULL;
+  PyObject* paths_fast =
+      PySequence_Fast(paths, "`paths` must be a sequence of paths");
+  if A_UNLIKELY(paths_fast == NULL) {
+    goto done;
+  }
+  if A_UNLIKELY(buffer.len == 0) {
+    PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
+    goto done;
+  }
+  Py_ssize_t const count = PySequence_Fast_GET_SIZE(paths_fast);
+  ret = PyTuple_New(count);
+  if A_UNLIKELY(ret == NULL) {
+    goto done;
+  }
+  for (Py_ssize_t i = 0; i < count; ++i) {
+    PyObject* value = extract_path(
+        self, obj, (uint8_t const*)buffer.buf, buffer.len,
+        PySequence_Fast_GET_ITEM(paths_fast, i), default_value);
+    if A_UNLIKELY(value == NULL) {
+      Py_CLEAR(ret);
+      goto done;
+    }
+    PyTuple_SET_ITEM(ret, i, value);
+  }
+done:
+  Py_XDECREF(paths_fast);
+  PyBuffer_Release(&buffer);
+  return ret;
+}
+
+#undef EXTRACT_MISSING
+#undef EXTRACT_ERROR
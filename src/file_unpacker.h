@@ -28,12 +28,15 @@ static int FileUnpacker_init(FileUnpacker* self, PyObject* args,
 
   PyObject* no_args = PyTuple_New(0);
   if A_UNLIKELY(no_args == NULL) {
-    return -1;  // GCOVR_EXCL_LINE
+    Py_DECREF(read_callback);  // GCOVR_EXCL_LINE
+    return -1;                 // GCOVR_EXCL_LINE
   }
-  if (Unpacker_init(&self->unpacker, no_args, kwargs) != 0) {
+  int const init_result = Unpacker_init(&self->unpacker, no_args, kwargs);
+  Py_DECREF(no_args);
+  if (init_result != 0) {
+    Py_DECREF(read_callback);
     return -1;
   }
-  Py_DECREF(no_args);
   self->read_callback = read_callback;
   if (read_size == NULL) {
     // handle default value
@@ -67,12 +70,7 @@ static PyObject* FileUnpacker_iternext(FileUnpacker* self) {
     if A_UNLIKELY(bytes == NULL) {
       return NULL;
     }
-    if A_UNLIKELY(PyBytes_CheckExact(bytes) == 0) {
-      PyErr_Format(PyExc_TypeError, "a bytes object is required, not '%.100s'",
-                   Py_TYPE(bytes)->tp_name);
-      return NULL;
-    }
-    // 3. Push bytes to the deque
+    // 3. Push bytes to the deque, any bytes-like object is accepted
     int const append_result = deque_append(&self->unpacker.deque, bytes);
     Py_DECREF(bytes);
     if A_UNLIKELY(append_result != 0) {
@@ -86,13 +84,23 @@ static PyObject* FileUnpacker_iternext(FileUnpacker* self) {
   return result;
 }
 
+static int FileUnpacker_traverse(FileUnpacker* self, visitproc visit,
+                                 void* arg) {
+  Py_VISIT(self->read_callback);
+  return Unpacker_traverse(&self->unpacker, visit, arg);
+}
+
 static void FileUnpacker_dealloc(FileUnpacker* self) {
+  PyObject_GC_UnTrack(self);
   Py_XDECREF(self->read_callback);
   Py_XDECREF(self->read_size);
   Unpacker_dealloc(&self->unpacker);
 }
 PyDoc_STRVAR(FileUnpacker_doc,
-             "FileUnpacker(file, read_size, tuple = False, ext_hook = None)\n"
+             "FileUnpacker(file, read_size, tuple = False, ext_hook = None, "
+             "typed_arrays = None, bin_type = 'bytes', cache_size = None, "
+             "cache_ways = 1, cache_key_length = 16, keys = None, "
+             "cache_values = False, raw = False)\n"
              "--\n\n"
              "Iteratively unpack binary stream to python objects:\n\n"
              ">>> from amsgpack import FileUnpacker\n"
@@ -103,6 +111,8 @@ PyDoc_STRVAR(FileUnpacker_doc,
              "0\n"
              "1\n"
              "2\n"
+             "\n"
+             "With *raw* every message is ``bytes``, for forwarding.\n"
 
 );
 
@@ -112,6 +122,8 @@ static PyType_Slot FileUnpacker_slots[] = {
     {Py_tp_new, PyType_GenericNew},
     {Py_tp_init, FileUnpacker_init},
     {Py_tp_dealloc, (destructor)FileUnpacker_dealloc},
+    {Py_tp_traverse, FileUnpacker_traverse},
+    {Py_tp_clear, Unpacker_clear},
     {Py_tp_iter, AnyUnpacker_iter},
     {Py_tp_iternext, (iternextfunc)FileUnpacker_iternext},
     {0, NULL}};
@@ -120,6 +132,6 @@ END_NO_PEDANTIC
 static PyType_Spec FileUnpacker_spec = {
     .name = "amsgpack.FileUnpacker",
     .basicsize = sizeof(FileUnpacker),
-    .flags = Py_TPFLAGS_DEFAULT,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
     .slots = FileUnpacker_slots,
 };
@@ -0,0 +1,342 @@
+#pragma once
+#include <Python.h>
+
+#include "macros.h"
+#include "utf8.h"
+
+/*
+  Key cache, a set-associative table of unpacked map keys, so repeated keys
+  are not decoded again. A key is looked up in the `ways` entries of one set
+  and replaces the least recently used one. Pinned keys, from
+  `Unpacker(keys=...)`, are never replaced.
+
+  The same table caches short string values with `Unpacker(cache_values=
+  True)`. Most values are seen once, so a value is only admitted on its
+  second sighting, and unique values do not push out repeated ones.
+
+  The hash is seeded with the string hash secret of the interpreter, so
+  colliding keys can not be crafted to thrash the cache.
+*/
+
+#define KEY_CACHE_MAX_SIZE (1 << 20)
+#define KEY_CACHE_MAX_KEY_LENGTH 255  // str 8
+
+typedef struct {
+  uint32_t hash;
+  uint8_t age;     // LRU rank in the set, 0 is the most recent
+  uint8_t pinned;  // never replaced
+  Py_ssize_t len;  // -1 for empty entry
+  char const* data;  // UTF-8 of `obj`, owned by `obj`
+  PyObject* obj;
+} CacheEntry;
+
+typedef struct {
+  uint32_t set_mask;  // number of sets - 1
+  unsigned int ways;  // 1, 2 or 4
+  Py_ssize_t max_len;
+  uint32_t seed;
+  int gc_epoch;  // `AMsgPackState.gc_epoch` seen last time, thread caches
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint32_t* seen;  // hashes seen once, for the admission, or NULL
+  int shared;      // owned by `Unpacker`, threads use it in `unpackb`
+#ifdef Py_GIL_DISABLED
+  PyMutex mutex;  // taken only for `shared` caches
+#endif
+  CacheEntry entries[];
+} KeyCache;
+
+static inline uint32_t xxhash32(uint8_t const* data, uint32_t len,
+                                uint32_t seed) {
+  if (len > KEY_CACHE_MAX_KEY_LENGTH) {
+    Py_UNREACHABLE();  // GCOVR_EXCL_LINE
+  }
+  uint32_t const prime = 0x9E3779B1;
+  uint32_t hash = seed + prime;
+  size_t idx = 0;
+
+  for (; idx != (len & ~0x03U); idx += 4) {
+    uint32_t block;
+    // Avoids strict-aliasing issues, as we know the data is not aligned
+    memcpy(&block, data + idx, 4);
+    hash ^= block;
+    hash *= prime;
+    hash = (hash << 13) | (hash >> 19);  // Rotate left 13
+  }
+
+  for (; idx < len; ++idx) {
+    hash ^= data[idx];
+    hash *= prime;
+    hash = (hash << 13) | (hash >> 19);
+  }
+
+  hash ^= len;
+  hash *= 0x85EBCA77;
+  hash ^= (hash >> 16);
+  return hash;
+}
+
+static inline Py_ssize_t key_cache_size(KeyCache const* cache) {
+  return ((Py_ssize_t)cache->set_mask + 1) * cache->ways;
+}
+
+static inline void reset_cache_entry(CacheEntry* entry) {
+  // reset, so that cache entry won't match after obj is destroyed,
+  // `age` is kept, ages of a set are always 0 .. ways - 1
+  entry->hash = 0;
+  entry->len = -1;
+  entry->data = NULL;
+  entry->obj = NULL;
+  entry->pinned = 0;
+}
+
+// returns new cache or NULL with exception set,
+// `size` and `ways` are powers of two, `size` >= `ways`
+static KeyCache* key_cache_new(Py_ssize_t size, unsigned int ways,
+                               Py_ssize_t max_len, uint32_t seed) {
+  assert(size >= (Py_ssize_t)ways && size <= KEY_CACHE_MAX_SIZE);
+  KeyCache* cache = (KeyCache*)PyMem_Malloc(
+      sizeof(KeyCache) + (size_t)size * sizeof(CacheEntry));
+  if A_UNLIKELY(cache == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+  cache->set_mask = (uint32_t)(size / ways - 1);
+  cache->ways = ways;
+  cache->max_len = max_len;
+  cache->seed = seed;
+  cache->gc_epoch = 0;
+  cache->hits = cache->misses = cache->evictions = 0;
+  cache->seen = NULL;
+  cache->shared = 0;
+#ifdef Py_GIL_DISABLED
+  cache->mutex = (PyMutex){0};
+#endif
+  for (Py_ssize_t i = 0; i < size; ++i) {
+    reset_cache_entry(cache->entries + i);
+    cache->entries[i].age = (uint8_t)(i % ways);
+  }
+  return cache;
+}
+
+static void key_cache_free(KeyCache* cache) {
+  if (cache == NULL) {
+    return;
+  }
+  Py_ssize_t const size = key_cache_size(cache);
+  for (Py_ssize_t i = 0; i < size; ++i) {
+    Py_XDECREF(cache->entries[i].obj);
+  }
+  PyMem_Free(cache->seen);
+  PyMem_Free(cache);
+}
+
+// makes `cache` admit strings on the second sighting
+// returns: -1 - failure (exception is set)
+//           0 - success
+static int key_cache_admit_second(KeyCache* cache) {
+  cache->seen =
+      (uint32_t*)PyMem_Calloc((size_t)key_cache_size(cache), sizeof(uint32_t));
+  if A_UNLIKELY(cache->seen == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
+}
+
+// returns: 1 - `hash` string should be cached
+//          0 - it is the first sighting
+static inline int key_cache_admit(KeyCache* cache, uint32_t hash) {
+  if A_LIKELY(cache->seen == NULL) {
+    return 1;
+  }
+  // the set index is in the low bits, rotated bits spread sets over the table
+  uint32_t const rotated = (hash >> 16) | (hash << 16);
+  uint32_t* const seen =
+      cache->seen + (rotated & (uint32_t)(key_cache_size(cache) - 1));
+  if (*seen == hash) {
+    return 1;
+  }
+  *seen = hash;
+  return 0;
+}
+
+// `PyCapsule` destructor of thread and `Unpacker` caches
+static void key_cache_capsule_free(PyObject* capsule) {
+  key_cache_free((KeyCache*)PyCapsule_GetPointer(capsule, NULL));
+}
+
+// marks `way` of `set` as the most recently used
+static inline void key_cache_touch(CacheEntry* set, unsigned int ways,
+                                   unsigned int way) {
+  uint8_t const age = set[way].age;
+  for (unsigned int i = 0; i < ways; ++i) {
+    set[i].age += set[i].age < age;
+  }
+  set[way].age = 0;
+}
+
+// returns: -1 - `obj` is not cached, every way is pinned (or no UTF-8)
+//           0 - success, the cache holds a reference to `obj`
+static int key_cache_insert(KeyCache* cache, CacheEntry* set, uint32_t hash,
+                            PyObject* obj, int pinned) {
+  unsigned int const ways = cache->ways;
+  unsigned int victim = ways;
+  for (unsigned int i = 0; i < ways; ++i) {
+    if (set[i].obj == NULL) {
+      victim = i;
+      break;
+    }
+    if (!set[i].pinned && (victim == ways || set[i].age > set[victim].age)) {
+      victim = i;
+    }
+  }
+  if A_UNLIKELY(victim == ways) {
+    return -1;
+  }
+  Py_ssize_t len;
+  // `str` made of UTF-8 holds it, for ASCII it is the `str` data itself
+  char const* data = PyUnicode_AsUTF8AndSize(obj, &len);
+  if A_UNLIKELY(data == NULL) {
+    PyErr_Clear();  // the cache is optional
+    return -1;
+  }
+  CacheEntry* const entry = set + victim;
+  if (entry->obj != NULL) {
+    Py_DECREF(entry->obj);
+    cache->evictions++;
+  }
+  entry->hash = hash;
+  entry->len = len;
+  entry->data = data;
+  Py_INCREF(obj);
+  entry->obj = obj;
+  entry->pinned = (uint8_t)pinned;
+  key_cache_touch(set, ways, victim);
+  return 0;
+}
+
+// returns: -1 - failure (exception is set)
+//           0 - success, keys that do not fit into their set are not pinned
+static int key_cache_pin(KeyCache* cache, PyObject* keys) {
+  PyObject* iterator = PyObject_GetIter(keys);
+  if A_UNLIKELY(iterator == NULL) {
+    return -1;
+  }
+  PyObject* key;
+  while ((key = PyIter_Next(iterator)) != NULL) {
+    if A_UNLIKELY(!PyUnicode_CheckExact(key)) {
+      PyErr_Format(PyExc_TypeError, "`keys` items must be str, not %.100s",
+                   Py_TYPE(key)->tp_name);
+      goto error;
+    }
+    Py_ssize_t len;
+    char const* data = PyUnicode_AsUTF8AndSize(key, &len);
+    if A_UNLIKELY(data == NULL) {
+      goto error;
+    }
+    if A_UNLIKELY(len > cache->max_len) {
+      PyErr_Format(PyExc_ValueError,
+                   "`keys` item of %zd bytes is longer than "
+                   "`cache_key_length` (%zd)",
+                   len, cache->max_len);
+      goto error;
+    }
+    uint32_t const hash =
+        xxhash32((uint8_t const*)data, (uint32_t)len, cache->seed);
+    CacheEntry* const set =
+        cache->entries + (hash & cache->set_mask) * cache->ways;
+    int found = 0;
+    for (unsigned int i = 0; i < cache->ways; ++i) {
+      if (set[i].hash == hash && set[i].len == len &&
+          memcmp(set[i].data, data, (size_t)len) == 0) {
+        set[i].pinned = 1;
+        found = 1;
+      }
+    }
+    if (!found) {
+      key_cache_insert(cache, set, hash, key, 1);
+    }
+    Py_DECREF(key);
+  }
+  Py_DECREF(iterator);
+  return PyErr_Occurred() != NULL ? -1 : 0;
+error:
+  Py_DECREF(key);
+  Py_DECREF(iterator);
+  return -1;
+}
+
+// releases strings of `part` (0 - 7) of the cache, that only the cache holds
+static void evict_cache_part(KeyCache* cache, int part) {
+  Py_ssize_t const stride_el = key_cache_size(cache) / 8;
+  CacheEntry* const entries = cache->entries;
+  for (Py_ssize_t i = part * stride_el; i < part * stride_el + stride_el;
+       ++i) {
+    PyObject* obj = entries[i].obj;
+    // Technically, another module can hold strings in its cache
+    // and we will never clear memory. Do not know what to do about it.
+    if (obj != NULL && !entries[i].pinned && Py_REFCNT(obj) == 1) {
+      Py_DECREF(obj);
+      reset_cache_entry(entries + i);
+    }
+  }
+}
+
+// `cache` may be NULL
+static inline PyObject* as_string(KeyCache* cache, char const* str,
+                                  Py_ssize_t length) {
+  if A_LIKELY(cache != NULL && length <= cache->max_len) {
+    uint32_t const hash =
+        xxhash32((uint8_t const*)str, (uint32_t)length, cache->seed);
+#ifdef Py_GIL_DISABLED
+    if (cache->shared) {
+      PyMutex_Lock(&cache->mutex);
+    }
+#endif
+    unsigned int const ways = cache->ways;
+    CacheEntry* const set = cache->entries + (hash & cache->set_mask) * ways;
+    PyObject* parsed_object = NULL;
+    for (unsigned int i = 0; i < ways; ++i) {
+      CacheEntry const* const entry = set + i;
+      if (entry->hash == hash && entry->len == length &&
+          memcmp(str, entry->data, (size_t)length) == 0) {
+        if (ways != 1) {
+          key_cache_touch(set, ways, i);
+        }
+        cache->hits++;
+        parsed_object = entry->obj;
+        Py_INCREF(parsed_object);
+        goto done;
+      }
+    }
+    cache->misses++;
+    parsed_object = utf8_decode(str, length);
+    if A_LIKELY(parsed_object != NULL && key_cache_admit(cache, hash)) {
+      key_cache_insert(cache, set, hash, parsed_object, 0);
+    }
+  done:
+#ifdef Py_GIL_DISABLED
+    if (cache->shared) {
+      PyMutex_Unlock(&cache->mutex);
+    }
+#endif
+    return parsed_object;
+  }
+  return utf8_decode(str, length);
+}
+
+// returns new `dict` with parameters and counters of `cache`
+static PyObject* key_cache_info(KeyCache* cache) {
+  Py_ssize_t const size = key_cache_size(cache);
+  Py_ssize_t pinned = 0;
+  for (Py_ssize_t i = 0; i < size; ++i) {
+    pinned += cache->entries[i].pinned;
+  }
+  return Py_BuildValue("{s:n,s:I,s:n,s:n,s:K,s:K,s:K}", "size", size, "ways",
+                       cache->ways, "key_length", cache->max_len, "pinned",
+                       pinned, "hits", (unsigned long long)cache->hits,
+                       "misses", (unsigned long long)cache->misses,
+                       "evictions", (unsigned long long)cache->evictions);
+}
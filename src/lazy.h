@@ -0,0 +1,559 @@
+#include <Python.h>
+
+#include "skip.h"
+
+/*
+  `Unpacker(lazy=True)`: `unpackb` walks the message once and returns
+  `LazyMap` or `LazyArray` with offsets of the items in the message. An item
+  is unpacked on the first access and kept, nested maps and arrays are lazy
+  too. Only the items that are read are made into Python objects.
+*/
+
+typedef struct {
+  PyObject_HEAD
+  Unpacker* unpacker;   // options of the items
+  PyObject* source;     // `bytes` of the whole message
+  Py_ssize_t start;     // offset of the map or array header in `source`
+  Py_ssize_t length;    // items of an array, pairs of a map
+  Py_ssize_t* offsets;  // item offsets and the end, keys and values of maps
+  PyObject** items;     // unpacked items, values of maps, NULL until read
+  PyObject* index;      // `LazyMap`: `dict` of keys to pair numbers or NULL
+#ifdef Py_GIL_DISABLED
+  PyMutex mutex;  // guards `items` and `index`
+#endif
+} Lazy;
+
+#ifdef Py_GIL_DISABLED
+#define LAZY_LOCK(self) PyMutex_Lock(&(self)->mutex)
+#define LAZY_UNLOCK(self) PyMutex_Unlock(&(self)->mutex)
+#else
+#define LAZY_LOCK(self)
+#define LAZY_UNLOCK(self)
+#endif
+
+// returns offset of the first item of the valid map or array at `pos`
+static Py_ssize_t lazy_header(uint8_t const* data, Py_ssize_t pos,
+                              Py_ssize_t* length, int* is_map) {
+  uint8_t const head = data[pos];
+  if (head <= 0x9f) {
+    *is_map = head <= 0x8f;
+    *length = head & 0x0f;
+    return pos + 1;
+  }
+  int const size_size = head & 0x01 ? 4 : 2;
+  *is_map = head >= 0xde;
+  *length = skip_load_size(data + pos + 1, size_size);
+  return pos + 1 + size_size;
+}
+
+// returns new `LazyMap` or `LazyArray` of the valid container at `start`
+static PyObject* lazy_new(Unpacker* unpacker, PyObject* source,
+                          Py_ssize_t start) {
+  uint8_t const* data = (uint8_t const*)PyBytes_AS_STRING(source);
+  Py_ssize_t const end = PyBytes_GET_SIZE(source);
+  Py_ssize_t length;
+  int is_map;
+  assert(skip_is_container(data[start]));
+  Py_ssize_t pos = lazy_header(data, start, &length, &is_map);
+  Py_ssize_t const slots = is_map ? 2 * length : length;
+
+  AMsgPackState const* state = unpacker->state;
+  Lazy* self = PyObject_GC_New(
+      Lazy, is_map ? state->lazy_map_type : state->lazy_array_type);
+  if A_UNLIKELY(self == NULL) {
+    return NULL;
+  }
+  Py_INCREF(unpacker);
+  self->unpacker = unpacker;
+  Py_INCREF(source);
+  self->source = source;
+  self->start = start;
+  self->length = length;
+  self->index = NULL;
+#ifdef Py_GIL_DISABLED
+  self->mutex = (PyMutex){0};
+#endif
+  self->offsets =
+      (Py_ssize_t*)PyMem_Malloc((size_t)(slots + 1) * sizeof(Py_ssize_t));
+  self->items = (PyObject**)PyMem_Calloc((size_t)length + 1, sizeof(PyObject*));
+  if A_UNLIKELY(self->offsets == NULL || self->items == NULL) {
+    Py_DECREF(self);
+    return PyErr_NoMemory();
+  }
+  for (Py_ssize_t i = 0; i < slots; ++i) {
+    self->offsets[i] = pos;
+    pos = msgpack_skip(data, pos, end);
+    if A_UNLIKELY(pos < 0) {
+      Py_DECREF(self);  // GCOVR_EXCL_LINE the message is validated
+      PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
+      return NULL;
+    }
+  }
+  self->offsets[slots] = pos;
+  PyObject_GC_Track(self);
+  return (PyObject*)self;
+}
+
+// returns new object of `size` bytes at `pos`, as `Unpacker.unpackb` does
+static PyObject* lazy_unpack_part(Lazy* self, Py_ssize_t pos,
+                                  Py_ssize_t size) {
+  return unpacker_unpack_part(self->unpacker, self->source,
+                              PyBytes_AS_STRING(self->source) + pos, size);
+}
+
+// returns new object of item `slot`, lazy for maps and arrays
+static PyObject* lazy_unpack_slot(Lazy* self, Py_ssize_t slot) {
+  Py_ssize_t const pos = self->offsets[slot];
+  if (skip_is_container((uint8_t)PyBytes_AS_STRING(self->source)[pos])) {
+    return lazy_new(self->unpacker, self->source, pos);
+  }
+  return lazy_unpack_part(self, pos, self->offsets[slot + 1] - pos);
+}
+
+// returns new key of `pair` of `LazyMap`, short strings are looked up in
+// the key cache of the unpacker
+static PyObject* lazy_unpack_key(Lazy* self, Py_ssize_t pair) {
+  Py_ssize_t const pos = self->offsets[2 * pair];
+  char const* data = PyBytes_AS_STRING(self->source) + pos;
+  uint8_t const head = (uint8_t)data[0];
+  if (head >= 0xa0 && head <= 0xbf) {
+    Unpacker const* unpacker = self->unpacker;
+    KeyCache* cache = unpacker->key_cache != NULL
+                          ? unpacker->key_cache
+                          : get_unicode_cache(unpacker->state);
+    return as_string(cache, data + 1, head & 0x1f);
+  }
+  return lazy_unpack_part(self, pos, self->offsets[2 * pair + 1] - pos);
+}
+
+// returns new reference to item `idx` of `self->items`, unpacking it from
+// `slot` on the first access
+static PyObject* lazy_item(Lazy* self, Py_ssize_t idx, Py_ssize_t slot) {
+  LAZY_LOCK(self);
+  PyObject* item = self->items[idx];
+  Py_XINCREF(item);
+  LAZY_UNLOCK(self);
+  if (item != NULL) {
+    return item;
+  }
+  // unpacked without the lock, `ext_hook` may read this object
+  item = lazy_unpack_slot(self, slot);
+  if A_UNLIKELY(item == NULL) {
+    return NULL;
+  }
+  LAZY_LOCK(self);
+  if A_LIKELY(self->items[idx] == NULL) {
+    Py_INCREF(item);
+    self->items[idx] = item;
+  } else {
+    Py_SETREF(item, Py_NewRef(self->items[idx]));  // another reader won
+  }
+  LAZY_UNLOCK(self);
+  return item;
+}
+
+// returns borrowed `dict` of keys to pair numbers, the last pair of
+// a repeated key wins, like in `dict` made by `unpackb`
+static PyObject* lazy_index(Lazy* self) {
+  LAZY_LOCK(self);
+  PyObject* index = self->index;
+  LAZY_UNLOCK(self);
+  if A_LIKELY(index != NULL) {
+    return index;
+  }
+  index = PyDict_New();
+  if A_UNLIKELY(index == NULL) {
+    return NULL;
+  }
+  for (Py_ssize_t pair = 0; pair < self->length; ++pair) {
+    PyObject* key = lazy_unpack_key(self, pair);
+    if A_UNLIKELY(key == NULL) {
+      goto error;
+    }
+    PyObject* number = PyLong_FromSsize_t(pair);
+    if A_UNLIKELY(number == NULL) {
+      Py_DECREF(key);
+      goto error;
+    }
+    int const set_result = PyDict_SetItem(index, key, number);
+    Py_DECREF(key);
+    Py_DECREF(number);
+    if A_UNLIKELY(set_result != 0) {
+      goto error;
+    }
+  }
+  LAZY_LOCK(self);
+  if A_LIKELY(self->index == NULL) {
+    self->index = index;
+  } else {
+    Py_SETREF(index, self->index);  // another reader won
+  }
+  LAZY_UNLOCK(self);
+  return index;
+error:
+  Py_DECREF(index);
+  return NULL;
+}
+
+static PyObject* Lazy_materialize(Lazy* self, PyObject* Py_UNUSED(unused)) {
+  Py_ssize_t const slots =
+      Py_IS_TYPE(self, self->unpacker->state->lazy_map_type) ? 2 * self->length
+                                                             : self->length;
+  return lazy_unpack_part(self, self->start,
+                          self->offsets[slots] - self->start);
+}
+
+static PyObject* Lazy_richcompare(Lazy* self, PyObject* other, int op) {
+  if (op != Py_EQ && op != Py_NE) {
+    Py_RETURN_NOTIMPLEMENTED;
+  }
+  PyObject* materialized = Lazy_materialize(self, NULL);
+  if A_UNLIKELY(materialized == NULL) {
+    return NULL;
+  }
+  AMsgPackState const* state = self->unpacker->state;
+  PyObject* ret;
+  if (Py_IS_TYPE(other, state->lazy_map_type) ||
+      Py_IS_TYPE(other, state->lazy_array_type)) {
+    PyObject* other_materialized = Lazy_materialize((Lazy*)other, NULL);
+    if A_UNLIKELY(other_materialized == NULL) {
+      Py_DECREF(materialized);
+      return NULL;
+    }
+    ret = PyObject_RichCompare(materialized, other_materialized, op);
+    Py_DECREF(other_materialized);
+  } else {
+    ret = PyObject_RichCompare(materialized, other, op);
+  }
+  Py_DECREF(materialized);
+  return ret;
+}
+
+static int Lazy_traverse(Lazy* self, visitproc visit, void* arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->unpacker);
+  if (self->items != NULL) {
+    for (Py_ssize_t i = 0; i < self->length; ++i) {
+      Py_VISIT(self->items[i]);
+    }
+  }
+  Py_VISIT(self->index);
+  return 0;
+}
+
+// read items, like `ext_hook` results, may reference the map or array
+static int Lazy_clear(Lazy* self) {
+  if (self->items != NULL) {
+    for (Py_ssize_t i = 0; i < self->length; ++i) {
+      Py_CLEAR(self->items[i]);
+    }
+  }
+  Py_CLEAR(self->index);
+  return 0;
+}
+
+static void Lazy_dealloc(Lazy* self) {
+  PyObject_GC_UnTrack(self);
+  Lazy_clear(self);
+  PyMem_Free(self->items);
+  PyMem_Free(self->offsets);
+  Py_DECREF(self->source);
+  Py_DECREF(self->unpacker);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/*
+  LazyArray
+*/
+static Py_ssize_t LazyArray_length(Lazy* self) { return self->length; }
+
+static PyObject* LazyArray_item(Lazy* self, Py_ssize_t idx) {
+  if A_UNLIKELY(idx < 0 || idx >= self->length) {
+    PyErr_SetString(PyExc_IndexError, "LazyArray index out of range");
+    return NULL;
+  }
+  return lazy_item(self, idx, idx);
+}
+
+static PyObject* LazyArray_subscript(Lazy* self, PyObject* key) {
+  if (PyIndex_Check(key)) {
+    Py_ssize_t idx = PyNumber_AsSsize_t(key, PyExc_IndexError);
+    if A_UNLIKELY(idx == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    if (idx < 0) {
+      idx += self->length;
+    }
+    return LazyArray_item(self, idx);
+  }
+  if A_UNLIKELY(!PySlice_Check(key)) {
+    PyErr_Format(PyExc_TypeError,
+                 "LazyArray indices must be integers or slices, not %.100s",
+                 Py_TYPE(key)->tp_name);
+    return NULL;
+  }
+  Py_ssize_t start, stop, step;
+  if A_UNLIKELY(PySlice_Unpack(key, &start, &stop, &step) < 0) {
+    return NULL;
+  }
+  Py_ssize_t const length =
+      PySlice_AdjustIndices(self->length, &start, &stop, step);
+  // a slice is a new sequence, like slices of `unpackb` result
+  PyObject* ret =
+      (self->unpacker->use_tuple ? PyTuple_New : PyList_New)(length);
+  if A_UNLIKELY(ret == NULL) {
+    return NULL;
+  }
+  for (Py_ssize_t i = 0, idx = start; i < length; ++i, idx += step) {
+    PyObject* item = lazy_item(self, idx, idx);
+    if A_UNLIKELY(item == NULL) {
+      Py_DECREF(ret);
+      return NULL;
+    }
+    PySequence_Fast_ITEMS(ret)[i] = item;
+  }
+  return ret;
+}
+
+static PyObject* LazyArray_repr(Lazy* self) {
+  return PyUnicode_FromFormat("<amsgpack.LazyArray of %zd items>",
+                              self->length);
+}
+
+PyDoc_STRVAR(Lazy_materialize_doc,
+             "materialize($self, /)\n--\n\n"
+             "Unpack the whole object, as ``Unpacker.unpackb`` without "
+             "*lazy* does. Read items are not reused.");
+
+static PyMethodDef LazyArray_methods[] = {
+    {"materialize", (PyCFunction)Lazy_materialize, METH_NOARGS,
+     Lazy_materialize_doc},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
+PyDoc_STRVAR(LazyArray_doc,
+             "Read-only sequence returned by ``Unpacker(lazy=True)``. Items "
+             "are unpacked on the first access. Slices are ``list`` or "
+             "``tuple``, as the unpacker makes them.");
+
+BEGIN_NO_PEDANTIC
+static PyType_Slot LazyArray_slots[] = {
+    {Py_tp_doc, (char*)LazyArray_doc},
+    {Py_tp_dealloc, (destructor)Lazy_dealloc},
+    {Py_tp_traverse, Lazy_traverse},
+    {Py_tp_clear, Lazy_clear},
+    {Py_tp_repr, (reprfunc)LazyArray_repr},
+    {Py_tp_hash, PyObject_HashNotImplemented},
+    {Py_tp_richcompare, (richcmpfunc)Lazy_richcompare},
+    {Py_tp_iter, PySeqIter_New},
+    {Py_tp_methods, LazyArray_methods},
+    {Py_sq_length, (lenfunc)LazyArray_length},
+    {Py_sq_item, (ssizeargfunc)LazyArray_item},
+    {Py_mp_length, (lenfunc)LazyArray_length},
+    {Py_mp_subscript, (binaryfunc)LazyArray_subscript},
+    {0, NULL}};
+END_NO_PEDANTIC
+
+static PyType_Spec LazyArray_spec = {
+    .name = "amsgpack.LazyArray",
+    .basicsize = sizeof(Lazy),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+             Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION |
+             Py_TPFLAGS_SEQUENCE,
+    .slots = LazyArray_slots,
+};
+
+/*
+  LazyMap
+*/
+static Py_ssize_t LazyMap_length(Lazy* self) {
+  PyObject* index = lazy_index(self);
+  return index != NULL ? PyDict_GET_SIZE(index) : -1;
+}
+
+// returns new value of `key` or NULL, with exception set on failure only
+static PyObject* lazy_map_get(Lazy* self, PyObject* key) {
+  PyObject* index = lazy_index(self);
+  if A_UNLIKELY(index == NULL) {
+    return NULL;
+  }
+  PyObject* number = PyDict_GetItemWithError(index, key);
+  if (number == NULL) {
+    return NULL;
+  }
+  Py_ssize_t const pair = PyLong_AsSsize_t(number);
+  return lazy_item(self, pair, 2 * pair + 1);
+}
+
+static PyObject* LazyMap_subscript(Lazy* self, PyObject* key) {
+  PyObject* value = lazy_map_get(self, key);
+  if A_UNLIKELY(value == NULL && !PyErr_Occurred()) {
+    PyErr_SetObject(PyExc_KeyError, key);
+  }
+  return value;
+}
+
+static int LazyMap_contains(Lazy* self, PyObject* key) {
+  PyObject* index = lazy_index(self);
+  return index != NULL ? PyDict_Contains(index, key) : -1;
+}
+
+static PyObject* LazyMap_iter(Lazy* self) {
+  PyObject* index = lazy_index(self);
+  return index != NULL ? PyObject_GetIter(index) : NULL;
+}
+
+static PyObject* LazyMap_get(Lazy* self, PyObject* args) {
+  PyObject* key;
+  PyObject* default_value = Py_None;
+  if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &default_value)) {
+    return NULL;
+  }
+  PyObject* value = lazy_map_get(self, key);
+  if (value == NULL && !PyErr_Occurred()) {
+    return Py_NewRef(default_value);
+  }
+  return value;
+}
+
+static PyObject* LazyMap_keys(Lazy* self, PyObject* Py_UNUSED(unused)) {
+  PyObject* index = lazy_index(self);
+  return index != NULL ? PyDict_Keys(index) : NULL;
+}
+
+// returns new `list` of values or of (key, value) tuples of `self`
+static PyObject* lazy_map_values(Lazy* self, int with_keys) {
+  PyObject* index = lazy_index(self);
+  if A_UNLIKELY(index == NULL) {
+    return NULL;
+  }
+  PyObject* ret = PyList_New(PyDict_GET_SIZE(index));
+  if A_UNLIKELY(ret == NULL) {
+    return NULL;
+  }
+  Py_ssize_t dict_pos = 0, i = 0;
+  PyObject *key, *number;
+  while (PyDict_Next(index, &dict_pos, &key, &number)) {
+    Py_ssize_t const pair = PyLong_AsSsize_t(number);
+    PyObject* value = lazy_item(self, pair, 2 * pair + 1);
+    if A_UNLIKELY(value == NULL) {
+      Py_DECREF(ret);
+      return NULL;
+    }
+    if (with_keys) {
+      PyObject* item = PyTuple_Pack(2, key, value);
+      Py_DECREF(value);
+      if A_UNLIKELY(item == NULL) {
+        Py_DECREF(ret);
+        return NULL;
+      }
+      value = item;
+    }
+    PyList_SET_ITEM(ret, i++, value);
+  }
+  return ret;
+}
+
+static PyObject* LazyMap_values(Lazy* self, PyObject* Py_UNUSED(unused)) {
+  return lazy_map_values(self, 0);
+}
+
+static PyObject* LazyMap_items(Lazy* self, PyObject* Py_UNUSED(unused)) {
+  return lazy_map_values(self, 1);
+}
+
+static PyObject* LazyMap_repr(Lazy* self) {
+  Py_ssize_t const length = LazyMap_length(self);  // repeated keys count once
+  if A_UNLIKELY(length < 0) {
+    return NULL;
+  }
+  return PyUnicode_FromFormat("<amsgpack.LazyMap of %zd pairs>", length);
+}
+
+PyDoc_STRVAR(LazyMap_get_doc,
+             "get($self, key, default=None, /)\n--\n\n"
+             "Return the value for *key* if *key* is in the map, else "
+             "*default*.");
+PyDoc_STRVAR(LazyMap_keys_doc,
+             "keys($self, /)\n--\n\n"
+             "Return ``list`` of keys.");
+PyDoc_STRVAR(LazyMap_values_doc,
+             "values($self, /)\n--\n\n"
+             "Return ``list`` of values, unpacking all of them.");
+PyDoc_STRVAR(LazyMap_items_doc,
+             "items($self, /)\n--\n\n"
+             "Return ``list`` of (key, value) tuples, unpacking all values.");
+
+static PyMethodDef LazyMap_methods[] = {
+    {"get", (PyCFunction)LazyMap_get, METH_VARARGS, LazyMap_get_doc},
+    {"keys", (PyCFunction)LazyMap_keys, METH_NOARGS, LazyMap_keys_doc},
+    {"values", (PyCFunction)LazyMap_values, METH_NOARGS, LazyMap_values_doc},
+    {"items", (PyCFunction)LazyMap_items, METH_NOARGS, LazyMap_items_doc},
+    {"materialize", (PyCFunction)Lazy_materialize, METH_NOARGS,
+     Lazy_materialize_doc},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
+PyDoc_STRVAR(LazyMap_doc,
+             "Read-only mapping returned by ``Unpacker(lazy=True)``. Keys "
+             "are unpacked on the first lookup, values on the first access.");
+
+BEGIN_NO_PEDANTIC
+static PyType_Slot LazyMap_slots[] = {
+    {Py_tp_doc, (char*)LazyMap_doc},
+    {Py_tp_dealloc, (destructor)Lazy_dealloc},
+    {Py_tp_traverse, Lazy_traverse},
+    {Py_tp_clear, Lazy_clear},
+    {Py_tp_repr, (reprfunc)LazyMap_repr},
+    {Py_tp_hash, PyObject_HashNotImplemented},
+    {Py_tp_richcompare, (richcmpfunc)Lazy_richcompare},
+    {Py_tp_iter, (getiterfunc)LazyMap_iter},
+    {Py_tp_methods, LazyMap_methods},
+    {Py_sq_contains, (objobjproc)LazyMap_contains},
+    {Py_mp_length, (lenfunc)LazyMap_length},
+    {Py_mp_subscript, (binaryfunc)LazyMap_subscript},
+    {0, NULL}};
+END_NO_PEDANTIC
+
+static PyType_Spec LazyMap_spec = {
+    .name = "amsgpack.LazyMap",
+    .basicsize = sizeof(Lazy),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+             Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION |
+             Py_TPFLAGS_MAPPING,
+    .slots = LazyMap_slots,
+};
+
+// returns new `LazyMap` or `LazyArray`, `None` when `obj` is not a map or
+// an array, or NULL with exception set
+static PyObject* lazy_unpackb(Unpacker* self, PyObject* obj) {
+  // items reference the message, other buffers may change, so they are
+  // copied once
+  PyObject* source =
+      PyBytes_CheckExact(obj) ? Py_NewRef(obj) : PyBytes_FromObject(obj);
+  if A_UNLIKELY(source == NULL) {
+    return NULL;
+  }
+  uint8_t const* data = (uint8_t const*)PyBytes_AS_STRING(source);
+  Py_ssize_t const size = PyBytes_GET_SIZE(source);
+  if (size == 0 || !skip_is_container(data[0])) {
+    Py_DECREF(source);
+    Py_RETURN_NONE;
+  }
+  PyObject* ret = NULL;
+  Py_ssize_t const end = msgpack_skip(data, 0, size);
+  if A_UNLIKELY(end == SKIP_INVALID) {
+    PyErr_SetString(PyExc_ValueError, "amsgpack: 0xc1 byte must not be used");
+  } else if A_UNLIKELY(end == SKIP_INCOMPLETE) {
+    PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
+  } else if A_UNLIKELY(end != size) {
+    PyErr_SetString(PyExc_ValueError, "Extra data");
+  } else {
+    ret = lazy_new(self, source, 0);
+  }
+  Py_DECREF(source);
+  return ret;
+}
+
+#undef LAZY_LOCK
+#undef LAZY_UNLOCK
@@ -0,0 +1,149 @@
+#include <Python.h>
+
+/*
+  Growable memory for `Packer.pack_into`. Unlike `bytes` returned by `packb`,
+  the memory is reused between messages until `clear` is called.
+*/
+typedef struct {
+  PyObject_HEAD
+  PackbWriter writer;
+  Py_ssize_t exports;  // number of exported buffers, resizing is forbidden
+  int packing;         // set while `Packer.pack_into` writes to the buffer
+} PackBuffer;
+
+static int PackBuffer_reserve(PackbWriter* writer, Py_ssize_t n) {
+  PackBuffer const* self =
+      (PackBuffer*)((char*)writer - offsetof(PackBuffer, writer));
+  if A_UNLIKELY(self->exports != 0) {
+    PyErr_SetString(PyExc_BufferError,
+                    "Existing exports of data: PackBuffer can not be resized");
+    return -1;
+  }
+  return packb_reserve_mem(writer, n);
+}
+
+static int PackBuffer_init(PackBuffer* self, PyObject* args,
+                           PyObject* kwargs) {
+  static char* keywords[] = {"capacity", NULL};
+  Py_ssize_t capacity = 1024;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n:PackBuffer", keywords,
+                                   &capacity)) {
+    return -1;
+  }
+  if A_UNLIKELY(capacity < 0) {
+    PyErr_SetString(PyExc_ValueError, "`capacity` must be non-negative");
+    return -1;
+  }
+  if A_UNLIKELY(self->exports != 0 || self->packing != 0) {
+    PyErr_SetString(PyExc_BufferError, "PackBuffer is in use");
+    return -1;
+  }
+  capacity = Py_MAX(capacity, 16);
+  char* const data = (char*)PyMem_Realloc(self->writer.data, capacity);
+  if A_UNLIKELY(data == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  self->writer = (PackbWriter){.data = data,
+                               .size = 0,
+                               .capacity = capacity,
+                               .reserve = PackBuffer_reserve,
+                               .payload = packb_payload_copy};
+  return 0;
+}
+
+static void PackBuffer_dealloc(PackBuffer* self) {
+  PyMem_Free(self->writer.data);
+  Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static Py_ssize_t PackBuffer_length(PackBuffer* self) {
+  return self->writer.size;
+}
+
+static int PackBuffer_getbuffer(PackBuffer* self, Py_buffer* view,
+                                int flags) {
+  if A_UNLIKELY(self->writer.data == NULL) {
+    PyErr_SetString(PyExc_ValueError, "PackBuffer is not initialized");
+    return -1;
+  }
+  if A_UNLIKELY(PyBuffer_FillInfo(view, (PyObject*)self, self->writer.data,
+                                  self->writer.size, 1, flags) != 0) {
+    return -1;
+  }
+  self->exports += 1;
+  return 0;
+}
+
+static void PackBuffer_releasebuffer(PackBuffer* self,
+                                     Py_buffer* Py_UNUSED(view)) {
+  self->exports -= 1;
+}
+
+static PyObject* PackBuffer_clear(PackBuffer* self,
+                                  PyObject* Py_UNUSED(unused)) {
+  if A_UNLIKELY(self->packing != 0) {
+    PyErr_SetString(PyExc_BufferError, "PackBuffer is in use");
+    return NULL;
+  }
+  self->writer.size = 0;
+  Py_RETURN_NONE;
+}
+
+static PyObject* PackBuffer_view(PackBuffer* self,
+                                 PyObject* Py_UNUSED(unused)) {
+  return PyMemoryView_FromObject((PyObject*)self);
+}
+
+PyDoc_STRVAR(PackBuffer_clear_doc,
+             "clear($self, /)\n--\n\n"
+             "Sets length to zero. Allocated memory is kept for reuse.");
+PyDoc_STRVAR(PackBuffer_view_doc,
+             "view($self, /)\n--\n\n"
+             "Returns read-only ``memoryview`` of the packed data without "
+             "copying. The buffer can not grow while the view exists.");
+
+static PyMethodDef PackBuffer_methods[] = {
+    {"clear", (PyCFunction)PackBuffer_clear, METH_NOARGS,
+     PackBuffer_clear_doc},
+    {"view", (PyCFunction)PackBuffer_view, METH_NOARGS, PackBuffer_view_doc},
+    {NULL, NULL, 0, NULL}  // Sentinel
+};
+
+PyDoc_STRVAR(PackBuffer_doc,
+             "PackBuffer(capacity=1024)\n"
+             "--\n\n"
+             "Reusable growable buffer for :meth:`Packer.pack_into`. Packed "
+             "messages are appended to the end:\n\n"
+             ">>> from amsgpack import PackBuffer, Packer\n"
+             ">>> buffer = PackBuffer()\n"
+             ">>> packer = Packer()\n"
+             ">>> packer.pack_into(buffer, 1)\n"
+             "1\n"
+             ">>> packer.pack_into(buffer, 'a')\n"
+             "2\n"
+             ">>> bytes(buffer)\n"
+             "b'\\x01\\xa1a'\n"
+             ">>> buffer.clear()\n"
+             ">>> len(buffer)\n"
+             "0\n");
+
+BEGIN_NO_PEDANTIC
+static PyType_Slot PackBuffer_slots[] = {
+    {Py_tp_doc, (char*)PackBuffer_doc},
+    {Py_tp_new, PyType_GenericNew},
+    {Py_tp_init, PackBuffer_init},
+    {Py_tp_dealloc, (destructor)PackBuffer_dealloc},
+    {Py_tp_methods, PackBuffer_methods},
+    {Py_sq_length, (lenfunc)PackBuffer_length},
+    {Py_bf_getbuffer, (getbufferproc)PackBuffer_getbuffer},
+    {Py_bf_releasebuffer, (releasebufferproc)PackBuffer_releasebuffer},
+    {0, NULL}};
+END_NO_PEDANTIC
+
+static PyType_Spec PackBuffer_spec = {
+    .name = "amsgpack.PackBuffer",
+    .basicsize = sizeof(PackBuffer),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE,
+    .slots = PackBuffer_slots,
+};
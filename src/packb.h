@@ -1,15 +1,65 @@
+#ifdef _WIN32
+#include <io.h>  // _write
+#else
+#include <unistd.h>  // write
+#endif
+
 #include "ext.h"
 #include "raw.h"
+#include "struct_plan.h"
+#include "typed_array.h"
+#include "utf8.h"
+#include "xxh64.h"
+
+// `size` and `capacity` are cached locally, so sync them with the writer
+// before asking it for more space
+#define AMSGPACK_RESIZE(n)                             \
+  do {                                                 \
+    if A_UNLIKELY(capacity < size + n) {               \
+      writer->size = size;                             \
+      if A_UNLIKELY(writer->reserve(writer, n) != 0) { \
+        goto error;                                    \
+      }                                                \
+      data = writer->data;                             \
+      size = writer->size;                             \
+      capacity = writer->capacity;                     \
+    }                                                  \
+  } while (0)
+
+// copies `n` bytes from `src`, when there is no room, the writer decides
+// how to handle the payload, for example, write it without copying
+#define AMSGPACK_PAYLOAD(src, n)                            \
+  do {                                                      \
+    if A_LIKELY(capacity >= size + n) {                     \
+      memcpy(data + size, src, n);                          \
+      size += n;                                            \
+    } else {                                                \
+      writer->size = size;                                  \
+      if A_UNLIKELY(writer->payload(writer, src, n) != 0) { \
+        goto error;                                         \
+      }                                                     \
+      data = writer->data;                                  \
+      size = writer->size;                                  \
+      capacity = writer->capacity;                          \
+    }                                                       \
+  } while (0)
 
-#define AMSGPACK_RESIZE(n)                                        \
-  do {                                                            \
-    if A_UNLIKELY(capacity < size + n) {                          \
-      capacity += Py_MAX(capacity, n);                            \
-      if A_UNLIKELY(_PyBytes_Resize(&buffer_py, capacity) != 0) { \
-        goto error;                                               \
-      }                                                           \
-      data = PyBytes_AS_STRING(buffer_py);                        \
-    }                                                             \
+// the same as `AMSGPACK_PAYLOAD` for the whole content of `owner` object,
+// writers with `reference` keep big payloads as `owner` references
+#define AMSGPACK_OWNED_PAYLOAD(owner, src, n)                \
+  do {                                                       \
+    if A_UNLIKELY(writer->reference != NULL &&               \
+                  n >= writer->reference_size) {             \
+      writer->size = size;                                   \
+      if A_UNLIKELY(writer->reference(writer, owner) != 0) { \
+        goto error;                                          \
+      }                                                      \
+      data = writer->data;                                   \
+      size = writer->size;                                   \
+      capacity = writer->capacity;                           \
+    } else {                                                 \
+      AMSGPACK_PAYLOAD(src, n);                              \
+    }                                                        \
   } while (0)
 
 static inline void put2(char* dst, char header, char value) {
@@ -56,7 +106,8 @@ typedef struct {
     LIST_OR_TUPLE_NEXT,
     KEY_NEXT,
     VALUE_NEXT,
-    DEFAULT_NEXT
+    DEFAULT_NEXT,
+    STRUCT_NEXT
   } action;
   union {
     PyObject* sequence;
@@ -64,28 +115,301 @@ typedef struct {
   };
   Py_ssize_t size;
   Py_ssize_t pos;
-  PyObject* value;  // holds value from PyDict_Next
+  PyObject* value;  // holds value from PyDict_Next or owned attribute value
+  StructPlan const* plan;
 } PackbStack;
 
+// `Packer(compact_floats=...)` modes
+#define COMPACT_FLOATS_DISABLED 0
+#define COMPACT_FLOATS_FLOAT32 1  // float32 when it keeps the value
+#define COMPACT_FLOATS_INT 2      // integral floats as integers too
+
 typedef struct {
   PyObject_HEAD
   AMsgPackState* state;
   PyObject* default_hook;
+  Py_ssize_t size_hint;  // decaying high-water mark of `packb` output sizes
+  PyObject* plans;       // {type: StructPlan capsule or None}, when enabled
+  int structs_as_array;
+  int presize;  // `packb` counts the size first to allocate the output once
+  int compact_floats;  // COMPACT_FLOATS_DISABLED, _FLOAT32 or _INT
+  int typed_arrays;  // Ext code, TYPED_ARRAYS_AS_ARRAY or TYPED_ARRAYS_DISABLED
 } Packer;
 
+typedef struct PackbWriter PackbWriter;
+
+// Makes room for `n` more bytes after `writer->size`.
+// returns: -1 - failure (exception is set)
+//           0 - success
+typedef int (*packb_reserve)(PackbWriter* writer, Py_ssize_t n);
+
+// Writes `n` bytes of `src` that do not fit into `capacity`.
+// returns: -1 - failure (exception is set)
+//           0 - success
+typedef int (*packb_payload)(PackbWriter* writer, char const* src,
+                             Py_ssize_t n);
+
+// Keeps `owner` object instead of copying its content.
+// returns: -1 - failure (exception is set)
+//           0 - success
+typedef int (*packb_reference)(PackbWriter* writer, PyObject* owner);
+
+/*
+  Destination of `packb_write`. `data`, `size` and `capacity` describe
+  the output memory, `reserve` is called when `capacity` is not enough.
+  `payload` is called for string and binary data that does not fit.
+  `reference`, when set, is called for binary data of `reference_size`
+  bytes or more.
+*/
+struct PackbWriter {
+  char* data;
+  Py_ssize_t size;
+  Py_ssize_t capacity;
+  packb_reserve reserve;
+  packb_payload payload;
+  PyObject* buffer_py;  // `bytes` object, used by `packb`
+  packb_reference reference;
+  Py_ssize_t reference_size;
+};
+
+static int packb_payload_copy(PackbWriter* writer, char const* src,
+                              Py_ssize_t n) {
+  if A_UNLIKELY(writer->reserve(writer, n) != 0) {
+    return -1;
+  }
+  memcpy(writer->data + writer->size, src, n);
+  writer->size += n;
+  return 0;
+}
+
+// `packb` starts in stack memory and moves to `bytes` object only when the
+// message does not fit
+static int packb_reserve_bytes(PackbWriter* writer, Py_ssize_t n) {
+  Py_ssize_t const capacity = writer->capacity + Py_MAX(writer->capacity, n);
+  if (writer->buffer_py == NULL) {
+    writer->buffer_py = PyBytes_FromStringAndSize(NULL, capacity);
+    if A_UNLIKELY(writer->buffer_py == NULL) {
+      return -1;
+    }
+    memcpy(PyBytes_AS_STRING(writer->buffer_py), writer->data, writer->size);
+  } else if A_UNLIKELY(_PyBytes_Resize(&writer->buffer_py, capacity) != 0) {
+    return -1;
+  }
+  writer->data = PyBytes_AS_STRING(writer->buffer_py);
+  writer->capacity = capacity;
+  return 0;
+}
+
+static int packb_reserve_mem(PackbWriter* writer, Py_ssize_t n) {
+  Py_ssize_t const capacity = writer->capacity + Py_MAX(writer->capacity, n);
+  char* const data = (char*)PyMem_Realloc(writer->data, capacity);
+  if A_UNLIKELY(data == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  writer->data = data;
+  writer->capacity = capacity;
+  return 0;
+}
+
+static int packb_reserve_fixed(PackbWriter* Py_UNUSED(writer),
+                               Py_ssize_t Py_UNUSED(n)) {
+  PyErr_SetString(PyExc_ValueError, "Buffer is too small");
+  return -1;
+}
+
+#include "pack_buffer.h"
+
+/*
+  Writer for `Packer.dump`. Full chunks are flushed to `file.write` or to
+  the file descriptor, so the memory is bounded by the chunk size.
+*/
+typedef struct {
+  PackbWriter writer;
+  PyObject* write;     // bound `file.write` method or NULL when `fd` is used
+  int fd;              // file descriptor
+  Py_ssize_t written;  // number of flushed bytes
+} PackbFileWriter;
+
+// calls `view.release()`, keeping the exception of a failed `write`
+// returns: -1 - failure (exception is set)
+//           0 - success
+static int packb_release_view(PyObject* view) {
+#if PY_VERSION_HEX >= 0x030C0000
+  PyObject* exc = PyErr_GetRaisedException();
+#else
+  PyObject *exc_type, *exc_value, *exc_tb;
+  PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+#endif
+  PyObject* release_result = PyObject_CallMethod(view, "release", NULL);
+  Py_XDECREF(release_result);
+#if PY_VERSION_HEX >= 0x030C0000
+  if (exc != NULL) {
+    PyErr_SetRaisedException(exc);  // the `write` error replaces ours
+    return -1;
+  }
+#else
+  if (exc_type != NULL) {
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+    return -1;
+  }
+#endif
+  return release_result == NULL ? -1 : 0;
+}
+
+static int packb_file_write(PackbFileWriter* file_writer, char const* src,
+                            Py_ssize_t n) {
+  while (n != 0) {
+    Py_ssize_t written;
+    if (file_writer->write == NULL) {
+      int const fd = file_writer->fd;
+      Py_BEGIN_ALLOW_THREADS
+#ifdef _WIN32
+      written = _write(fd, src, (unsigned int)Py_MIN(n, INT_MAX));
+#else
+      written = write(fd, src, (size_t)n);
+#endif
+      Py_END_ALLOW_THREADS
+      if A_UNLIKELY(written < 0) {
+        if (errno == EINTR) {
+          if (PyErr_CheckSignals() != 0) {
+            return -1;
+          }
+          continue;
+        }
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+      }
+    } else {
+      PyObject* view = PyMemoryView_FromMemory((char*)src, n, PyBUF_READ);
+      if A_UNLIKELY(view == NULL) {
+        return -1;
+      }
+      PyObject* result = PyObject_CallOneArg(file_writer->write, view);
+      // `write` must not keep the view, as the memory is reused
+      int const release_result = packb_release_view(view);
+      Py_DECREF(view);
+      if A_UNLIKELY(release_result != 0) {
+        Py_XDECREF(result);
+        return -1;
+      }
+      if (result == Py_None) {
+        written = n;  // not all file-like objects report the written size
+      } else {
+        written = PyLong_AsSsize_t(result);
+        if A_UNLIKELY(written == -1 && PyErr_Occurred() != NULL) {
+          Py_DECREF(result);
+          return -1;
+        }
+      }
+      Py_DECREF(result);
+    }
+    if A_UNLIKELY(written <= 0 || written > n) {
+      PyErr_Format(PyExc_OSError, "Failed to write %zd bytes to the file", n);
+      return -1;
+    }
+    src += written;
+    n -= written;
+    file_writer->written += written;
+  }
+  return 0;
+}
+
+static int packb_reserve_file(PackbWriter* writer, Py_ssize_t n) {
+  PackbFileWriter* file_writer =
+      (PackbFileWriter*)((char*)writer - offsetof(PackbFileWriter, writer));
+  if A_UNLIKELY(packb_file_write(file_writer, writer->data, writer->size) !=
+                0) {
+    return -1;
+  }
+  writer->size = 0;
+  if A_UNLIKELY(n > writer->capacity) {
+    char* const data = (char*)PyMem_Realloc(writer->data, n);
+    if A_UNLIKELY(data == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    writer->data = data;
+    writer->capacity = n;
+  }
+  return 0;
+}
+
+static int packb_payload_file(PackbWriter* writer, char const* src,
+                              Py_ssize_t n) {
+  if (n < writer->capacity) {
+    return packb_payload_copy(writer, src, n);
+  }
+  // big payload, write it as is
+  PackbFileWriter* file_writer =
+      (PackbFileWriter*)((char*)writer - offsetof(PackbFileWriter, writer));
+  if A_UNLIKELY(packb_file_write(file_writer, writer->data, writer->size) !=
+                0) {
+    return -1;
+  }
+  writer->size = 0;
+  return packb_file_write(file_writer, src, n);
+}
+
 static int Packer_init(Packer* self, PyObject* args, PyObject* kwargs) {
-  static char* keywords[] = {"default", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:Packer", keywords,
-                                   &self->default_hook)) {
+  static char* keywords[] = {"default", "structs",        "typed_arrays",
+                             "presize", "compact_floats", NULL};
+  PyObject* default_hook = NULL;  // borrowed until every option is valid
+  char const* structs = NULL;
+  PyObject* typed_arrays = NULL;
+  PyObject* compact_floats = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$zOpO:Packer", keywords,
+                                   &default_hook, &structs, &typed_arrays,
+                                   &self->presize, &compact_floats)) {
+    return -1;
+  }
+  if (compact_floats == NULL) {
+    self->compact_floats = COMPACT_FLOATS_DISABLED;
+  } else if (PyUnicode_Check(compact_floats)) {
+    if A_UNLIKELY(PyUnicode_CompareWithASCIIString(compact_floats, "int") !=
+                  0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "`compact_floats` must be True, False or 'int'");
+      return -1;
+    }
+    self->compact_floats = COMPACT_FLOATS_INT;
+  } else {
+    int const enabled = PyObject_IsTrue(compact_floats);
+    if A_UNLIKELY(enabled < 0) {
+      return -1;
+    }
+    self->compact_floats =
+        enabled ? COMPACT_FLOATS_FLOAT32 : COMPACT_FLOATS_DISABLED;
+  }
+  if A_UNLIKELY(typed_arrays_parse(&self->typed_arrays, typed_arrays, 1) !=
+                0) {
     return -1;
   }
-  Py_XINCREF(self->default_hook);
-  if A_UNLIKELY(self->default_hook != NULL &&
-                Py_TYPE(self->default_hook)->tp_call == NULL) {
-    Py_DECREF(self->default_hook);
+  if (structs != NULL) {
+    if (strcmp(structs, "map") == 0) {
+      self->structs_as_array = 0;
+    } else if A_LIKELY(strcmp(structs, "array") == 0) {
+      self->structs_as_array = 1;
+    } else {
+      PyErr_SetString(PyExc_ValueError,
+                      "`structs` must be 'map', 'array' or None");
+      return -1;
+    }
+    PyObject* plans = PyDict_New();
+    if A_UNLIKELY(plans == NULL) {
+      return -1;
+    }
+    Py_XSETREF(self->plans, plans);
+  } else {
+    Py_CLEAR(self->plans);
+  }
+  if A_UNLIKELY(default_hook != NULL &&
+                Py_TYPE(default_hook)->tp_call == NULL) {
     PyErr_SetString(PyExc_TypeError, "`default` must be callable");
     return -1;
   }
+  Py_XINCREF(default_hook);
+  Py_XSETREF(self->default_hook, default_hook);
   self->state =
       get_amsgpack_state(((PyHeapTypeObject*)Py_TYPE(self))->ht_module);
   if A_UNLIKELY(self->state == NULL) {
@@ -94,8 +418,23 @@ static int Packer_init(Packer* self, PyObject* args, PyObject* kwargs) {
   return 0;
 }
 
+static int Packer_traverse(Packer* self, visitproc visit, void* arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->default_hook);
+  Py_VISIT(self->plans);
+  return 0;
+}
+
+// `default` and the classes in `plans` may reference the packer
+static int Packer_clear(Packer* self) {
+  Py_CLEAR(self->default_hook);
+  Py_CLEAR(self->plans);
+  return 0;
+}
+
 static void Packer_dealloc(Packer* self) {
-  Py_XDECREF(self->default_hook);
+  PyObject_GC_UnTrack(self);
+  Packer_clear(self);
   Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -151,27 +490,396 @@ static void Packer_dealloc(Packer* self) {
     }                                             \
   }
 
-static PyObject* packer_packb(Packer* self, PyObject* obj) {
-  Py_ssize_t capacity = 1024;
-  Py_ssize_t size = 0;
-  PyObject* buffer_py = PyBytes_FromStringAndSize(NULL, capacity);
-  if A_UNLIKELY(buffer_py == NULL) {
-    return NULL;
+// writes integer to `dst` that has at least 9 bytes
+// returns: number of written bytes
+static A_FORCE_INLINE Py_ssize_t put_long_long(char* dst, long long value) {
+  if (value >= -0x20) {
+    if (value < 0x80) {
+      *dst = (char)value;
+      return 1;
+    } else if (value <= 0xff) {
+      put2(dst, '\xcc', (uint8_t)value);
+      return 2;
+    } else if (value <= 0xffff) {
+      put3(dst, '\xcd', (uint16_t)value);
+      return 3;
+    } else if (value <= 0xffffffff) {
+      put5(dst, '\xce', (uint32_t)value);
+      return 5;
+    }
+    put9(dst, '\xcf', (uint64_t)value);
+    return 9;
+  } else if (value >= -0x80) {
+    put2(dst, '\xd0', (char)value);
+    return 2;
+  } else if (value >= -0x8000) {
+    put3(dst, '\xd1', (uint16_t)value);
+    return 3;
+  } else if (value >= -0x80000000LL) {
+    put5(dst, '\xd2', (uint32_t)value);
+    return 5;
   }
-  char* data = PyBytes_AS_STRING(buffer_py);
+  put9(dst, '\xd3', (uint64_t)value);
+  return 9;
+}
+
+// writes float in the shortest lossless `compact_floats` form to `dst`,
+// that has at least 9 bytes
+// returns: number of written bytes
+static A_FORCE_INLINE Py_ssize_t put_compact_double(char* dst, double value,
+                                                    int compact_floats) {
+  if (compact_floats == COMPACT_FLOATS_INT && is_small_integral(value)) {
+    return put_long_long(dst, (long long)value);
+  }
+  if (is_float32_exact(value)) {
+    float const value32 = (float)value;
+    uint32_t bits;
+    memcpy(&bits, &value32, 4);
+    put5(dst, '\xca', bits);
+    return 5;
+  }
+  put9_dbl(dst, '\xcb', value);
+  return 9;
+}
+
+// number of typed array bytes converted at once, bounds `dump` memory
+#define TYPED_CHUNK_SIZE 4096
+
+// packs typed array `view` as MessagePack array or as Ext,
+// unsigned bytes are packed as bin
+// returns: -1 - failure
+//           0 - success
+static int packb_write_typed(int typed_arrays, PackbWriter* writer,
+                             Py_buffer const* view,
+                             TypedFormat const* format) {
+  char* data = writer->data;
+  Py_ssize_t size = writer->size;
+  Py_ssize_t capacity = writer->capacity;
+  int const itemsize = format->itemsize;
+  Py_ssize_t const count = view->len / itemsize;
+  char const* items = (char const*)view->buf;
+
+  if (format->kind == 'u' && itemsize == 1) {
+    // raw bytes, like `memoryview` of `bytes`
+    if A_LIKELY(count <= 0xff) {
+      AMSGPACK_RESIZE(2);
+      put2(data + size, '\xc4', (uint8_t)count);
+      size += 2;
+    } else if (count <= 0xffff) {
+      AMSGPACK_RESIZE(3);
+      put3(data + size, '\xc5', (uint16_t)count);
+      size += 3;
+    } else if (count <= 0xffffffff) {
+      AMSGPACK_RESIZE(5);
+      put5(data + size, '\xc6', (uint32_t)count);
+      size += 5;
+    } else {
+      PyErr_SetString(PyExc_ValueError,
+                      "Bytes length is out of MessagePack range");
+      goto error;
+    }
+    AMSGPACK_PAYLOAD(items, count);
+  } else if (typed_arrays == TYPED_ARRAYS_AS_ARRAY) {
+    if A_LIKELY(count <= 0x0f) {
+      AMSGPACK_RESIZE(1);
+      data[size] = '\x90' + (char)count;
+      size += 1;
+    } else if (count <= 0xffff) {
+      AMSGPACK_RESIZE(3);
+      put3(data + size, '\xdc', (uint16_t)count);
+      size += 3;
+    } else if (count <= 0xffffffff) {
+      AMSGPACK_RESIZE(5);
+      put5(data + size, '\xdd', (uint32_t)count);
+      size += 5;
+    } else {
+      PyErr_SetString(PyExc_ValueError,
+                      "List length is out of MessagePack range");
+      goto error;
+    }
+    // floats are written in MessagePack byte order,
+    // integers are read in native byte order
+    int const swap = format->kind == 'f' ? !format->big_endian
+                                         : format->big_endian;
+    char const float_header = itemsize == 4 ? '\xca' : '\xcb';
+    char swapped[TYPED_CHUNK_SIZE];
+    Py_ssize_t n;
+    for (Py_ssize_t start = 0; start < count; start += n) {
+      // `dump` chunk can be smaller than `swapped`
+      n = Py_MIN(TYPED_CHUNK_SIZE / itemsize, Py_MAX(1, capacity / 9));
+      n = Py_MIN(n, count - start);
+      char const* src = items + start * itemsize;
+      if (swap && itemsize > 1) {
+        bswap_copy(swapped, src, n, itemsize);
+        src = swapped;
+      }
+      AMSGPACK_RESIZE(n * 9);
+      char* dst = data + size;
+      if (format->kind == 'f') {
+        for (Py_ssize_t idx = 0; idx < n; ++idx) {
+          *dst = float_header;
+          memcpy(dst + 1, src + idx * itemsize, itemsize);
+          dst += 1 + itemsize;
+        }
+      } else {
+        for (Py_ssize_t idx = 0; idx < n; ++idx, src += itemsize) {
+          long long value;
+          switch (format->typecode) {
+            case 'b':
+              value = *(int8_t const*)src;
+              break;
+            case 'B':
+              value = *(uint8_t const*)src;
+              break;
+            case 'h': {
+              int16_t item;
+              memcpy(&item, src, 2);
+              value = item;
+              break;
+            }
+            case 'H': {
+              uint16_t item;
+              memcpy(&item, src, 2);
+              value = item;
+              break;
+            }
+            case 'i': {
+              int32_t item;
+              memcpy(&item, src, 4);
+              value = item;
+              break;
+            }
+            case 'I': {
+              uint32_t item;
+              memcpy(&item, src, 4);
+              value = item;
+              break;
+            }
+            case 'Q': {
+              uint64_t item;
+              memcpy(&item, src, 8);
+              if A_UNLIKELY(item > (uint64_t)LLONG_MAX) {
+                put9(dst, '\xcf', item);
+                dst += 9;
+                continue;
+              }
+              value = (long long)item;
+              break;
+            }
+            default:
+              memcpy(&value, src, 8);
+          }
+          dst += put_long_long(dst, value);
+        }
+      }
+      size = dst - data;
+    }
+  } else {
+    Py_ssize_t const ext_length = 1 + view->len;
+    char header = '\0';
+    switch (ext_length) {
+      case 1:
+        header = '\xd4';
+        break;
+      case 2:
+        header = '\xd5';
+        break;
+      case 4:
+        header = '\xd6';
+        break;
+      case 8:
+        header = '\xd7';
+        break;
+      case 16:
+        header = '\xd8';
+        break;
+    }
+    if (header != '\0') {
+      AMSGPACK_RESIZE(3);
+      put2(data + size, header, (char)typed_arrays);
+      size += 2;
+    } else if (ext_length <= 0xff) {
+      AMSGPACK_RESIZE(4);
+      put2(data + size, '\xc7', (uint8_t)ext_length);
+      data[size + 2] = (char)typed_arrays;
+      size += 3;
+    } else if (ext_length <= 0xffff) {
+      AMSGPACK_RESIZE(5);
+      put3(data + size, '\xc8', (uint16_t)ext_length);
+      data[size + 3] = (char)typed_arrays;
+      size += 4;
+    } else if (ext_length <= 0xffffffff) {
+      AMSGPACK_RESIZE(7);
+      put5(data + size, '\xc9', (uint32_t)ext_length);
+      data[size + 5] = (char)typed_arrays;
+      size += 6;
+    } else {
+      PyErr_SetString(PyExc_TypeError, "Ext() length is too large");
+      goto error;
+    }
+    data[size] = format->typecode;
+    size += 1;
+    if (format->big_endian || itemsize == 1) {
+      AMSGPACK_PAYLOAD(items, view->len);
+    } else {
+      Py_ssize_t n;
+      for (Py_ssize_t start = 0; start < count; start += n) {
+        n = Py_MIN(TYPED_CHUNK_SIZE, Py_MAX(itemsize, capacity)) / itemsize;
+        n = Py_MIN(n, count - start);
+        AMSGPACK_RESIZE(n * itemsize);
+        bswap_copy(data + size, items + start * itemsize, n, itemsize);
+        size += n * itemsize;
+      }
+    }
+  }
+  writer->size = size;
+  return 0;
+error:
+  writer->size = size;
+  return -1;
+}
+
+#undef TYPED_CHUNK_SIZE
+
+// number of list items converted at once, bounds the reserved memory
+#define NUMBERS_CHUNK_SIZE 256
+
+// packs the run of exact floats or exact integers of a list or a tuple,
+// starting at `values[*pos]`, `*pos` is advanced past the run
+// returns: -1 - failure
+//           0 - success
+static int packb_write_numbers(PackbWriter* writer, PyObject* const* values,
+                               Py_ssize_t* pos, Py_ssize_t end,
+                               int compact_floats) {
+  char* data = writer->data;
+  Py_ssize_t size = writer->size;
+  Py_ssize_t capacity = writer->capacity;
+  PyTypeObject const* const run_type = Py_TYPE(values[*pos]);
+  Py_ssize_t idx = *pos;
+  for (;;) {
+    // `dump` chunk can be smaller than the maximal reservation
+    Py_ssize_t const chunk_end =
+        Py_MIN(end, idx + Py_MIN(NUMBERS_CHUNK_SIZE, Py_MAX(1, capacity / 9)));
+    Py_ssize_t n = 0;
+    if (run_type == &PyFloat_Type) {
+      double swapped[NUMBERS_CHUNK_SIZE];
+      while (idx + n != chunk_end &&
+             Py_TYPE(values[idx + n]) == &PyFloat_Type) {
+        swapped[n] = PyFloat_AS_DOUBLE(values[idx + n]);
+        n += 1;
+      }
+      if (n == 0) {
+        break;
+      }
+      AMSGPACK_RESIZE(n * 9);
+      int compacted = 0;
+      if A_UNLIKELY(compact_floats != COMPACT_FLOATS_DISABLED) {
+        // the whole chunk is checked at once, usually it is packed in bulk
+        Py_ssize_t const float32_count = count_float32_exact(swapped, n);
+        int const integral = compact_floats == COMPACT_FLOATS_INT &&
+                             has_small_integral(swapped, n);
+        if (float32_count == n && !integral) {
+          float floats[NUMBERS_CHUNK_SIZE];
+          for (Py_ssize_t i = 0; i < n; ++i) {
+            floats[i] = (float)swapped[i];
+          }
+          bswap_copy((char*)floats, (char const*)floats, n, 4);
+          char* dst = data + size;
+          for (Py_ssize_t i = 0; i < n; ++i, dst += 5) {
+            *dst = '\xca';
+            memcpy(dst + 1, floats + i, 4);
+          }
+          size += n * 5;
+          compacted = 1;
+        } else if (float32_count != 0 || integral) {
+          for (Py_ssize_t i = 0; i < n; ++i) {
+            size += put_compact_double(data + size, swapped[i], compact_floats);
+          }
+          compacted = 1;
+        }
+      }
+      if (!compacted) {
+        bswap_copy((char*)swapped, (char const*)swapped, n, 8);
+        char* dst = data + size;
+        for (Py_ssize_t i = 0; i < n; ++i, dst += 9) {
+          *dst = '\xcb';
+          memcpy(dst + 1, swapped + i, 8);
+        }
+        size += n * 9;
+      }
+    } else {
+      long long numbers[NUMBERS_CHUNK_SIZE];
+      long long low = 0;
+      long long high = 0;
+      while (idx + n != chunk_end &&
+             Py_TYPE(values[idx + n]) == &PyLong_Type) {
+        long long const value = PyLong_AsLongLong(values[idx + n]);
+        if A_UNLIKELY(value == -1 && PyErr_Occurred() != NULL) {
+          goto error;
+        }
+        numbers[n] = value;
+        low = Py_MIN(low, value);
+        high = Py_MAX(high, value);
+        n += 1;
+      }
+      if (n == 0) {
+        break;
+      }
+      if (low >= -0x20 && high < 0x80) {
+        // every number is fixint, the common case of small counters
+        AMSGPACK_RESIZE(n);
+        for (Py_ssize_t i = 0; i < n; ++i) {
+          data[size + i] = (char)numbers[i];
+        }
+        size += n;
+      } else {
+        AMSGPACK_RESIZE(n * 9);
+        for (Py_ssize_t i = 0; i < n; ++i) {
+          size += put_long_long(data + size, numbers[i]);
+        }
+      }
+    }
+    idx += n;
+  }
+  *pos = idx;
+  writer->size = size;
+  return 0;
+error:
+  writer->size = size;
+  return -1;
+}
+
+#undef NUMBERS_CHUNK_SIZE
+
+// returns: -1 - failure
+//           0 - success
+static int packb_write(Packer* self, PyObject* obj, PackbWriter* writer) {
+  char* data = writer->data;
+  Py_ssize_t size = writer->size;
+  Py_ssize_t capacity = writer->capacity;
 
   PackbStack stack[A_STACK_SIZE];
   AMsgPackState const* state = self->state;
   unsigned int stack_length = 0;
   void* obj_type;
+  StructPlan const* plan;
+  int struct_result;
+  Py_buffer view;
+  TypedFormat format;
 pack_next:
   obj_type = Py_TYPE(obj);
 pack_next_with_obj_type_set:
   if A_UNLIKELY(obj_type == &PyFloat_Type) {
     // https://docs.python.org/3/c-api/float.html
+  obj_is_float:
     AMSGPACK_RESIZE(9);
-    put9_dbl(data + size, '\xcb', PyFloat_AS_DOUBLE(obj));
-    size += 9;
+    if A_UNLIKELY(self->compact_floats != COMPACT_FLOATS_DISABLED) {
+      size += put_compact_double(data + size, PyFloat_AS_DOUBLE(obj),
+                                 self->compact_floats);
+    } else {
+      put9_dbl(data + size, '\xcb', PyFloat_AS_DOUBLE(obj));
+      size += 9;
+    }
   } else if A_UNLIKELY(obj_type == &PyUnicode_Type) {
     // https://docs.python.org/3.11/c-api/unicode.html
     Py_ssize_t u8size;
@@ -181,14 +889,18 @@ pack_next_with_obj_type_set:
       u8size = ((PyASCIIObject*)obj)->length;
       u8string = (char*)(((PyASCIIObject*)obj) + 1);
     } else {
-      u8size = ((PyCompactUnicodeObject*)obj)->utf8_length;
-      if A_LIKELY(u8size == 0) {
-        u8string = PyUnicode_AsUTF8AndSize(obj, &u8size);
-        if A_UNLIKELY(u8string == NULL) {
-          return NULL;
+      u8string = ((PyCompactUnicodeObject*)obj)->utf8;
+      if A_LIKELY(u8string == NULL) {
+        // transcoded below, so UTF-8 copy is not attached to the object
+        u8size = ucs_utf8_length(PyUnicode_KIND(obj), PyUnicode_DATA(obj),
+                                 PyUnicode_GET_LENGTH(obj));
+        if A_UNLIKELY(u8size < 0) {
+          // surrogates, let Python raise the usual UnicodeEncodeError
+          PyUnicode_AsUTF8AndSize(obj, &u8size);
+          goto error;
         }
       } else {
-        u8string = ((PyCompactUnicodeObject*)obj)->utf8;
+        u8size = ((PyCompactUnicodeObject*)obj)->utf8_length;
       }
     }
 
@@ -197,15 +909,15 @@ pack_next_with_obj_type_set:
       data[size] = '\xa0' + (char)u8size;
       size += 1;
     } else if (u8size <= 0xff) {
-      AMSGPACK_RESIZE(2 + u8size);
+      AMSGPACK_RESIZE(2);
       put2(data + size, '\xd9', (uint8_t)u8size);
       size += 2;
     } else if A_UNLIKELY(u8size <= 0xffff) {
-      AMSGPACK_RESIZE(3 + u8size);
+      AMSGPACK_RESIZE(3);
       put3(data + size, '\xda', (uint16_t)u8size);
       size += 3;
     } else if A_UNLIKELY(u8size <= 0xffffffff) {
-      AMSGPACK_RESIZE(5 + u8size);
+      AMSGPACK_RESIZE(5);
       put5(data + size, '\xdb', (uint32_t)u8size);
       size += 5;
     } else {
@@ -213,10 +925,26 @@ pack_next_with_obj_type_set:
                       "String length is out of MessagePack range");
       goto error;
     }
-    memcpy(data + size, u8string, u8size);
-    size += u8size;
+    if A_LIKELY(u8string != NULL) {
+      AMSGPACK_PAYLOAD(u8string, u8size);
+    } else {
+      int const kind = PyUnicode_KIND(obj);
+      void const* ucs_data = PyUnicode_DATA(obj);
+      Py_ssize_t const length = PyUnicode_GET_LENGTH(obj);
+      Py_ssize_t pos = 0;
+      for (Py_ssize_t left = u8size; left != 0;) {
+        // the whole string when it fits the writer, otherwise piece by
+        // piece, so `dump` keeps its chunk size
+        AMSGPACK_RESIZE((left <= capacity ? left : 4));
+        Py_ssize_t const written = ucs_utf8_encode(
+            data + size, capacity - size, kind, ucs_data, &pos, length);
+        size += written;
+        left -= written;
+      }
+    }
   } else if A_UNLIKELY(obj_type == &PyLong_Type) {
     // https://docs.python.org/3/c-api/long.html
+  obj_is_long:;
     long long const value = PyLong_AsLongLong(obj);
     if A_UNLIKELY(value == -1 && PyErr_Occurred() != NULL) {
       goto error;
@@ -224,6 +952,7 @@ pack_next_with_obj_type_set:
     PACK_LONG_LONG();
   } else if A_UNLIKELY(obj_type == &PyList_Type || obj_type == &PyTuple_Type) {
     // https://docs.python.org/3.11/c-api/list.html
+  obj_is_list_or_tuple:
     if A_UNLIKELY(stack_length >= A_STACK_SIZE) {
       PyErr_SetString(PyExc_ValueError, "Deeply nested object");
       goto error;
@@ -255,25 +984,12 @@ pack_next_with_obj_type_set:
 #else
     PyObject** values = PySequence_Fast_ITEMS(obj);
 #endif
-    stack[stack_length] = (PackbStack){.action = LIST_OR_TUPLE_NEXT,
-                                       .values = values,
-                                       .size = length,
-                                       .pos = 0};
-    PackbStack* item = &stack[stack_length];
-    stack_length += 1;
-    while (item->pos != length && Py_TYPE(values[item->pos]) == &PyFloat_Type) {
-      AMSGPACK_RESIZE(9);
-      put9_dbl(data + size, '\xcb', PyFloat_AS_DOUBLE(values[item->pos++]));
-      size += 9;
-    }
-    while (item->pos != length && Py_TYPE(values[item->pos]) == &PyLong_Type) {
-      long long const value = PyLong_AsLongLong(values[item->pos++]);
-      if A_UNLIKELY(value == -1 && PyErr_Occurred() != NULL) {
-        goto error;
-      }
-      PACK_LONG_LONG();
-    }
+    stack[stack_length++] = (PackbStack){.action = LIST_OR_TUPLE_NEXT,
+                                         .values = values,
+                                         .size = length,
+                                         .pos = 0};
   } else if A_UNLIKELY(obj_type == &PyDict_Type) {
+  obj_is_dict:
     if A_UNLIKELY(stack_length >= A_STACK_SIZE) {
       PyErr_SetString(PyExc_ValueError, "Deeply nested object");
       goto error;
@@ -304,6 +1020,7 @@ pack_next_with_obj_type_set:
                        obj_type == &PyByteArray_Type) {
     // https://docs.python.org/3.11/c-api/bytes.html
     // https://docs.python.org/3.11/c-api/bytearray.html
+  obj_is_bytes_or_bytearray:;
     char* bytes_buffer;
     Py_ssize_t bytes_size;
     if A_LIKELY(obj_type == &PyBytes_Type) {
@@ -314,15 +1031,15 @@ pack_next_with_obj_type_set:
       bytes_buffer = PyByteArray_AS_STRING(obj);
     }
     if A_LIKELY(bytes_size <= 0xff) {
-      AMSGPACK_RESIZE(2 + bytes_size);
+      AMSGPACK_RESIZE(2);
       put2(data + size, '\xc4', (uint8_t)bytes_size);
       size += 2;
     } else if (bytes_size <= 0xffff) {
-      AMSGPACK_RESIZE(3 + bytes_size);
+      AMSGPACK_RESIZE(3);
       put3(data + size, '\xc5', (uint16_t)bytes_size);
       size += 3;
     } else if (bytes_size <= 0xffffffff) {
-      AMSGPACK_RESIZE(5 + bytes_size);
+      AMSGPACK_RESIZE(5);
       put5(data + size, '\xc6', (uint32_t)bytes_size);
       size += 5;
     } else {
@@ -330,8 +1047,7 @@ pack_next_with_obj_type_set:
                       "Bytes length is out of MessagePack range");
       goto error;
     }
-    memcpy(data + size, bytes_buffer, bytes_size);
-    size += bytes_size;
+    AMSGPACK_OWNED_PAYLOAD(obj, bytes_buffer, bytes_size);
   } else if A_UNLIKELY(obj_type == &PyBool_Type) {
     AMSGPACK_RESIZE(1);
     data[size] = obj == Py_True ? '\xc3' : '\xc2';
@@ -342,8 +1058,8 @@ pack_next_with_obj_type_set:
     size += 1;
   } else if A_UNLIKELY(obj_type == state->ext_type) {
     Ext const* ext = (Ext*)obj;
-    Py_ssize_t const ext_data_length = PyBytes_GET_SIZE(ext->data);
-    char const* data_bytes = PyBytes_AS_STRING(ext->data);
+    Py_ssize_t const ext_data_length = ext->view.len;
+    char const* data_bytes = (char const*)ext->view.buf;
     char header = '\0';
     switch (ext_data_length) {
       case 1:
@@ -363,15 +1079,15 @@ pack_next_with_obj_type_set:
         goto non_default;
       default:
         if (ext_data_length <= 0xff) {
-          AMSGPACK_RESIZE(2 + 1 + ext_data_length);
+          AMSGPACK_RESIZE(2 + 1);
           put2(data + size, '\xc7', (uint8_t)ext_data_length);
           size += 2;
         } else if (ext_data_length <= 0xffff) {
-          AMSGPACK_RESIZE(3 + 1 + ext_data_length);
+          AMSGPACK_RESIZE(3 + 1);
           put3(data + size, '\xc8', (uint16_t)ext_data_length);
           size += 3;
         } else if (ext_data_length <= 0xffffffff) {
-          AMSGPACK_RESIZE(5 + 1 + ext_data_length);
+          AMSGPACK_RESIZE(5 + 1);
           put5(data + size, '\xc9', (uint32_t)ext_data_length);
           size += 5;
         } else {
@@ -379,20 +1095,19 @@ pack_next_with_obj_type_set:
           goto error;
         }
         data[size] = ext->code;
-        memcpy(data + size + 1, data_bytes, ext_data_length);
-        size += 1 + ext_data_length;
+        size += 1;
+        AMSGPACK_OWNED_PAYLOAD(ext->data, data_bytes, ext_data_length);
         break;
       non_default:
         AMSGPACK_RESIZE(2 + ext_data_length);
-        put2(data, header, ext->code);
-        memcpy(data + 2, data_bytes, ext_data_length);
+        put2(data + size, header, ext->code);
+        memcpy(data + size + 2, data_bytes, ext_data_length);
         size += 2 + ext_data_length;
     }
   } else if A_UNLIKELY(obj_type == state->raw_type) {
-    Py_ssize_t const raw_length = PyBytes_GET_SIZE(((Raw*)obj)->data);
-    AMSGPACK_RESIZE(raw_length);
-    memcpy(data + size, PyBytes_AS_STRING(((Raw*)obj)->data), raw_length);
-    size += raw_length;
+    Raw const* raw = (Raw*)obj;
+    AMSGPACK_OWNED_PAYLOAD(raw->data, (char const*)raw->view.buf,
+                           raw->view.len);
   } else if A_UNLIKELY(PyDateTime_CheckExact(obj) ||
                        obj_type == state->timestamp_type) {
     MsgPackTimestamp const ts = obj_type == state->timestamp_type
@@ -448,22 +1163,161 @@ pack_next_with_obj_type_set:
       data[size + 3 + 11] = (ts.seconds >> 000) & 0xff;
       size += 15;
     }
+  } else if (self->typed_arrays != TYPED_ARRAYS_DISABLED &&
+             PyObject_CheckBuffer(obj)) {
+    if A_UNLIKELY(PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS |
+                                                     PyBUF_FORMAT) != 0) {
+      // non-contiguous views and exporters without formats
+      if (self->default_hook != NULL) {
+        PyErr_Clear();
+        goto call_default;
+      }
+      goto error;
+    }
+    if A_UNLIKELY(view.ndim > 1 ||
+                  typed_format_parse(&format, view.format, view.itemsize) ==
+                      0) {
+      if (self->default_hook != NULL) {
+        PyBuffer_Release(&view);
+        goto call_default;
+      }
+      if (view.ndim > 1) {  // the shape would be lost
+        PyErr_Format(PyExc_TypeError,
+                     "Unsupported '%s' object buffer of %d dimensions",
+                     Py_TYPE(obj)->tp_name, view.ndim);
+      } else {
+        PyErr_Format(PyExc_TypeError,
+                     "Unsupported '%s' object buffer format '%s'",
+                     Py_TYPE(obj)->tp_name, view.format);
+      }
+      PyBuffer_Release(&view);
+      goto error;
+    }
+    writer->size = size;
+    int const write_result =
+        packb_write_typed(self->typed_arrays, writer, &view, &format);
+    PyBuffer_Release(&view);
+    if A_UNLIKELY(write_result != 0) {
+      goto error;
+    }
+    data = writer->data;
+    size = writer->size;
+    capacity = writer->capacity;
+  } else if (self->plans != NULL &&
+             (struct_result = struct_plan_get(self->plans, obj_type,
+                                              self->structs_as_array,
+                                              &plan)) != 0) {
+    if A_UNLIKELY(struct_result < 0) {
+      goto error;
+    }
+    if A_UNLIKELY(stack_length >= A_STACK_SIZE) {
+      PyErr_SetString(PyExc_ValueError, "Deeply nested object");
+      goto error;
+    }
+    Py_ssize_t const length = plan->length;
+    if A_UNLIKELY(plan->is_tuple && PyTuple_GET_SIZE(obj) != length) {
+      PyErr_Format(PyExc_ValueError,
+                   "'%s' object length does not match its fields",
+                   Py_TYPE(obj)->tp_name);
+      goto error;
+    }
+    if (plan->keys == NULL) {
+      if A_LIKELY(length <= 0x0f) {
+        AMSGPACK_RESIZE(1);
+        data[size] = '\x90' + (char)length;
+        size += 1;
+      } else if (length <= 0xffff) {
+        AMSGPACK_RESIZE(3);
+        put3(data + size, '\xdc', (uint16_t)length);
+        size += 3;
+      } else {
+        AMSGPACK_RESIZE(5);
+        put5(data + size, '\xdd', (uint32_t)length);
+        size += 5;
+      }
+    } else {
+      if A_LIKELY(length <= 0x0f) {
+        AMSGPACK_RESIZE(1);
+        data[size] = '\x80' + (char)length;
+        size += 1;
+      } else if (length <= 0xffff) {
+        AMSGPACK_RESIZE(3);
+        put3(data + size, '\xde', (uint16_t)length);
+        size += 3;
+      } else {
+        AMSGPACK_RESIZE(5);
+        put5(data + size, '\xdf', (uint32_t)length);
+        size += 5;
+      }
+    }
+    stack[stack_length++] = (PackbStack){.action = STRUCT_NEXT,
+                                         .sequence = obj,
+                                         .size = length,
+                                         .pos = 0,
+                                         .value = NULL,
+                                         .plan = plan};
+  } else if (PyLong_Check(obj)) {
+    // subclasses of builtin types are checked after the exact types,
+    // `IntEnum` and `IntFlag`
+    goto obj_is_long;
+  } else if (PyUnicode_Check(obj)) {
+    goto obj_is_unicode;  // `StrEnum`
+  } else if (PyFloat_Check(obj)) {
+    goto obj_is_float;
+  } else if (PyList_Check(obj) || PyTuple_Check(obj)) {
+    obj_type = PyList_Check(obj) ? &PyList_Type : &PyTuple_Type;
+    goto obj_is_list_or_tuple;
+  } else if (PyDict_Check(obj) &&
+             Py_TYPE(obj)->tp_iter == PyDict_Type.tp_iter) {
+    goto obj_is_dict;  // `defaultdict` and `Counter` iterate as `dict`
+  } else if (PyBytes_Check(obj) || PyByteArray_Check(obj)) {
+    obj_type = PyBytes_Check(obj) ? &PyBytes_Type : &PyByteArray_Type;
+    goto obj_is_bytes_or_bytearray;
+  } else if (PyDict_Check(obj) || obj_type == &PyDictProxy_Type ||
+             PyAnySet_Check(obj)) {
+    // `OrderedDict` has its own order and `mappingproxy` wraps any mapping,
+    // so they are packed as a `dict` copy, sets are packed as a `tuple`
+    if A_UNLIKELY(stack_length >= A_STACK_SIZE) {
+      PyErr_SetString(PyExc_ValueError, "Deeply nested object");
+      goto error;
+    }
+    PyObject* new_obj;
+    if (PyAnySet_Check(obj)) {
+      new_obj = PySequence_Tuple(obj);
+    } else {
+      new_obj = PyDict_New();
+      if A_LIKELY(new_obj != NULL) {
+        if A_UNLIKELY(PyDict_Merge(new_obj, obj, 1) != 0) {
+          Py_CLEAR(new_obj);
+        }
+      }
+    }
+    if A_UNLIKELY(new_obj == NULL) {
+      goto error;
+    }
+    // the stack owns `new_obj` until it is packed
+    stack[stack_length++] =
+        (PackbStack){.action = DEFAULT_NEXT, .value = new_obj};
+    obj = new_obj;
+    goto pack_next;
   } else if A_LIKELY(self->default_hook == NULL) {
     PyErr_Format(PyExc_TypeError, "Unserializable '%s' object",
                  Py_TYPE(obj)->tp_name);
     goto error;
   } else {
+  call_default:
     if A_UNLIKELY(stack_length >= A_STACK_SIZE) {
       PyErr_SetString(PyExc_ValueError, "Deeply nested object");
       goto error;
     }
     PyObject* new_obj = PyObject_CallOneArg(self->default_hook, obj);
     if A_UNLIKELY(new_obj == NULL) {
-      return NULL;  // likely exception in user code
+      goto error;  // likely exception in user code
     }
-    Py_DECREF(obj);
+    // the stack owns `new_obj` until it is packed
+    stack[stack_length++] =
+        (PackbStack){.action = DEFAULT_NEXT, .value = new_obj};
     obj = new_obj;
-    stack[stack_length++] = (PackbStack){.action = DEFAULT_NEXT};
     goto pack_next;
   }
 
@@ -475,8 +1329,52 @@ pack_next_with_obj_type_set:
           stack_length -= 1;
           break;
         }
-        obj = item->values[item->pos++];
-        goto pack_next;
+        obj = item->values[item->pos];
+        obj_type = Py_TYPE(obj);
+        if (obj_type == &PyFloat_Type || obj_type == &PyLong_Type) {
+          PyObject** values = item->values;
+          if (item->size - item->pos >= 8 &&
+              Py_TYPE(values[item->pos + 1]) == obj_type &&
+              Py_TYPE(values[item->pos + 2]) == obj_type &&
+              Py_TYPE(values[item->pos + 3]) == obj_type) {
+            // a long run of numbers, pack it in bulk
+            writer->size = size;
+            if A_UNLIKELY(packb_write_numbers(writer, values, &item->pos,
+                                              item->size,
+                                              self->compact_floats) != 0) {
+              goto error;
+            }
+            data = writer->data;
+            size = writer->size;
+            capacity = writer->capacity;
+          } else if (obj_type == &PyFloat_Type) {
+            do {
+              AMSGPACK_RESIZE(9);
+              if A_UNLIKELY(self->compact_floats != COMPACT_FLOATS_DISABLED) {
+                size += put_compact_double(
+                    data + size, PyFloat_AS_DOUBLE(values[item->pos++]),
+                    self->compact_floats);
+              } else {
+                put9_dbl(data + size, '\xcb',
+                         PyFloat_AS_DOUBLE(values[item->pos++]));
+                size += 9;
+              }
+            } while (item->pos != item->size &&
+                     Py_TYPE(values[item->pos]) == &PyFloat_Type);
+          } else {
+            do {
+              long long const value = PyLong_AsLongLong(values[item->pos++]);
+              if A_UNLIKELY(value == -1 && PyErr_Occurred() != NULL) {
+                goto error;
+              }
+              PACK_LONG_LONG();
+            } while (item->pos != item->size &&
+                     Py_TYPE(values[item->pos]) == &PyLong_Type);
+          }
+          break;
+        }
+        item->pos += 1;
+        goto pack_next_with_obj_type_set;
       case KEY_NEXT:
         if A_UNLIKELY(item->pos == item->size) {
           stack_length -= 1;
@@ -494,36 +1392,784 @@ pack_next_with_obj_type_set:
         obj = item->value;
         goto pack_next;
       case DEFAULT_NEXT:
+        Py_DECREF(item->value);
         stack_length -= 1;
         break;
+      case STRUCT_NEXT: {
+        // the previous attribute value is packed now
+        Py_CLEAR(item->value);
+        if A_UNLIKELY(item->pos == item->size) {
+          stack_length -= 1;
+          break;
+        }
+        Py_ssize_t const pos = item->pos++;
+        StructPlan const* item_plan = item->plan;
+        if (item_plan->keys != NULL) {
+          Py_ssize_t const key_offset = item_plan->key_offsets[pos];
+          Py_ssize_t const key_size =
+              item_plan->key_offsets[pos + 1] - key_offset;
+          AMSGPACK_RESIZE(key_size);
+          memcpy(data + size, item_plan->keys + key_offset, key_size);
+          size += key_size;
+        }
+        if (item_plan->is_tuple) {
+          obj = PyTuple_GET_ITEM(item->sequence, pos);
+        } else {
+          obj = PyObject_GetAttr(item->sequence,
+                                 PyTuple_GET_ITEM(item_plan->names, pos));
+          if A_UNLIKELY(obj == NULL) {
+            goto error;
+          }
+          item->value = obj;
+        }
+        goto pack_next;
+      }
       default:             // GCOVR_EXCL_LINE
         Py_UNREACHABLE();  // GCOVR_EXCL_LINE
     }
   }
 
-  Py_SET_SIZE(buffer_py, size);
-  data[size] = 0;  // warning! is it safe?
-  return buffer_py;
+  writer->size = size;
+  return 0;
+error:
+  writer->size = size;
+  while (stack_length) {
+    PackbStack const* item = &stack[--stack_length];
+    if (item->action == DEFAULT_NEXT) {
+      Py_DECREF(item->value);
+    } else if (item->action == STRUCT_NEXT) {
+      Py_XDECREF(item->value);
+    }
+  }
+  return -1;
+}
+
+#define PACKB_SCRATCH_SIZE 1024
+
+// returns `bytes` object with the packed data, consuming `writer->buffer_py`
+static PyObject* packb_writer_to_bytes(PackbWriter* writer) {
+  Py_ssize_t const size = writer->size;
+  if (writer->buffer_py == NULL) {
+    return PyBytes_FromStringAndSize(writer->data, size);
+  }
+  if (writer->capacity - size > (size >> 3)) {
+    // give the slack back, as the result can live long in a queue
+    if A_UNLIKELY(_PyBytes_Resize(&writer->buffer_py, size) != 0) {
+      return NULL;
+    }
+    return writer->buffer_py;
+  }
+  Py_SET_SIZE(writer->buffer_py, size);
+  writer->data[size] = 0;  // warning! is it safe?
+  return writer->buffer_py;
+}
+
+// when recent messages were big, skips the doubling by starting big
+// returns: -1 - failure
+//           0 - success
+static inline int packb_writer_use_size_hint(Py_ssize_t size_hint,
+                                             PackbWriter* writer) {
+  if (size_hint > PACKB_SCRATCH_SIZE) {
+    writer->capacity = size_hint + (size_hint >> 3);
+    writer->buffer_py = PyBytes_FromStringAndSize(NULL, writer->capacity);
+    if A_UNLIKELY(writer->buffer_py == NULL) {
+      return -1;
+    }
+    writer->data = PyBytes_AS_STRING(writer->buffer_py);
+  }
+  return 0;
+}
+
+static inline void update_size_hint(Py_ssize_t* size_hint, Py_ssize_t size) {
+  Py_ssize_t const hint = *size_hint;
+  *size_hint = size >= hint ? size : hint - ((hint - size) >> 3);
+}
+
+/*
+  Writer for `Packer.packed_size`. Written bytes are counted and the scratch
+  memory is reused, payloads that do not fit are counted without copying.
+*/
+typedef struct {
+  PackbWriter writer;
+  Py_ssize_t counted;   // number of bytes, discarded from `writer.data`
+  Py_ssize_t max_size;  // `ValueError` is raised when `counted` exceeds it
+  char* memory;         // used instead of the scratch for big reservations
+} PackbCountWriter;
+
+static int packb_count_check(PackbCountWriter* count_writer) {
+  if A_UNLIKELY(count_writer->counted > count_writer->max_size) {
+    PyErr_SetString(PyExc_ValueError, "Packed size exceeds `max_size`");
+    return -1;
+  }
+  return 0;
+}
+
+static int packb_reserve_count(PackbWriter* writer, Py_ssize_t n) {
+  PackbCountWriter* count_writer =
+      (PackbCountWriter*)((char*)writer - offsetof(PackbCountWriter, writer));
+  count_writer->counted += writer->size;
+  writer->size = 0;
+  if A_UNLIKELY(packb_count_check(count_writer) != 0) {
+    return -1;
+  }
+  if A_UNLIKELY(n > writer->capacity) {
+    char* const data = (char*)PyMem_Realloc(count_writer->memory, n);
+    if A_UNLIKELY(data == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    count_writer->memory = writer->data = data;
+    writer->capacity = n;
+  }
+  return 0;
+}
+
+static int packb_payload_count(PackbWriter* writer,
+                               char const* Py_UNUSED(src), Py_ssize_t n) {
+  PackbCountWriter* count_writer =
+      (PackbCountWriter*)((char*)writer - offsetof(PackbCountWriter, writer));
+  count_writer->counted += n;
+  return packb_count_check(count_writer);
+}
+
+// returns: -1 - failure (exception is set)
+//           0 - success, `*packed_size` is set
+static int packb_count(Packer* self, PyObject* obj, Py_ssize_t max_size,
+                       Py_ssize_t* packed_size) {
+  char scratch[PACKB_SCRATCH_SIZE];
+  PackbCountWriter count_writer = {.writer = {.data = scratch,
+                                              .size = 0,
+                                              .capacity = PACKB_SCRATCH_SIZE,
+                                              .reserve = packb_reserve_count,
+                                              .payload = packb_payload_count,
+                                              .buffer_py = NULL},
+                                   .counted = 0,
+                                   .max_size = max_size,
+                                   .memory = NULL};
+  int result = packb_write(self, obj, &count_writer.writer);
+  PyMem_Free(count_writer.memory);
+  if A_LIKELY(result == 0) {
+    count_writer.counted += count_writer.writer.size;
+    result = packb_count_check(&count_writer);
+    *packed_size = count_writer.counted;
+  }
+  return result;
+}
+
+static PyObject* packer_packb(Packer* self, PyObject* obj) {
+  char scratch[PACKB_SCRATCH_SIZE];
+  PackbWriter writer = {.data = scratch,
+                        .size = 0,
+                        .capacity = PACKB_SCRATCH_SIZE,
+                        .reserve = packb_reserve_bytes,
+                        .payload = packb_payload_copy,
+                        .buffer_py = NULL};
+  if A_UNLIKELY(self->presize) {
+    Py_ssize_t packed_size;
+    if A_UNLIKELY(packb_count(self, obj, PY_SSIZE_T_MAX, &packed_size) != 0) {
+      return NULL;
+    }
+    if (packed_size > PACKB_SCRATCH_SIZE) {
+      // `reserve` still grows the buffer, when `default` returns
+      // something bigger the second time
+      writer.buffer_py = PyBytes_FromStringAndSize(NULL, packed_size);
+      if A_UNLIKELY(writer.buffer_py == NULL) {
+        return NULL;
+      }
+      writer.data = PyBytes_AS_STRING(writer.buffer_py);
+      writer.capacity = packed_size;
+    }
+  } else if A_UNLIKELY(packb_writer_use_size_hint(self->size_hint,
+                                                  &writer) != 0) {
+    return NULL;
+  }
+  if A_UNLIKELY(packb_write(self, obj, &writer) != 0) {
+    Py_XDECREF(writer.buffer_py);
+    return NULL;
+  }
+  update_size_hint(&self->size_hint, writer.size);
+  return packb_writer_to_bytes(&writer);
+}
+
+static PyObject* packer_packb_many(Packer* self, PyObject* args,
+                                   PyObject* kwargs) {
+  static char* keywords[] = {"iterable", "concat", "offsets", NULL};
+  PyObject* iterable = NULL;
+  int concat = 0;
+  int with_offsets = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$pp:packb_many",
+                                   keywords, &iterable, &concat,
+                                   &with_offsets)) {
+    return NULL;
+  }
+  PyObject* iterator = PyObject_GetIter(iterable);
+  if A_UNLIKELY(iterator == NULL) {
+    return NULL;
+  }
+  PyObject* messages = NULL;
+  PyObject* offsets = NULL;
+  PyObject* ret = NULL;
+  char scratch[PACKB_SCRATCH_SIZE];
+  // `concat` packs everything to a single `bytes` object, otherwise
+  // one scratch memory is reused for every message
+  PackbWriter writer = {.data = scratch,
+                        .size = 0,
+                        .capacity = PACKB_SCRATCH_SIZE,
+                        .reserve = packb_reserve_bytes,
+                        .payload = packb_payload_copy,
+                        .buffer_py = NULL};
+  if (concat == 0) {
+    writer.reserve = packb_reserve_mem;
+    writer.data = (char*)PyMem_Malloc(PACKB_SCRATCH_SIZE);
+    if A_UNLIKELY(writer.data == NULL) {
+      PyErr_NoMemory();
+      goto error;
+    }
+    messages = PyList_New(0);
+    if A_UNLIKELY(messages == NULL) {
+      goto error;
+    }
+  }
+  if (with_offsets != 0 && (offsets = PyList_New(0)) == NULL) {
+    goto error;
+  }
+  Py_ssize_t total_size = 0;
+  PyObject* item;
+  while ((item = PyIter_Next(iterator)) != NULL) {
+    if (offsets != NULL) {
+      PyObject* offset = PyLong_FromSsize_t(total_size + writer.size);
+      if A_UNLIKELY(offset == NULL || PyList_Append(offsets, offset) != 0) {
+        Py_XDECREF(offset);
+        Py_DECREF(item);
+        goto error;
+      }
+      Py_DECREF(offset);
+    }
+    int const write_result = packb_write(self, item, &writer);
+    Py_DECREF(item);
+    if A_UNLIKELY(write_result != 0) {
+      goto error;
+    }
+    if (messages != NULL) {
+      PyObject* message = PyBytes_FromStringAndSize(writer.data, writer.size);
+      if A_UNLIKELY(message == NULL || PyList_Append(messages, message) != 0) {
+        Py_XDECREF(message);
+        goto error;
+      }
+      Py_DECREF(message);
+      total_size += writer.size;
+      writer.size = 0;
+    }
+  }
+  if A_UNLIKELY(PyErr_Occurred() != NULL) {
+    goto error;
+  }
+  if (messages == NULL) {
+    messages = packb_writer_to_bytes(&writer);
+    writer.buffer_py = NULL;  // consumed
+    if A_UNLIKELY(messages == NULL) {
+      goto error;
+    }
+  }
+  if (offsets != NULL) {
+    ret = PyTuple_Pack(2, messages, offsets);
+  } else {
+    Py_INCREF(messages);
+    ret = messages;
+  }
+error:
+  if (concat == 0) {
+    PyMem_Free(writer.data);
+  }
+  Py_XDECREF(writer.buffer_py);
+  Py_XDECREF(messages);
+  Py_XDECREF(offsets);
+  Py_DECREF(iterator);
+  return ret;
+}
+
+static PyObject* packer_pack_into_pack_buffer(Packer* self,
+                                              PackBuffer* pack_buffer,
+                                              PyObject* obj,
+                                              Py_ssize_t offset) {
+  if A_UNLIKELY(pack_buffer->writer.data == NULL) {
+    PyErr_SetString(PyExc_ValueError, "PackBuffer is not initialized");
+    return NULL;
+  }
+  if A_UNLIKELY(pack_buffer->packing != 0) {
+    PyErr_SetString(PyExc_BufferError, "PackBuffer is in use");
+    return NULL;
+  }
+  if (offset < 0) {
+    offset = pack_buffer->writer.size;
+  } else if A_UNLIKELY(offset > pack_buffer->writer.size) {
+    PyErr_SetString(PyExc_ValueError, "`offset` is out of range");
+    return NULL;
+  }
+  pack_buffer->writer.size = offset;
+  pack_buffer->packing = 1;
+  int const write_result = packb_write(self, obj, &pack_buffer->writer);
+  pack_buffer->packing = 0;
+  if A_UNLIKELY(write_result != 0) {
+    pack_buffer->writer.size = offset;
+    return NULL;
+  }
+  return PyLong_FromSsize_t(pack_buffer->writer.size - offset);
+}
+
+static PyObject* packer_pack_into(Packer* self, PyObject* args,
+                                  PyObject* kwargs) {
+  static char* keywords[] = {"buffer", "obj", "offset", NULL};
+  PyObject* buffer = NULL;
+  PyObject* obj = NULL;
+  PyObject* offset_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|O:pack_into", keywords,
+                                   &buffer, &obj, &offset_obj)) {
+    return NULL;
+  }
+  Py_ssize_t offset = -1;  // default
+  if (offset_obj != Py_None) {
+    offset = PyLong_AsSsize_t(offset_obj);
+    if A_UNLIKELY(offset == -1 && PyErr_Occurred() != NULL) {
+      return NULL;
+    }
+    if A_UNLIKELY(offset < 0) {
+      PyErr_SetString(PyExc_ValueError, "`offset` must be non-negative");
+      return NULL;
+    }
+  }
+  if (Py_IS_TYPE(buffer, self->state->pack_buffer_type)) {
+    return packer_pack_into_pack_buffer(self, (PackBuffer*)buffer, obj,
+                                        offset);
+  }
+  offset = Py_MAX(offset, 0);
+  Py_buffer view;
+  if A_UNLIKELY(PyObject_GetBuffer(buffer, &view, PyBUF_WRITABLE) != 0) {
+    return NULL;
+  }
+  if A_UNLIKELY(offset > view.len) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "`offset` is out of range");
+    return NULL;
+  }
+  PackbWriter writer = {.data = (char*)view.buf + offset,
+                        .size = 0,
+                        .capacity = view.len - offset,
+                        .reserve = packb_reserve_fixed,
+                        .payload = packb_payload_copy};
+  int const write_result = packb_write(self, obj, &writer);
+  PyBuffer_Release(&view);
+  if A_UNLIKELY(write_result != 0) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(writer.size);
+}
+
+static PyObject* packer_dump(Packer* self, PyObject* args, PyObject* kwargs) {
+  static char* keywords[] = {"obj", "file", "chunk_size", NULL};
+  PyObject* obj = NULL;
+  PyObject* file = NULL;
+  Py_ssize_t chunk_size = 65536;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|n:dump", keywords, &obj,
+                                   &file, &chunk_size)) {
+    return NULL;
+  }
+  if A_UNLIKELY(chunk_size < 64) {
+    PyErr_SetString(PyExc_ValueError, "`chunk_size` must be at least 64");
+    return NULL;
+  }
+  PackbFileWriter file_writer = {.writer = {.size = 0,
+                                            .capacity = chunk_size,
+                                            .reserve = packb_reserve_file,
+                                            .payload = packb_payload_file},
+                                 .write = NULL,
+                                 .fd = -1,
+                                 .written = 0};
+  if A_UNLIKELY(PyBool_Check(file)) {  // `True` would be stdout
+    PyErr_SetString(PyExc_TypeError,
+                    "`file` must be a file descriptor or have `write`");
+    return NULL;
+  }
+  if (PyLong_Check(file)) {
+    long const fd = PyLong_AsLong(file);
+    if A_UNLIKELY(fd == -1 && PyErr_Occurred() != NULL) {
+      return NULL;
+    }
+    if A_UNLIKELY(fd < 0 || fd > INT_MAX) {
+      PyErr_SetString(PyExc_ValueError, "Invalid file descriptor");
+      return NULL;
+    }
+    file_writer.fd = (int)fd;
+  } else {
+    file_writer.write = PyObject_GetAttrString(file, "write");
+    if A_UNLIKELY(file_writer.write == NULL) {
+      return NULL;
+    }
+  }
+  PyObject* ret = NULL;
+  file_writer.writer.data = (char*)PyMem_Malloc(chunk_size);
+  if A_UNLIKELY(file_writer.writer.data == NULL) {
+    PyErr_NoMemory();
+    goto error;
+  }
+  if A_UNLIKELY(packb_write(self, obj, &file_writer.writer) != 0) {
+    goto error;
+  }
+  if A_UNLIKELY(packb_file_write(&file_writer, file_writer.writer.data,
+                                 file_writer.writer.size) != 0) {
+    goto error;
+  }
+  ret = PyLong_FromSsize_t(file_writer.written);
 error:
-  Py_XDECREF(buffer_py);
-  return NULL;
+  PyMem_Free(file_writer.writer.data);
+  Py_XDECREF(file_writer.write);
+  return ret;
+}
+
+/*
+  Writer for `Packer.packb_iov`. Packed data is cut into `bytes` segments
+  around big binary payloads, that are referenced instead of copied.
+*/
+typedef struct {
+  PackbWriter writer;
+  PyObject* segments;  // `list` of `bytes` and referenced objects
+  char* scratch;       // `PACKB_SCRATCH_SIZE` bytes
+} PackbIovWriter;
+
+// appends packed data as a `bytes` segment and starts a new one
+// returns: -1 - failure
+//           0 - success
+static int packb_iov_flush(PackbIovWriter* iov_writer) {
+  PackbWriter* writer = &iov_writer->writer;
+  if (writer->size == 0) {
+    return 0;
+  }
+  PyObject* segment = packb_writer_to_bytes(writer);
+  writer->buffer_py = NULL;  // consumed or freed on failure
+  writer->data = iov_writer->scratch;
+  writer->size = 0;
+  writer->capacity = PACKB_SCRATCH_SIZE;
+  if A_UNLIKELY(segment == NULL) {
+    return -1;
+  }
+  int const append_result = PyList_Append(iov_writer->segments, segment);
+  Py_DECREF(segment);
+  return append_result;
 }
 
+static int packb_reference_iov(PackbWriter* writer, PyObject* owner) {
+  PackbIovWriter* iov_writer =
+      (PackbIovWriter*)((char*)writer - offsetof(PackbIovWriter, writer));
+  if A_UNLIKELY(packb_iov_flush(iov_writer) != 0) {
+    return -1;
+  }
+  return PyList_Append(iov_writer->segments, owner);
+}
+
+static PyObject* packer_packb_iov(Packer* self, PyObject* args,
+                                  PyObject* kwargs) {
+  static char* keywords[] = {"", "threshold", NULL};
+  PyObject* obj = NULL;
+  Py_ssize_t threshold = 4096;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$n:packb_iov", keywords,
+                                   &obj, &threshold)) {
+    return NULL;
+  }
+  if A_UNLIKELY(threshold < 0) {
+    PyErr_SetString(PyExc_ValueError, "`threshold` must be non-negative");
+    return NULL;
+  }
+  char scratch[PACKB_SCRATCH_SIZE];
+  PackbIovWriter iov_writer = {.writer = {.data = scratch,
+                                          .size = 0,
+                                          .capacity = PACKB_SCRATCH_SIZE,
+                                          .reserve = packb_reserve_bytes,
+                                          .payload = packb_payload_copy,
+                                          .buffer_py = NULL,
+                                          .reference = packb_reference_iov,
+                                          .reference_size = threshold},
+                               .segments = PyList_New(0),
+                               .scratch = scratch};
+  if A_UNLIKELY(iov_writer.segments == NULL) {
+    return NULL;
+  }
+  if A_UNLIKELY(packb_write(self, obj, &iov_writer.writer) != 0 ||
+                packb_iov_flush(&iov_writer) != 0) {
+    Py_XDECREF(iov_writer.writer.buffer_py);
+    Py_DECREF(iov_writer.segments);
+    return NULL;
+  }
+  return iov_writer.segments;
+}
+
+/*
+  Writer for `Packer.packb_with_digest`. `packb_write` sees at most
+  `DIGEST_WINDOW` bytes of free space, so the data is hashed by parts,
+  while it is still in cache.
+*/
+#define DIGEST_WINDOW 8192
+
+typedef struct {
+  PackbWriter writer;
+  Py_ssize_t buffer_capacity;  // real capacity of `writer.data`
+  Py_ssize_t hashed;           // number of hashed bytes of `writer.data`
+  XXH64State hash_state;
+} PackbDigestWriter;
+
+static void packb_digest_update(PackbDigestWriter* digest_writer) {
+  PackbWriter const* writer = &digest_writer->writer;
+  xxh64_update(&digest_writer->hash_state,
+               writer->data + digest_writer->hashed,
+               writer->size - digest_writer->hashed);
+  digest_writer->hashed = writer->size;
+}
+
+static int packb_reserve_digest(PackbWriter* writer, Py_ssize_t n) {
+  PackbDigestWriter* digest_writer =
+      (PackbDigestWriter*)((char*)writer - offsetof(PackbDigestWriter, writer));
+  packb_digest_update(digest_writer);
+  writer->capacity = digest_writer->buffer_capacity;
+  if (writer->capacity < writer->size + n) {
+    if A_UNLIKELY(packb_reserve_bytes(writer, n) != 0) {
+      return -1;
+    }
+    digest_writer->buffer_capacity = writer->capacity;
+  }
+  writer->capacity =
+      Py_MIN(writer->capacity, writer->size + Py_MAX(n, DIGEST_WINDOW));
+  return 0;
+}
+
+static PyObject* packer_packb_with_digest(Packer* self, PyObject* args,
+                                          PyObject* kwargs) {
+  static char* keywords[] = {"", "seed", NULL};
+  PyObject* obj = NULL;
+  unsigned long long seed = 0;
+  if (kwargs == NULL && PyTuple_GET_SIZE(args) == 1) {
+    obj = PyTuple_GET_ITEM(args, 0);  // skip the slow parsing for small data
+  } else if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+                                          "O|$K:packb_with_digest", keywords,
+                                          &obj, &seed)) {
+    return NULL;
+  }
+  char scratch[PACKB_SCRATCH_SIZE];
+  PackbDigestWriter digest_writer = {
+      .writer = {.data = scratch,
+                 .size = 0,
+                 .capacity = PACKB_SCRATCH_SIZE,
+                 .reserve = packb_reserve_digest,
+                 .payload = packb_payload_copy,
+                 .buffer_py = NULL},
+      .hashed = 0};
+  if A_UNLIKELY(packb_writer_use_size_hint(self->size_hint,
+                                           &digest_writer.writer) != 0) {
+    return NULL;
+  }
+  digest_writer.buffer_capacity = digest_writer.writer.capacity;
+  digest_writer.writer.capacity =
+      Py_MIN(digest_writer.buffer_capacity, DIGEST_WINDOW);
+  xxh64_init(&digest_writer.hash_state, seed);
+  PyObject* ret = PyTuple_New(2);
+  if A_UNLIKELY(ret == NULL ||
+                packb_write(self, obj, &digest_writer.writer) != 0) {
+    Py_XDECREF(ret);
+    Py_XDECREF(digest_writer.writer.buffer_py);
+    return NULL;
+  }
+  packb_digest_update(&digest_writer);
+  digest_writer.writer.capacity = digest_writer.buffer_capacity;
+  update_size_hint(&self->size_hint, digest_writer.writer.size);
+  PyObject* packed = packb_writer_to_bytes(&digest_writer.writer);
+  PyObject* digest = PyLong_FromUnsignedLongLong(
+      (unsigned long long)xxh64_digest(&digest_writer.hash_state));
+  if A_UNLIKELY(packed == NULL || digest == NULL) {
+    Py_XDECREF(packed);
+    Py_XDECREF(digest);
+    Py_DECREF(ret);
+    return NULL;
+  }
+  PyTuple_SET_ITEM(ret, 0, packed);
+  PyTuple_SET_ITEM(ret, 1, digest);
+  return ret;
+}
+
+#undef DIGEST_WINDOW
+
+static PyObject* packer_packed_size(Packer* self, PyObject* args,
+                                    PyObject* kwargs) {
+  static char* keywords[] = {"", "max_size", NULL};
+  PyObject* obj = NULL;
+  PyObject* max_size_obj = Py_None;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$O:packed_size", keywords,
+                                   &obj, &max_size_obj)) {
+    return NULL;
+  }
+  Py_ssize_t max_size = PY_SSIZE_T_MAX;
+  if (max_size_obj != Py_None) {
+    max_size = PyLong_AsSsize_t(max_size_obj);
+    if A_UNLIKELY(max_size == -1 && PyErr_Occurred() != NULL) {
+      return NULL;
+    }
+    if A_UNLIKELY(max_size < 0) {
+      PyErr_SetString(PyExc_ValueError, "`max_size` must be non-negative");
+      return NULL;
+    }
+  }
+  Py_ssize_t packed_size;
+  if A_UNLIKELY(packb_count(self, obj, max_size, &packed_size) != 0) {
+    return NULL;
+  }
+  return PyLong_FromSsize_t(packed_size);
+}
+
+#include "compiled_packer.h"
+
+#undef PACKB_SCRATCH_SIZE
+
 PyDoc_STRVAR(packer_packb_doc,
              "packb($self, obj, /)\n--\n\n"
              "Serialize ``obj`` to a MessagePack formatted ``bytes``.");
+PyDoc_STRVAR(
+    packer_packb_many_doc,
+    "packb_many($self, iterable, /, *, concat=False, offsets=False)\n--\n\n"
+    "Serialize every object of ``iterable``. Returns ``list`` of ``bytes`` "
+    "or, when ``concat`` is true, a single ``bytes`` object with the "
+    "messages back-to-back. When ``offsets`` is true, ``(result, offsets)`` "
+    "tuple is returned, where ``offsets`` are start positions of the messages "
+    "in the concatenated output.\n\n"
+    ">>> from amsgpack import Packer\n"
+    ">>> Packer().packb_many([1, 'a', None], concat=True, offsets=True)\n"
+    "(b'\\x01\\xa1a\\xc0', [0, 1, 3])\n");
+PyDoc_STRVAR(
+    packer_dump_doc,
+    "dump($self, obj, file, chunk_size=65536)\n--\n\n"
+    "Serialize ``obj`` to ``file`` and return the number of written bytes. "
+    "``file`` is an object with ``write`` method or a file descriptor. The "
+    "data is written in chunks of ``chunk_size`` bytes as soon as they are "
+    "ready, so the memory usage does not depend on the message size. Big "
+    "``bytes`` and ``str`` payloads are written without copying. On error, "
+    "the chunks that are already written stay in the file.\n\n"
+    "``write`` is called with a ``memoryview`` that is released after the "
+    "call, so the data must be copied if needed later. Each call is a "
+    "point where long exports can report progress or let other threads "
+    "run.");
+PyDoc_STRVAR(
+    packer_pack_into_doc,
+    "pack_into($self, buffer, obj, offset=None)\n--\n\n"
+    "Serialize ``obj`` into writable ``buffer`` starting at ``offset`` and "
+    "return the number of written bytes. ``ValueError`` is raised when the "
+    "``buffer`` is too small.\n\n"
+    "When ``buffer`` is :class:`PackBuffer`, it grows as needed and "
+    "``offset`` defaults to its end, so messages are appended.");
+
+PyDoc_STRVAR(
+    packer_packb_iov_doc,
+    "packb_iov($self, obj, /, *, threshold=4096)\n--\n\n"
+    "Serialize ``obj`` to a ``list`` of buffers for ``socket.sendmsg`` or "
+    "``os.writev``. ``bytes``, ``bytearray``, ``Raw`` and ``Ext`` data of "
+    "``threshold`` bytes or more are not copied, the list references the "
+    "objects themselves between ``bytes`` segments of the other packed "
+    "data. Joined buffers are equal to :meth:`packb` result.\n\n"
+    ">>> from amsgpack import Packer\n"
+    ">>> blob = bytes(5000)\n"
+    ">>> iov = Packer().packb_iov([blob, 1])\n"
+    ">>> iov[0], iov[1] is blob, iov[2]\n"
+    "(b'\\x92\\xc5\\x13\\x88', True, b'\\x01')\n");
+
+PyDoc_STRVAR(
+    packer_packb_with_digest_doc,
+    "packb_with_digest($self, obj, /, *, seed=0)\n--\n\n"
+    "Serialize ``obj`` like :meth:`packb` and return ``(bytes, digest)`` "
+    "tuple, where ``digest`` is 64-bit XXH64 hash of the bytes with "
+    "``seed``. The hash is computed by parts while packing, so the data is "
+    "not read a second time.\n\n"
+    ">>> from amsgpack import Packer\n"
+    ">>> Packer().packb_with_digest('abc')\n"
+    "(b'\\xa3abc', 4938341721263302805)\n");
+
+PyDoc_STRVAR(
+    packer_packed_size_doc,
+    "packed_size($self, obj, /, *, max_size=None)\n--\n\n"
+    "Return the length of :meth:`packb` result without producing it. "
+    "Payloads are counted, not copied, and no output is allocated. When "
+    "``max_size`` is set, ``ValueError`` is raised as soon as the size "
+    "exceeds it, without walking the rest of ``obj``.\n\n"
+    ">>> from amsgpack import Packer\n"
+    ">>> Packer().packed_size({'data': bytes(1000)})\n"
+    "1009\n");
+
+PyDoc_STRVAR(
+    packer_compile_doc,
+    "compile($self, template, /)\n--\n\n"
+    "Return :class:`CompiledPacker` for messages of the same shape. "
+    "``template`` is made of ``dict``, ``list`` and ``tuple`` objects, "
+    "where types are placeholders for :meth:`CompiledPacker.pack` values "
+    "and other objects are constants. Headers, keys and constants are "
+    "encoded once. ``int``, ``float``, ``str``, ``bytes`` and ``bool`` "
+    "values are packed inline, values of other types or not of the "
+    "placeholder type are packed by this packer as usual.\n\n"
+    ">>> from amsgpack import Packer\n"
+    ">>> template = {'id': int, 'tags': [str, str], 'v': 1}\n"
+    ">>> compiled = Packer().compile(template)\n"
+    ">>> compiled.pack(7, 'a', 'b')\n"
+    "b'\\x83\\xa2id\\x07\\xa4tags\\x92\\xa1a\\xa1b\\xa1v\\x01'\n");
 
 static PyMethodDef Packer_Methods[] = {
     {"packb", (PyCFunction)&packer_packb, METH_O, packer_packb_doc},
+    {"pack_into", (PyCFunction)(void (*)(void))packer_pack_into,
+     METH_VARARGS | METH_KEYWORDS, packer_pack_into_doc},
+    {"packb_many", (PyCFunction)(void (*)(void))packer_packb_many,
+     METH_VARARGS | METH_KEYWORDS, packer_packb_many_doc},
+    {"dump", (PyCFunction)(void (*)(void))packer_dump,
+     METH_VARARGS | METH_KEYWORDS, packer_dump_doc},
+    {"packb_iov", (PyCFunction)(void (*)(void))packer_packb_iov,
+     METH_VARARGS | METH_KEYWORDS, packer_packb_iov_doc},
+    {"packb_with_digest", (PyCFunction)(void (*)(void))packer_packb_with_digest,
+     METH_VARARGS | METH_KEYWORDS, packer_packb_with_digest_doc},
+    {"packed_size", (PyCFunction)(void (*)(void))packer_packed_size,
+     METH_VARARGS | METH_KEYWORDS, packer_packed_size_doc},
+    {"compile", (PyCFunction)packer_compile, METH_O, packer_compile_doc},
     {NULL, NULL, 0, NULL}  // Sentinel
 };
 
 PyDoc_STRVAR(Packer_doc,
-             "Packer(default=None)\n--\n\n"
+             "Packer(default=None, *, structs=None, typed_arrays=None, "
+             "presize=False, compact_floats=False)\n"
+             "--\n\n"
              "Class for holding ``default`` callback for :meth:`unpackb` to "
              "use. The ``amsgpack.packb`` function is created using::\n\n"
              "  packb = Packer().packb\n\n"
              "\n"
+             "When ``structs`` is ``'map'`` or ``'array'``, dataclasses, "
+             "NamedTuples and ``__slots__`` classes are packed without "
+             "``default`` as maps of field names to values or as arrays of "
+             "values. Field names are collected and encoded once per type.\n"
+             "\n"
+             "When ``typed_arrays`` is set, buffer exporters like "
+             "``array.array`` and ``memoryview`` are packed without copying "
+             "to ``bytes``. ``'array'`` packs items as MessagePack array of "
+             "numbers, Ext code between 0 and 127 packs Ext with ``array`` "
+             "typecode byte followed by big-endian items, that "
+             "``Unpacker(typed_arrays=code)`` unpacks back. Unsigned bytes are "
+             "packed as bin. Non-contiguous and multi-dimensional buffers and "
+             "unsupported formats are passed to ``default``.\n"
+             "\n"
+             "Subclasses of builtin types, like ``IntEnum``, ``StrEnum``, "
+             "``defaultdict`` or ``OrderedDict``, are packed as their base "
+             "type. ``set``, ``frozenset`` and ``mappingproxy`` are packed as "
+             "arrays and maps. ``default`` is called only for other types.\n"
+             "\n"
+             "When ``presize`` is true, :meth:`packb` computes the size with "
+             ":meth:`packed_size` first and allocates the result once, "
+             "instead of growing it. It pays off for big messages, as the "
+             "data is walked twice. ``default`` is called twice too.\n"
+             "\n"
+             "When ``compact_floats`` is true, ``float`` values that are "
+             "exactly representable as float32 are packed in 5 bytes instead "
+             "of 9. With ``'int'``, integral values between -2**31 and "
+             "2**32 - 1 are packed as MessagePack integers, they are unpacked "
+             "as ``int``. ``array.array`` items are packed as is.\n"
+             "\n"
              "Default callback example:\n\n"
              ">>> from typing import Any\n"
              ">>> from amsgpack import Ext, Packer\n"
@@ -544,6 +2190,8 @@ static PyType_Slot Packer_slots[] = {
     {Py_tp_new, PyType_GenericNew},
     {Py_tp_init, Packer_init},
     {Py_tp_dealloc, (destructor)Packer_dealloc},
+    {Py_tp_traverse, Packer_traverse},
+    {Py_tp_clear, Packer_clear},
     {Py_tp_methods, Packer_Methods},
     {0, NULL}};
 END_NO_PEDANTIC
@@ -551,8 +2199,13 @@ END_NO_PEDANTIC
 static PyType_Spec Packer_spec = {
     .name = "amsgpack.Packer",
     .basicsize = sizeof(Packer),
-    .flags = Py_TPFLAGS_DEFAULT,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
     .slots = Packer_slots,
 };
 
 #undef AMSGPACK_RESIZE
+#undef AMSGPACK_PAYLOAD
+#undef AMSGPACK_OWNED_PAYLOAD
+#undef COMPACT_FLOATS_DISABLED
+#undef COMPACT_FLOATS_FLOAT32
+#undef COMPACT_FLOATS_INT
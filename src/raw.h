@@ -1,27 +1,39 @@
 #include <Python.h>
 #include <structmember.h>
 
+#include "data_view.h"
+
 typedef struct {
   PyObject_HEAD
-  PyObject *data;  // store PyBytes only
+  PyObject *data;  // bytes-like object
+  Py_buffer view;  // memory of `data`
 } Raw;
 
 static PyMemberDef Raw_members[] = {
-    {"data", T_OBJECT_EX, offsetof(Raw, data), READONLY, "Raw data (bytes)"},
+    {"data", T_OBJECT_EX, offsetof(Raw, data), READONLY,
+     "Raw data (bytes-like object)"},
     {NULL, 0, 0, 0, NULL}  // Sentinel
 };
 
 static int Raw_init(Raw *self, PyObject *args, PyObject *kwargs) {
   static char *kwlist[] = {"data", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!:Raw", kwlist,
-                                   &PyBytes_Type, &self->data)) {
+  PyObject *data = NULL;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O:Raw", kwlist, &data)) {
+    return -1;
+  }
+  Py_buffer view;
+  if A_UNLIKELY(data_view_init(&view, data, "Raw() argument 1") != 0) {
     return -1;
   }
-  Py_INCREF(self->data);
+  data_view_release(&self->view);
+  Py_INCREF(data);
+  Py_XSETREF(self->data, data);
+  self->view = view;
   return 0;
 }
 
 static void Raw_dealloc(Raw *self) {
+  data_view_release(&self->view);
   Py_XDECREF(self->data);
   Py_TYPE(self)->tp_free((PyObject *)self);
 }
@@ -41,7 +53,8 @@ PyDoc_STRVAR(
     "Raw(data)\n"
     "--\n\n"
     "Raw type for :func:`packb`. When packer sees :class:`Raw` type, it "
-    "inserts its :attr:`data` as is.\n"
+    "inserts its :attr:`data` as is. :attr:`data` is ``bytes`` or any "
+    "other bytes-like object, that is written without a copy.\n"
     "\n"
     ">>> from amsgpack import Raw, packb\n"
     ">>> packb(Raw(b'Hello'))\n"
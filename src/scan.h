@@ -0,0 +1,157 @@
+#include <Python.h>
+
+#include "skip.h"
+
+/*
+  `scan` and `validate` check messages of a buffer without making objects.
+  They only read bytes, so the GIL is released for large buffers and other
+  threads keep unpacking.
+*/
+
+#define SCAN_NOGIL_SIZE 65536  // smaller buffers keep the GIL
+
+typedef struct {
+  Py_ssize_t count;  // number of complete messages
+  Py_ssize_t* ends;  // their ends, when requested, raw memory
+  Py_ssize_t capacity;
+  Py_ssize_t end;  // end of the last complete message
+} ScanResult;
+
+// walks messages of `data`, stops at the first incomplete one
+// returns: 0, SKIP_INVALID, SKIP_DEEP or SKIP_INCOMPLETE of `PyMem_Raw*`
+//          failure, the GIL is not needed
+static int scan_messages(uint8_t const* data, Py_ssize_t size, int max_depth,
+                         int keep_ends, ScanResult* result) {
+  Py_ssize_t pos = 0;
+  while (pos < size) {
+    Py_ssize_t const end = msgpack_check(data, pos, size, max_depth);
+    if (end == SKIP_INCOMPLETE) {
+      break;
+    }
+    if A_UNLIKELY(end < 0) {
+      return (int)end;
+    }
+    if (keep_ends) {
+      if (result->count == result->capacity) {
+        Py_ssize_t const capacity = result->capacity * 2 + 64;
+        Py_ssize_t* ends = (Py_ssize_t*)PyMem_RawRealloc(
+            result->ends, (size_t)capacity * sizeof(Py_ssize_t));
+        if A_UNLIKELY(ends == NULL) {
+          return SKIP_INCOMPLETE;
+        }
+        result->ends = ends;
+        result->capacity = capacity;
+      }
+      result->ends[result->count] = end;
+    }
+    result->count++;
+    pos = end;
+  }
+  result->end = pos;
+  return 0;
+}
+
+// returns: 0 - success
+//         -1 - failure (exception is set)
+static int scan_buffer(PyObject* args, PyObject* kwargs, char const* format,
+                       int keep_ends, ScanResult* result,
+                       Py_ssize_t* buffer_size) {
+  static char* keywords[] = {"", "max_depth", NULL};
+  Py_buffer buffer;
+  int max_depth = A_STACK_SIZE;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, format, keywords, &buffer,
+                                   &max_depth)) {
+    return -1;
+  }
+  if A_UNLIKELY(max_depth < 0 || max_depth > A_STACK_SIZE) {
+    PyBuffer_Release(&buffer);
+    PyErr_Format(PyExc_ValueError, "`max_depth` must be from 0 to %d",
+                 A_STACK_SIZE);
+    return -1;
+  }
+  *result = (ScanResult){0, NULL, 0, 0};
+  int status;
+  if (buffer.len >= SCAN_NOGIL_SIZE) {
+    Py_BEGIN_ALLOW_THREADS
+    status = scan_messages((uint8_t const*)buffer.buf, buffer.len, max_depth,
+                           keep_ends, result);
+    Py_END_ALLOW_THREADS
+  } else {
+    status = scan_messages((uint8_t const*)buffer.buf, buffer.len, max_depth,
+                           keep_ends, result);
+  }
+  *buffer_size = buffer.len;
+  PyBuffer_Release(&buffer);
+  if A_LIKELY(status == 0) {
+    return 0;
+  }
+  PyMem_RawFree(result->ends);
+  switch (status) {
+    case SKIP_INVALID:
+      PyErr_SetString(PyExc_ValueError,
+                      "amsgpack: 0xc1 byte must not be used");
+      break;
+    case SKIP_DEEP:
+      PyErr_SetString(PyExc_ValueError, "Deeply nested object");
+      break;
+    default:
+      PyErr_NoMemory();
+      break;
+  }
+  return -1;
+}
+
+static PyObject* amsgpack_scan(PyObject* Py_UNUSED(module), PyObject* args,
+                               PyObject* kwargs) {
+  ScanResult result;
+  Py_ssize_t size;
+  if (scan_buffer(args, kwargs, "y*|$i:scan", 1, &result, &size) != 0) {
+    return NULL;
+  }
+  PyObject* ends = PyList_New(result.count);
+  for (Py_ssize_t i = 0; ends != NULL && i < result.count; ++i) {
+    PyObject* end = PyLong_FromSsize_t(result.ends[i]);
+    if A_UNLIKELY(end == NULL) {
+      Py_CLEAR(ends);
+      break;
+    }
+    PyList_SET_ITEM(ends, i, end);
+  }
+  PyMem_RawFree(result.ends);
+  return ends;
+}
+
+static PyObject* amsgpack_validate(PyObject* Py_UNUSED(module),
+                                   PyObject* args, PyObject* kwargs) {
+  ScanResult result;
+  Py_ssize_t size;
+  if (scan_buffer(args, kwargs, "y*|$i:validate", 0, &result, &size) != 0) {
+    return NULL;
+  }
+  if A_UNLIKELY(result.end != size) {
+    PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
+    return NULL;
+  }
+  return PyLong_FromSsize_t(result.count);
+}
+
+PyDoc_STRVAR(amsgpack_scan_doc,
+             "scan(data, /, *, max_depth=32)\n--\n\n"
+             "Return ``list`` of end offsets of the complete messages of "
+             "``data``, a bytes-like object. An incomplete message at the "
+             "end is not included. Raises ``ValueError`` for invalid data "
+             "and maps and arrays nested deeper than *max_depth*. No "
+             "objects are made and the GIL is released for large data.");
+
+PyDoc_STRVAR(amsgpack_validate_doc,
+             "validate(data, /, *, max_depth=32)\n--\n\n"
+             "Check that ``data`` is a sequence of complete, well-formed "
+             "MessagePack messages nested at most ``max_depth`` times, and "
+             "return their number. Raises ``ValueError`` like :func:`scan`, "
+             "and for an incomplete message at the end.\n\n"
+             "Only the framing is checked: strings are not decoded, so their "
+             "UTF-8 is not checked, and Ext payloads, like timestamps and "
+             "typed arrays, are not parsed. :class:`Unpacker` may still "
+             "reject a valid message.");
+
+#undef SCAN_NOGIL_SIZE
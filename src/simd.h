@@ -0,0 +1,352 @@
+#ifndef A_INCLUDE_SIMD_H
+#define A_INCLUDE_SIMD_H
+#include <Python.h>
+#include <float.h>  // FLT_MAX
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define A_SSE2_ONLY
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define A_HAS_SSE2
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define A_POPCOUNT(value) __popcnt(value)
+static inline int a_ctz(unsigned int value) {
+  unsigned long idx;
+  _BitScanForward(&idx, value);
+  return (int)idx;
+}
+#define A_CTZ(value) a_ctz(value)
+#else
+#define A_POPCOUNT(value) __builtin_popcount(value)
+#define A_CTZ(value) __builtin_ctz(value)
+#endif
+
+/*
+  Byte order conversion of typed arrays. MessagePack is big-endian, so
+  every item of a native array is reversed. `dst` may be equal to `src`.
+*/
+
+static inline void bswap_item(char* dst, char const* src, int itemsize) {
+  char tmp[8];
+  for (int idx = 0; idx < itemsize; ++idx) {
+    tmp[idx] = src[itemsize - 1 - idx];
+  }
+  memcpy(dst, tmp, itemsize);
+}
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+// `_mm_shuffle_epi8` masks reversing 2, 4 and 8 byte items
+static inline __m128i bswap_mask128(int itemsize) {
+  switch (itemsize) {
+    case 2:
+      return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15,
+                           14);
+    case 4:
+      return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13,
+                           12);
+    default:
+      return _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9,
+                           8);
+  }
+}
+#endif
+
+#ifdef A_SSE2_ONLY
+// SSE2 has no byte shuffle, so words are reordered first,
+// then bytes of every word are swapped with shifts
+static inline __m128i bswap_sse2(__m128i value, int itemsize) {
+  if (itemsize == 4) {
+    value = _mm_shufflehi_epi16(_mm_shufflelo_epi16(value, 0xb1), 0xb1);
+  } else if (itemsize == 8) {
+    value = _mm_shufflehi_epi16(_mm_shufflelo_epi16(value, 0x1b), 0x1b);
+  }
+  return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+}
+#endif
+
+// reverses bytes of `count` items of `itemsize` (2, 4 or 8) bytes
+static void bswap_copy(char* dst, char const* src, Py_ssize_t count,
+                       int itemsize) {
+  Py_ssize_t const size = count * itemsize;
+  Py_ssize_t pos = 0;
+#if defined(__AVX2__)
+  __m128i const mask128 = bswap_mask128(itemsize);
+  __m256i const mask256 = _mm256_broadcastsi128_si256(mask128);
+  for (; pos + 32 <= size; pos += 32) {
+    __m256i const value = _mm256_loadu_si256((__m256i const*)(src + pos));
+    _mm256_storeu_si256((__m256i*)(dst + pos),
+                        _mm256_shuffle_epi8(value, mask256));
+  }
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    _mm_storeu_si128((__m128i*)(dst + pos), _mm_shuffle_epi8(value, mask128));
+  }
+#elif defined(__SSSE3__)
+  __m128i const mask128 = bswap_mask128(itemsize);
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    _mm_storeu_si128((__m128i*)(dst + pos), _mm_shuffle_epi8(value, mask128));
+  }
+#elif defined(A_SSE2_ONLY)
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    _mm_storeu_si128((__m128i*)(dst + pos), bswap_sse2(value, itemsize));
+  }
+#endif
+  for (; pos < size; pos += itemsize) {
+    bswap_item(dst + pos, src + pos, itemsize);
+  }
+}
+
+/*
+  ASCII detection for UTF-8 transcoding
+*/
+
+// returns the number of bytes with the high bit set
+static Py_ssize_t count_non_ascii(uint8_t const* src, Py_ssize_t n) {
+  Py_ssize_t count = 0;
+  Py_ssize_t pos = 0;
+#if defined(__AVX2__)
+  for (; pos + 32 <= n; pos += 32) {
+    __m256i const value = _mm256_loadu_si256((__m256i const*)(src + pos));
+    count += A_POPCOUNT((unsigned int)_mm256_movemask_epi8(value));
+  }
+#endif
+#ifdef A_HAS_SSE2
+  for (; pos + 16 <= n; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    count += A_POPCOUNT((unsigned int)_mm_movemask_epi8(value));
+  }
+#endif
+  for (; pos < n; ++pos) {
+    count += src[pos] >> 7;
+  }
+  return count;
+}
+
+// returns the length of ASCII prefix of `src`, blocks are checked at once
+static inline Py_ssize_t ascii_prefix_length(uint8_t const* src,
+                                             Py_ssize_t n) {
+  Py_ssize_t pos = 0;
+#if defined(__AVX2__)
+  for (; pos + 32 <= n; pos += 32) {
+    __m256i const value = _mm256_loadu_si256((__m256i const*)(src + pos));
+    if (_mm256_movemask_epi8(value) != 0) {
+      break;
+    }
+  }
+#endif
+#ifdef A_HAS_SSE2
+  for (; pos + 16 <= n; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    if (_mm_movemask_epi8(value) != 0) {
+      break;
+    }
+  }
+#else
+  for (; pos + 8 <= n; pos += 8) {
+    uint64_t value;
+    memcpy(&value, src + pos, 8);
+    if ((value & 0x8080808080808080ULL) != 0) {
+      break;
+    }
+  }
+#endif
+  while (pos < n && src[pos] < 0x80) {
+    pos += 1;
+  }
+  return pos;
+}
+
+// returns the number of UTF-8 continuation bytes (0x80 - 0xbf) of `src`,
+// `*max_byte` is the largest byte, it tells the widest character
+static Py_ssize_t count_utf8_continuations(uint8_t const* src, Py_ssize_t n,
+                                           uint8_t* max_byte) {
+  Py_ssize_t count = 0;
+  Py_ssize_t pos = 0;
+  uint8_t max = 0;
+#if defined(__AVX2__)
+  // continuation bytes are the signed ones below -64
+  __m256i const below256 = _mm256_set1_epi8(-64);
+  __m256i max256 = _mm256_setzero_si256();
+  for (; pos + 32 <= n; pos += 32) {
+    __m256i const value = _mm256_loadu_si256((__m256i const*)(src + pos));
+    max256 = _mm256_max_epu8(max256, value);
+    count += A_POPCOUNT(
+        (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(below256, value)));
+  }
+  uint8_t lanes256[32];
+  _mm256_storeu_si256((__m256i*)lanes256, max256);
+  for (int idx = 0; idx < 32; ++idx) {
+    max = Py_MAX(max, lanes256[idx]);
+  }
+#endif
+#ifdef A_HAS_SSE2
+  __m128i const below = _mm_set1_epi8(-64);
+  __m128i max128 = _mm_setzero_si128();
+  for (; pos + 16 <= n; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    max128 = _mm_max_epu8(max128, value);
+    count += A_POPCOUNT(
+        (unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(below, value)));
+  }
+  uint8_t lanes[16];
+  _mm_storeu_si128((__m128i*)lanes, max128);
+  for (int idx = 0; idx < 16; ++idx) {
+    max = Py_MAX(max, lanes[idx]);
+  }
+#endif
+  for (; pos < n; ++pos) {
+    count += (src[pos] & 0xc0) == 0x80;
+    max = Py_MAX(max, src[pos]);
+  }
+  *max_byte = max;
+  return count;
+}
+
+/*
+  MessagePack scanning
+*/
+
+static inline int is_one_byte_object(uint8_t byte) {
+  return byte <= 0x7f || byte >= 0xe0 || byte == 0xc0 || byte == 0xc2 ||
+         byte == 0xc3;
+}
+
+// returns the length of the prefix of `src` made of one byte objects,
+// fixint, nil and bool, that are most items of numeric arrays
+static inline Py_ssize_t one_byte_objects_length(uint8_t const* src,
+                                                 Py_ssize_t n) {
+  Py_ssize_t pos = 0;
+#if defined(__AVX2__)
+  // fixint is signed -32 .. 127, nil, false and true are -64, -62 and -61
+  __m256i const fixint256 = _mm256_set1_epi8(-33);
+  __m256i const nil256 = _mm256_set1_epi8(-64);
+  __m256i const false256 = _mm256_set1_epi8(-62);
+  __m256i const true256 = _mm256_set1_epi8(-61);
+  for (; pos + 32 <= n; pos += 32) {
+    __m256i const value = _mm256_loadu_si256((__m256i const*)(src + pos));
+    __m256i const found = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpgt_epi8(value, fixint256),
+                        _mm256_cmpeq_epi8(value, nil256)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(value, false256),
+                        _mm256_cmpeq_epi8(value, true256)));
+    unsigned int const mask = (unsigned int)_mm256_movemask_epi8(found);
+    if (mask != 0xffffffffU) {
+      return pos + A_CTZ(~mask);
+    }
+  }
+#endif
+#ifdef A_HAS_SSE2
+  __m128i const fixint = _mm_set1_epi8(-33);
+  __m128i const nil = _mm_set1_epi8(-64);
+  __m128i const false_ = _mm_set1_epi8(-62);
+  __m128i const true_ = _mm_set1_epi8(-61);
+  for (; pos + 16 <= n; pos += 16) {
+    __m128i const value = _mm_loadu_si128((__m128i const*)(src + pos));
+    __m128i const found =
+        _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi8(value, fixint),
+                                  _mm_cmpeq_epi8(value, nil)),
+                     _mm_or_si128(_mm_cmpeq_epi8(value, false_),
+                                  _mm_cmpeq_epi8(value, true_)));
+    unsigned int const mask = (unsigned int)_mm_movemask_epi8(found);
+    if (mask != 0xffffU) {
+      return pos + A_CTZ(~mask & 0xffffU);
+    }
+  }
+#endif
+  while (pos < n && is_one_byte_object(src[pos])) {
+    pos += 1;
+  }
+  return pos;
+}
+
+/*
+  Lossless float checks for `Packer(compact_floats=...)`. Values are
+  clamped first, so conversions are defined, infinities and NaNs fail both
+  checks. SSE2 versions give the same answers as the scalar ones.
+*/
+
+#define SMALL_INTEGRAL_MIN -2147483648.0
+#define SMALL_INTEGRAL_MAX 4294967295.0
+
+// `value` is the same after the round trip through float32
+static inline int is_float32_exact(double value) {
+  double const clamped =
+      Py_MIN(Py_MAX(value, -(double)FLT_MAX), (double)FLT_MAX);
+  return (double)(float)clamped == value;
+}
+
+// `value` is integral and packs as integer in 5 bytes or less,
+// -0.0 is not, as its sign would be lost
+static inline int is_small_integral(double value) {
+  double const clamped =
+      Py_MIN(Py_MAX(value, SMALL_INTEGRAL_MIN), SMALL_INTEGRAL_MAX);
+  return (double)(long long)clamped == value &&
+         (value != 0.0 || !signbit(value));
+}
+
+// returns the number of `is_float32_exact` values
+static Py_ssize_t count_float32_exact(double const* src, Py_ssize_t n) {
+  Py_ssize_t count = 0;
+  Py_ssize_t pos = 0;
+#ifdef A_HAS_SSE2
+  __m128d const low = _mm_set1_pd(-(double)FLT_MAX);
+  __m128d const high = _mm_set1_pd((double)FLT_MAX);
+  for (; pos + 2 <= n; pos += 2) {
+    __m128d const value = _mm_loadu_pd(src + pos);
+    // `_mm_max_pd` returns its second argument for NaN, like `Py_MAX`
+    __m128d const clamped = _mm_min_pd(_mm_max_pd(value, low), high);
+    __m128d const round_trip = _mm_cvtps_pd(_mm_cvtpd_ps(clamped));
+    count += A_POPCOUNT(
+        (unsigned int)_mm_movemask_pd(_mm_cmpeq_pd(round_trip, value)));
+  }
+#endif
+  for (; pos < n; ++pos) {
+    count += is_float32_exact(src[pos]);
+  }
+  return count;
+}
+
+// returns 1 when any value `is_small_integral`, 0 otherwise
+static int has_small_integral(double const* src, Py_ssize_t n) {
+  Py_ssize_t pos = 0;
+#ifdef A_HAS_SSE2
+  __m128d const low = _mm_set1_pd(SMALL_INTEGRAL_MIN);
+  __m128d const high = _mm_set1_pd(SMALL_INTEGRAL_MAX);
+  // adding and subtracting 2**52 rounds the clamped value to an integer
+  __m128d const round = _mm_set1_pd(4503599627370496.0);
+  __m128d const zero = _mm_setzero_pd();
+  int found = 0;
+  for (; pos + 2 <= n; pos += 2) {
+    __m128d const value = _mm_loadu_pd(src + pos);
+    __m128d const clamped = _mm_min_pd(_mm_max_pd(value, low), high);
+    __m128d const rounded = _mm_sub_pd(_mm_add_pd(clamped, round), round);
+    int const integral = _mm_movemask_pd(_mm_cmpeq_pd(rounded, value));
+    int const negative_zero =
+        _mm_movemask_pd(_mm_cmpeq_pd(value, zero)) & _mm_movemask_pd(value);
+    found |= integral & ~negative_zero;
+  }
+  if (found != 0) {
+    return 1;
+  }
+#endif
+  for (; pos < n; ++pos) {
+    if (is_small_integral(src[pos])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#undef SMALL_INTEGRAL_MIN
+#undef SMALL_INTEGRAL_MAX
+
+#endif  // A_INCLUDE_SIMD_H
@@ -0,0 +1,204 @@
+#pragma once
+#include <Python.h>
+
+#include "macros.h"
+#include "simd.h"
+
+/*
+  Walking MessagePack data without making objects. One object is skipped
+  with a counter of items left, so nesting needs no stack and no limit.
+*/
+
+#define SKIP_INCOMPLETE -1
+#define SKIP_INVALID -2  // 0xc1
+#define SKIP_DEEP -3     // deeper than `max_depth`
+
+#define SKIP_HEADER_MAX 5  // the longest header with the length, 0xdb
+
+static inline Py_ssize_t skip_load_size(uint8_t const* src, int size_size) {
+  switch (size_size) {
+    case 1:
+      return src[0];
+    case 2:
+      return (Py_ssize_t)src[0] << 8 | src[1];
+    default:
+      return (Py_ssize_t)((uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 |
+                          (uint32_t)src[2] << 8 | src[3]);
+  }
+}
+
+static inline int skip_is_container(uint8_t head) {
+  return (head >= 0x80 && head <= 0x9f) || (head >= 0xdc && head <= 0xdf);
+}
+
+// classifies the object at `src` with `avail` (> 0) bytes
+// returns: size of the header, `*payload` is the number of bytes after it,
+//          `*items` is the number of objects in it, keys and values of maps
+//          SKIP_INCOMPLETE when the header is longer than `avail`
+//          SKIP_INVALID
+static inline int skip_header(uint8_t const* src, Py_ssize_t avail,
+                              Py_ssize_t* payload, Py_ssize_t* items) {
+  uint8_t const head = src[0];
+  *payload = 0;
+  *items = 0;
+  if (head <= 0x7f || head >= 0xe0 || head == 0xc0 || head == 0xc2 ||
+      head == 0xc3) {
+    return 1;  // fixint, nil and bool
+  }
+  if (head <= 0x8f) {
+    *items = 2 * (Py_ssize_t)(head & 0x0f);  // fixmap
+    return 1;
+  }
+  if (head <= 0x9f) {
+    *items = head & 0x0f;  // fixarray
+    return 1;
+  }
+  if (head <= 0xbf) {
+    *payload = head & 0x1f;  // fixstr
+    return 1;
+  }
+  int size_size = 0;  // bytes of the length after `head`
+  int extra = 0;      // bytes between the length and the payload
+  int per_item = 0;   // 1 for arrays, 2 for maps
+  switch (head) {
+    case 0xc1:
+      return SKIP_INVALID;
+    case 0xc4:  // bin 8, 16, 32
+    case 0xc5:
+    case 0xc6:
+      size_size = 1 << (head - 0xc4);
+      break;
+    case 0xc7:  // ext 8, 16, 32
+    case 0xc8:
+    case 0xc9:
+      size_size = 1 << (head - 0xc7);
+      extra = 1;
+      break;
+    case 0xca:  // float 32
+    case 0xce:  // uint 32
+    case 0xd2:  // int 32
+      *payload = 4;
+      return 1;
+    case 0xcb:  // float 64
+    case 0xcf:  // uint 64
+    case 0xd3:  // int 64
+      *payload = 8;
+      return 1;
+    case 0xcc:  // uint 8
+    case 0xd0:  // int 8
+      *payload = 1;
+      return 1;
+    case 0xcd:  // uint 16
+    case 0xd1:  // int 16
+      *payload = 2;
+      return 1;
+    case 0xd4:  // fixext 1, 2, 4, 8, 16
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+      *payload = 1 + (1 << (head - 0xd4));
+      return 1;
+    case 0xd9:  // str 8, 16, 32
+    case 0xda:
+    case 0xdb:
+      size_size = 1 << (head - 0xd9);
+      break;
+    case 0xdc:  // array 16, 32
+    case 0xdd:
+      size_size = 2 << (head - 0xdc);
+      per_item = 1;
+      break;
+    default:  // map 16, 32
+      size_size = 2 << (head - 0xde);
+      per_item = 2;
+      break;
+  }
+  if A_UNLIKELY(avail < 1 + size_size) {
+    return SKIP_INCOMPLETE;
+  }
+  Py_ssize_t const size = skip_load_size(src + 1, size_size);
+  if (per_item != 0) {
+    *items = per_item * size;
+  } else {
+    *payload = extra + size;
+  }
+  return 1 + size_size;
+}
+
+// returns: position after the object at `pos` of `data` of `end` bytes,
+//          SKIP_INCOMPLETE or SKIP_INVALID
+static Py_ssize_t msgpack_skip(uint8_t const* data, Py_ssize_t pos,
+                               Py_ssize_t end) {
+  Py_ssize_t left = 1;  // objects left to skip
+  while (left != 0) {
+    if A_UNLIKELY(pos >= end) {
+      return SKIP_INCOMPLETE;
+    }
+    Py_ssize_t payload, items;
+    int const header = skip_header(data + pos, end - pos, &payload, &items);
+    if A_UNLIKELY(header < 0) {
+      return header;
+    }
+    if A_UNLIKELY(end - pos - header < payload) {
+      return SKIP_INCOMPLETE;
+    }
+    pos += header + payload;
+    left += items - 1;
+  }
+  return pos;
+}
+
+// like `msgpack_skip`, but maps and arrays may only be nested `max_depth`
+// (<= A_STACK_SIZE) times, like `Unpacker` allows, and runs of one byte
+// objects in arrays are skipped with SIMD
+// returns: position after the object, SKIP_INCOMPLETE, SKIP_INVALID or
+//          SKIP_DEEP
+static Py_ssize_t msgpack_check(uint8_t const* data, Py_ssize_t pos,
+                                Py_ssize_t end, int max_depth) {
+  Py_ssize_t stack[A_STACK_SIZE];  // objects left in open maps and arrays
+  int depth = 0;
+  for (;;) {
+    if A_UNLIKELY(pos >= end) {
+      return SKIP_INCOMPLETE;
+    }
+    if (depth != 0 && stack[depth - 1] > 1) {
+      // `[1, 2, 3, None, True]`, all but the last object of the container
+      Py_ssize_t const run = one_byte_objects_length(
+          data + pos, Py_MIN(stack[depth - 1] - 1, end - pos));
+      pos += run;
+      stack[depth - 1] -= run;
+      if A_UNLIKELY(pos >= end) {
+        return SKIP_INCOMPLETE;
+      }
+    }
+    uint8_t const head = data[pos];
+    Py_ssize_t payload, items;
+    int const header = skip_header(data + pos, end - pos, &payload, &items);
+    if A_UNLIKELY(header < 0) {
+      return header;
+    }
+    if (skip_is_container(head)) {
+      if A_UNLIKELY(depth >= max_depth) {
+        return SKIP_DEEP;
+      }
+      pos += header;
+      if (items != 0) {
+        stack[depth++] = items;
+        continue;
+      }
+    } else {
+      if A_UNLIKELY(end - pos - header < payload) {
+        return SKIP_INCOMPLETE;
+      }
+      pos += header + payload;
+    }
+    // one object is done, so are the containers it completes
+    while (depth != 0 && --stack[depth - 1] == 0) {
+      depth--;
+    }
+    if (depth == 0) {
+      return pos;
+    }
+  }
+}
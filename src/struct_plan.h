@@ -0,0 +1,254 @@
+#include <Python.h>
+
+/*
+  Packing plan of a dataclass, a NamedTuple or a `__slots__` class instances.
+  Plans are created once per type and stored in `Packer`.
+*/
+typedef struct {
+  Py_ssize_t length;  // number of fields
+  int is_tuple;       // values are tuple items (NamedTuple)
+  PyObject* names;    // tuple of attribute names
+  char* keys;         // msgpack encoded names back-to-back, NULL for arrays
+  Py_ssize_t key_offsets[];  // `length + 1` offsets in `keys`
+} StructPlan;
+
+static void struct_plan_free(PyObject* capsule) {
+  StructPlan* plan = (StructPlan*)PyCapsule_GetPointer(capsule, NULL);
+  Py_XDECREF(plan->names);
+  PyMem_Free(plan);
+}
+
+// appends `__slots__` names of `cls` to `names` list
+// returns: -1 - failure
+//           0 - success
+static int struct_add_slots(PyObject* names, PyTypeObject* cls,
+                            PyObject* slots) {
+  if (PyUnicode_Check(slots)) {
+    slots = PyTuple_Pack(1, slots);
+  } else {
+    slots = PySequence_Tuple(slots);
+  }
+  if A_UNLIKELY(slots == NULL) {
+    return -1;
+  }
+  for (Py_ssize_t idx = 0; idx < PyTuple_GET_SIZE(slots); ++idx) {
+    PyObject* name = PyTuple_GET_ITEM(slots, idx);
+    if A_UNLIKELY(!PyUnicode_Check(name)) {
+      PyErr_Format(PyExc_TypeError, "__slots__ items must be str, not '%s'",
+                   Py_TYPE(name)->tp_name);
+      Py_DECREF(slots);
+      return -1;
+    }
+    if (PyUnicode_CompareWithASCIIString(name, "__dict__") == 0 ||
+        PyUnicode_CompareWithASCIIString(name, "__weakref__") == 0) {
+      continue;
+    }
+    int result;
+    Py_ssize_t const length = PyUnicode_GET_LENGTH(name);
+    if (length > 2 && PyUnicode_READ_CHAR(name, 0) == '_' &&
+        PyUnicode_READ_CHAR(name, 1) == '_' &&
+        (PyUnicode_READ_CHAR(name, length - 1) != '_' ||
+         PyUnicode_READ_CHAR(name, length - 2) != '_')) {
+      // private name, mangle it the same way the compiler does
+      char const* class_name = cls->tp_name;
+      char const* dot = strrchr(class_name, '.');
+      if (dot != NULL) {
+        class_name = dot + 1;
+      }
+      while (*class_name == '_') {
+        class_name += 1;
+      }
+      PyObject* mangled = PyUnicode_FromFormat("_%s%U", class_name, name);
+      if A_UNLIKELY(mangled == NULL) {
+        Py_DECREF(slots);
+        return -1;
+      }
+      result = PyList_Append(names, mangled);
+      Py_DECREF(mangled);
+    } else {
+      result = PyList_Append(names, name);
+    }
+    if A_UNLIKELY(result != 0) {
+      Py_DECREF(slots);
+      return -1;
+    }
+  }
+  Py_DECREF(slots);
+  return 0;
+}
+
+// returns new reference to a tuple of field names,
+// `Py_None` when `type` is not a struct or NULL on failure
+static PyObject* struct_field_names(PyTypeObject* type, int* is_tuple) {
+  *is_tuple = 0;
+  if (PyType_IsSubtype(type, &PyTuple_Type)) {
+    PyObject* fields = PyObject_GetAttrString((PyObject*)type, "_fields");
+    if (fields == NULL) {
+      PyErr_Clear();
+      Py_RETURN_NONE;
+    }
+    if A_UNLIKELY(!PyTuple_CheckExact(fields)) {
+      Py_DECREF(fields);
+      Py_RETURN_NONE;
+    }
+    *is_tuple = 1;
+    return fields;
+  }
+  if (PyObject_HasAttrString((PyObject*)type, "__dataclass_fields__")) {
+    PyObject* dataclasses = PyImport_ImportModule("dataclasses");
+    if A_UNLIKELY(dataclasses == NULL) {
+      return NULL;
+    }
+    PyObject* fields =
+        PyObject_CallMethod(dataclasses, "fields", "O", (PyObject*)type);
+    Py_DECREF(dataclasses);
+    if A_UNLIKELY(fields == NULL) {
+      return NULL;
+    }
+    Py_ssize_t const length = PyTuple_GET_SIZE(fields);
+    PyObject* names = PyTuple_New(length);
+    if A_UNLIKELY(names == NULL) {
+      Py_DECREF(fields);
+      return NULL;
+    }
+    for (Py_ssize_t idx = 0; idx < length; ++idx) {
+      PyObject* name =
+          PyObject_GetAttrString(PyTuple_GET_ITEM(fields, idx), "name");
+      if A_UNLIKELY(name == NULL) {
+        Py_DECREF(fields);
+        Py_DECREF(names);
+        return NULL;
+      }
+      PyTuple_SET_ITEM(names, idx, name);
+    }
+    Py_DECREF(fields);
+    return names;
+  }
+  // a `__slots__` class must not have `__dict__`, so every class in MRO,
+  // except `object`, defines `__slots__`
+  PyObject* mro = type->tp_mro;
+  Py_ssize_t const mro_length = PyTuple_GET_SIZE(mro);
+  PyObject* names = PyList_New(0);
+  if A_UNLIKELY(names == NULL) {
+    return NULL;
+  }
+  for (Py_ssize_t idx = mro_length - 1; idx >= 0; --idx) {
+    PyTypeObject* cls = (PyTypeObject*)PyTuple_GET_ITEM(mro, idx);
+    if (cls == &PyBaseObject_Type) {
+      continue;
+    }
+    PyObject* slots = (cls->tp_flags & Py_TPFLAGS_HEAPTYPE) != 0
+                          ? PyDict_GetItemString(cls->tp_dict, "__slots__")
+                          : NULL;
+    if (slots == NULL) {
+      Py_DECREF(names);
+      Py_RETURN_NONE;
+    }
+    if A_UNLIKELY(struct_add_slots(names, cls, slots) != 0) {
+      Py_DECREF(names);
+      return NULL;
+    }
+  }
+  if (mro_length < 2) {
+    Py_DECREF(names);
+    Py_RETURN_NONE;
+  }
+  PyObject* ret = PyList_AsTuple(names);
+  Py_DECREF(names);
+  return ret;
+}
+
+// returns new plan capsule, `Py_None` when `type` is not a struct
+// or NULL on failure
+static PyObject* struct_plan_new(PyTypeObject* type, int as_array) {
+  int is_tuple;
+  PyObject* names = struct_field_names(type, &is_tuple);
+  if (names == NULL || names == Py_None) {
+    return names;
+  }
+  Py_ssize_t const length = PyTuple_GET_SIZE(names);
+  Py_ssize_t keys_size = 0;
+  for (Py_ssize_t idx = 0; idx < length; ++idx) {
+    Py_ssize_t u8size;
+    PyObject* name = PyTuple_GET_ITEM(names, idx);
+    if A_UNLIKELY(!PyUnicode_Check(name)) {
+      PyErr_Format(PyExc_TypeError, "field name must be str, not '%s'",
+                   Py_TYPE(name)->tp_name);
+      Py_DECREF(names);
+      return NULL;
+    }
+    if A_UNLIKELY(PyUnicode_AsUTF8AndSize(name, &u8size) == NULL) {
+      Py_DECREF(names);
+      return NULL;
+    }
+    keys_size += u8size + (u8size <= 0xf ? 1 : u8size <= 0xff ? 2 : 3);
+  }
+  StructPlan* plan = (StructPlan*)PyMem_Malloc(
+      sizeof(StructPlan) + sizeof(Py_ssize_t) * (length + 1) +
+      (as_array ? 0 : keys_size));
+  if A_UNLIKELY(plan == NULL) {
+    Py_DECREF(names);
+    return PyErr_NoMemory();
+  }
+  plan->length = length;
+  plan->is_tuple = is_tuple;
+  plan->names = names;
+  plan->keys = as_array ? NULL : (char*)(plan->key_offsets + length + 1);
+  plan->key_offsets[0] = 0;
+  for (Py_ssize_t idx = 0; idx < length && !as_array; ++idx) {
+    Py_ssize_t u8size;
+    char const* u8string =
+        PyUnicode_AsUTF8AndSize(PyTuple_GET_ITEM(names, idx), &u8size);
+    char* key = plan->keys + plan->key_offsets[idx];
+    if (u8size <= 0xf) {
+      *key++ = '\xa0' + (char)u8size;
+    } else if (u8size <= 0xff) {
+      *key++ = '\xd9';
+      *key++ = (char)u8size;
+    } else if A_LIKELY(u8size <= 0xffff) {
+      *key++ = '\xda';
+      *key++ = (char)(u8size >> 8);
+      *key++ = (char)u8size;
+    } else {
+      PyErr_SetString(PyExc_ValueError, "field name is too long");
+      Py_DECREF(names);
+      PyMem_Free(plan);
+      return NULL;
+    }
+    memcpy(key, u8string, u8size);
+    plan->key_offsets[idx + 1] = key + u8size - plan->keys;
+  }
+  PyObject* capsule = PyCapsule_New(plan, NULL, struct_plan_free);
+  if A_UNLIKELY(capsule == NULL) {
+    Py_DECREF(names);
+    PyMem_Free(plan);
+  }
+  return capsule;
+}
+
+// returns: -1 - failure
+//           0 - `type` is not a struct
+//           1 - success, `*plan` is set
+static int struct_plan_get(PyObject* plans, PyTypeObject* type,
+                           int as_array, StructPlan const** plan) {
+  PyObject* capsule = PyDict_GetItemWithError(plans, (PyObject*)type);
+  if A_UNLIKELY(capsule == NULL) {
+    if (PyErr_Occurred() != NULL) {
+      return -1;
+    }
+    capsule = struct_plan_new(type, as_array);
+    if A_UNLIKELY(capsule == NULL) {
+      return -1;
+    }
+    int const set_result = PyDict_SetItem(plans, (PyObject*)type, capsule);
+    Py_DECREF(capsule);  // `plans` holds the reference
+    if A_UNLIKELY(set_result != 0) {
+      return -1;
+    }
+  }
+  if (capsule == Py_None) {
+    return 0;
+  }
+  *plan = (StructPlan*)PyCapsule_GetPointer(capsule, NULL);
+  return 1;
+}
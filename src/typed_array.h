@@ -0,0 +1,177 @@
+#pragma once
+#include <Python.h>
+
+#include "simd.h"
+
+/*
+  Typed arrays are buffer exporters like `array.array` or `memoryview`.
+  They are packed as MessagePack arrays or as Ext with the following data:
+  `array.array` typecode byte followed by big-endian items.
+*/
+// values out of Ext code range
+#define TYPED_ARRAYS_AS_ARRAY 128
+#define TYPED_ARRAYS_DISABLED 256
+
+typedef struct {
+  char kind;       // 'i' - signed, 'u' - unsigned, 'f' - float
+  char typecode;   // `array.array` typecode with the same item size
+  int big_endian;  // items are stored in MessagePack byte order
+  int itemsize;
+} TypedFormat;
+
+// returns: 1 - `format` is a supported typed array format
+//          0 - not supported
+static int typed_format_parse(TypedFormat* out, char const* format,
+                              Py_ssize_t itemsize) {
+  out->big_endian = 0;
+  if (format == NULL) {
+    format = "B";  // unsigned bytes
+  }
+  if (*format == '>' || *format == '!') {
+    out->big_endian = 1;
+    format += 1;
+  } else if (*format == '<' || *format == '=' || *format == '@') {
+    format += 1;
+  }
+  if (format[0] == '\0' || format[1] != '\0') {
+    return 0;
+  }
+  switch (*format) {
+    case 'b':
+    case 'h':
+    case 'i':
+    case 'l':
+    case 'q':
+    case 'n':
+      out->kind = 'i';
+      break;
+    case 'B':
+    case 'H':
+    case 'I':
+    case 'L':
+    case 'Q':
+    case 'N':
+      out->kind = 'u';
+      break;
+    case 'f':
+    case 'd':
+      out->kind = 'f';
+      break;
+    default:
+      return 0;
+  }
+  out->itemsize = (int)itemsize;
+  switch (itemsize) {
+    case 1:
+      out->typecode = 'b';
+      break;
+    case 2:
+      out->typecode = 'h';
+      break;
+    case 4:
+      out->typecode = out->kind == 'f' ? 'f' : 'i';
+      break;
+    case 8:
+      out->typecode = out->kind == 'f' ? 'd' : 'q';
+      break;
+    default:
+      return 0;
+  }
+  if (out->kind == 'f' && itemsize < 4) {
+    return 0;
+  }
+  if (out->kind == 'u') {
+    out->typecode = (char)Py_TOUPPER(out->typecode);
+  }
+  return 1;
+}
+
+// parses `typed_arrays` argument of `Packer` and `Unpacker`
+// returns: -1 - failure
+//           0 - success
+static int typed_arrays_parse(int* out, PyObject* typed_arrays,
+                              int allow_array) {
+  if (typed_arrays == NULL || typed_arrays == Py_None) {
+    *out = TYPED_ARRAYS_DISABLED;
+    return 0;
+  }
+  if (allow_array && PyUnicode_Check(typed_arrays) &&
+      PyUnicode_CompareWithASCIIString(typed_arrays, "array") == 0) {
+    *out = TYPED_ARRAYS_AS_ARRAY;
+    return 0;
+  }
+  if (PyLong_Check(typed_arrays)) {
+    long const code = PyLong_AsLong(typed_arrays);
+    if (code >= 0 && code <= 127) {
+      *out = (int)code;
+      return 0;
+    }
+    if (code == -1 && PyErr_Occurred() != NULL) {
+      PyErr_Clear();
+    }
+  }
+  PyErr_SetString(PyExc_ValueError,
+                  allow_array ? "`typed_arrays` must be 'array', Ext code "
+                                "between 0 and 127 or None"
+                              : "`typed_arrays` must be Ext code between 0 "
+                                "and 127 or None");
+  return -1;
+}
+
+// returns new `array.array` from typed array Ext data or NULL on failure
+static PyObject* typed_array_from_ext(AMsgPackState const* state,
+                                      char const* data, Py_ssize_t length) {
+  char const typecode[2] = {length != 0 ? data[0] : '\0', '\0'};
+  Py_ssize_t itemsize = 0;
+  switch (typecode[0]) {
+    case 'b':
+    case 'B':
+      itemsize = 1;
+      break;
+    case 'h':
+    case 'H':
+      itemsize = 2;
+      break;
+    case 'i':
+    case 'I':
+    case 'f':
+      itemsize = 4;
+      break;
+    case 'q':
+    case 'Q':
+    case 'd':
+      itemsize = 8;
+      break;
+  }
+  if A_UNLIKELY(itemsize == 0 || (length - 1) % itemsize != 0) {
+    PyErr_SetString(PyExc_ValueError, "Invalid typed array data");
+    return NULL;
+  }
+  PyObject* array = PyObject_CallFunction(state->array_type, "s", typecode);
+  if A_UNLIKELY(array == NULL) {
+    return NULL;
+  }
+  PyObject* view =
+      PyMemoryView_FromMemory((char*)data + 1, length - 1, PyBUF_READ);
+  if A_UNLIKELY(view == NULL) {
+    Py_DECREF(array);
+    return NULL;
+  }
+  PyObject* result = PyObject_CallMethod(array, "frombytes", "O", view);
+  Py_DECREF(view);
+  if A_UNLIKELY(result == NULL) {
+    Py_DECREF(array);
+    return NULL;
+  }
+  Py_DECREF(result);
+  if (itemsize > 1) {
+    Py_buffer buffer;
+    if A_UNLIKELY(PyObject_GetBuffer(array, &buffer, PyBUF_WRITABLE) != 0) {
+      Py_DECREF(array);
+      return NULL;
+    }
+    bswap_copy(buffer.buf, buffer.buf, buffer.len / itemsize, (int)itemsize);
+    PyBuffer_Release(&buffer);
+  }
+  return array;
+}
@@ -1,6 +1,7 @@
 #include <Python.h>
 
 #include "deque.h"
+#include "skip.h"
 #define MiB128 134217728
 
 #ifndef PYPY_VERSION
@@ -9,63 +10,60 @@
 #define ANEW_DICT(N) PyDict_New()
 #endif
 
-static inline uint32_t xxhash32(uint8_t const* data, uint32_t len,
-                                uint32_t seed) {
-  if (len > MAX_CACHE_LEN) {
-    Py_UNREACHABLE();  // GCOVR_EXCL_LINE
+#ifdef A_PER_THREAD_CACHE
+// returns key cache of the current thread, created on the first call,
+// or NULL when it can not be created. The cache is optional, so errors
+// are not reported
+static KeyCache* get_unicode_cache(AMsgPackState* state) {
+  PyObject* thread_dict = PyThreadState_GetDict();
+  if A_UNLIKELY(thread_dict == NULL) {
+    return NULL;
   }
-  uint32_t const prime = 0x9E3779B1;
-  uint32_t hash = seed + prime;
-  size_t idx = 0;
-
-  for (; idx != (len & ~0x03U); idx += 4) {
-    uint32_t block;
-    // Avoids strict-aliasing issues, as we know the data is not aligned
-    memcpy(&block, data + idx, 4);
-    hash ^= block;
-    hash *= prime;
-    hash = (hash << 13) | (hash >> 19);  // Rotate left 13
+  int const gc_epoch = A_ATOMIC_LOAD_INT(&state->gc_epoch);
+  PyObject* capsule =
+      PyDict_GetItemWithError(thread_dict, state->thread_cache_key);
+  if A_LIKELY(capsule != NULL) {
+    KeyCache* cache = (KeyCache*)PyCapsule_GetPointer(capsule, NULL);
+    if A_UNLIKELY(cache->gc_epoch != gc_epoch) {
+      // the collector ran since the last call, same as `amsgpack_traverse`
+      // with the GIL, evict one part per two traversals
+      evict_cache_part(cache, (gc_epoch / 2) & 7);
+      cache->gc_epoch = gc_epoch;
+    }
+    return cache;
   }
-
-  for (; idx < len; ++idx) {
-    hash ^= data[idx];
-    hash *= prime;
-    hash = (hash << 13) | (hash >> 19);
+  if A_UNLIKELY(PyErr_Occurred() != NULL) {
+    PyErr_Clear();
+    return NULL;
   }
-
-  hash ^= len;
-  hash *= 0x85EBCA77;
-  hash ^= (hash >> 16);
-  return hash;
+  KeyCache* cache = key_cache_new(CACHE_TABLE_SIZE, 1, MAX_CACHE_LEN,
+                                  state->key_cache_seed);
+  if A_UNLIKELY(cache == NULL) {
+    PyErr_Clear();
+    return NULL;
+  }
+  cache->gc_epoch = gc_epoch;
+  capsule = PyCapsule_New(cache, NULL, key_cache_capsule_free);
+  if A_UNLIKELY(capsule == NULL) {
+    key_cache_free(cache);
+    PyErr_Clear();
+    return NULL;
+  }
+  // the thread dict owns the cache and releases it with the thread state
+  int const set_result =
+      PyDict_SetItem(thread_dict, state->thread_cache_key, capsule);
+  Py_DECREF(capsule);
+  if A_UNLIKELY(set_result != 0) {
+    PyErr_Clear();
+    return NULL;
+  }
+  return cache;
 }
-
-static inline PyObject* as_string(AMsgPackState* state, char const* str,
-                                  Py_ssize_t length) {
-  if A_LIKELY(length <= MAX_CACHE_LEN) {
-    // let's not  use the seed, as there's no actual denial of service
-    uint32_t const hash =
-        xxhash32((uint8_t const*)str, length, 0 /*_Py_HashSecret.siphash.k0*/);
-    CacheEntry* cache_entry =
-        &state->unicode_cache[hash & (CACHE_TABLE_SIZE - 1)];
-    if (cache_entry->hash == hash && cache_entry->len == length &&
-        memcmp(str, cache_entry->data, length) == 0) {
-      Py_INCREF(cache_entry->obj);
-      return cache_entry->obj;
-    }
-    PyObject* parsed_object = PyUnicode_DecodeUTF8(str, length, NULL);
-    if A_UNLIKELY(parsed_object == NULL) {
-      return parsed_object;
-    }
-    Py_XDECREF(cache_entry->obj);
-    cache_entry->hash = hash;
-    Py_INCREF(parsed_object);
-    cache_entry->obj = parsed_object;
-    cache_entry->len = length;
-    memcpy(cache_entry->data, str, length);
-    return parsed_object;
-  }
-  return PyUnicode_DecodeUTF8(str, length, NULL);
+#else
+static inline KeyCache* get_unicode_cache(AMsgPackState* state) {
+  return state->unicode_cache;  // the GIL protects the cache
 }
+#endif
 
 typedef struct {
   enum UnpackAction { SEQUENCE_APPEND, DICT_KEY, DICT_VALUE } action;
@@ -97,6 +95,14 @@ typedef struct {
   AMsgPackState* state;
   int use_tuple;
   PyObject* ext_hook;
+  int typed_arrays;  // Ext code of typed arrays or TYPED_ARRAYS_DISABLED
+  int bin_memoryview;  // `bin_type="memoryview"`
+  KeyCache* key_cache;  // own key cache or NULL for the shared one
+  PyObject* key_cache_capsule;  // owns `key_cache`
+  KeyCache* value_cache;        // `cache_values=True` cache or NULL
+  PyObject* value_cache_capsule;  // owns `value_cache`
+  int lazy;  // `unpackb` returns `LazyMap` and `LazyArray`
+  int raw;   // messages are returned as `bytes`, see `unpacker_next_raw`
 } Unpacker;
 
 static PyObject* size_error(char type[], Py_ssize_t length, Py_ssize_t limit) {
@@ -104,6 +110,67 @@ static PyObject* size_error(char type[], Py_ssize_t length, Py_ssize_t limit) {
                       length, limit);
 }
 
+// returns new read-only `memoryview` of bytes of `obj`, a fed object
+static PyObject* unpacker_byte_view(PyObject* obj) {
+  PyObject* view = PyMemoryView_FromObject(obj);
+  if A_LIKELY(view == NULL || PyBytes_CheckExact(obj)) {
+    return view;
+  }
+  // `bytearray`, `array` or `mmap` may be writable and of any item format
+  Py_SETREF(view, PyObject_CallMethod(view, "cast", "s", "B"));
+  if A_UNLIKELY(view == NULL) {
+    return NULL;
+  }
+  Py_SETREF(view, PyObject_CallMethod(view, "toreadonly", NULL));
+  return view;
+}
+
+// returns new `bytes` or `memoryview` of bin or Ext payload at `data`,
+// `in_head` is true when `data` points into the deque head, so it can be
+// referenced instead of copied
+static PyObject* unpacker_payload(Unpacker const* self, char const* data,
+                                  Py_ssize_t length, int in_head) {
+  Py_buffer const* head = in_head ? &self->deque.deque_first->view : NULL;
+  if (head != NULL && PyBytes_CheckExact(head->obj) &&
+      data == PyBytes_AS_STRING(head->obj) &&
+      length == PyBytes_GET_SIZE(head->obj)) {
+    // the payload is the whole fed `bytes`, like in `feed(header)`,
+    // `feed(blob)`, so `bytes` are returned as is
+    if A_LIKELY(!self->bin_memoryview) {
+      Py_INCREF(head->obj);
+      return head->obj;
+    }
+    return PyMemoryView_FromObject(head->obj);
+  }
+  if A_LIKELY(!self->bin_memoryview) {
+    return PyBytes_FromStringAndSize(data, length);
+  }
+  if (head == NULL) {
+    // the payload spans deque nodes and `data` is a temporary copy
+    PyObject* bytes = PyBytes_FromStringAndSize(data, length);
+    if A_UNLIKELY(bytes == NULL) {
+      return NULL;
+    }
+    PyObject* view = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    return view;
+  }
+  // the slice keeps the fed object alive
+  PyObject* head_view = unpacker_byte_view(head->obj);
+  if A_UNLIKELY(head_view == NULL) {
+    return NULL;
+  }
+  // the head may be a part of the object, see `deque_append_part`
+  Py_buffer const* const whole = PyMemoryView_GET_BUFFER(head_view);
+  Py_ssize_t const start = data - (char const*)whole->buf;
+  if (start == 0 && length == whole->len) {
+    return head_view;
+  }
+  PyObject* view = PySequence_GetSlice(head_view, start, start + length);
+  Py_DECREF(head_view);
+  return view;
+}
+
 #define READ_A_DATA(length)                                       \
   char const* data = deque_read_bytes_fast(&self->deque, length); \
   char* allocated = NULL;                                         \
@@ -123,7 +190,78 @@ static PyObject* size_error(char type[], Py_ssize_t length, Py_ssize_t limit) {
     }                                                  \
   } while (0)
 
+// returns: size of the first message of `deque`, SKIP_INCOMPLETE or
+//          SKIP_INVALID, no bytes are consumed
+static Py_ssize_t deque_message_size(Deque const* deque) {
+  if (!deque_has_next_byte(deque)) {
+    return SKIP_INCOMPLETE;
+  }
+  Py_ssize_t const head_size = deque->size_first - deque->pos;
+  Py_ssize_t const head_end = msgpack_skip(
+      (uint8_t const*)deque->deque_bytes + deque->pos, 0, head_size);
+  if A_LIKELY(head_end != SKIP_INCOMPLETE ||
+              deque->deque_first->next == NULL) {
+    return head_end;
+  }
+  // the message continues in the next fed objects, headers are copied
+  DequeCursor cursor = {deque->deque_first, deque->pos};
+  Py_ssize_t size = 0;
+  Py_ssize_t left = 1;
+  while (left != 0) {
+    char header[SKIP_HEADER_MAX];
+    Py_ssize_t const avail = deque_cursor_peek(cursor, header, SKIP_HEADER_MAX);
+    if (avail == 0) {
+      return SKIP_INCOMPLETE;
+    }
+    Py_ssize_t payload, items;
+    int const header_size =
+        skip_header((uint8_t const*)header, avail, &payload, &items);
+    if (header_size < 0) {
+      return header_size;
+    }
+    if (deque_cursor_advance(&cursor, header_size + payload) != 0) {
+      return SKIP_INCOMPLETE;
+    }
+    size += header_size + payload;
+    left += items - 1;
+  }
+  return size;
+}
+
+// returns new `bytes` of the next message of `self->deque` or NULL,
+// with exception set on failure only
+static PyObject* unpacker_next_raw(Unpacker* self) {
+  Deque* const deque = &self->deque;
+  Py_ssize_t const size = deque_message_size(deque);
+  if (size == SKIP_INCOMPLETE) {
+    return NULL;
+  }
+  if A_UNLIKELY(size == SKIP_INVALID) {
+    PyErr_SetString(PyExc_ValueError, "amsgpack: 0xc1 byte must not be used");
+    return NULL;
+  }
+  Py_buffer const* head = &deque->deque_first->view;
+  PyObject* message;
+  if (PyBytes_CheckExact(head->obj) && deque->pos == 0 &&
+      head->buf == PyBytes_AS_STRING(head->obj) &&
+      size == PyBytes_GET_SIZE(head->obj)) {
+    message = Py_NewRef(head->obj);  // one message per fed `bytes`
+  } else {
+    message = PyBytes_FromStringAndSize(NULL, size);
+    if A_UNLIKELY(message == NULL) {
+      return NULL;
+    }
+    DequeCursor const cursor = {deque->deque_first, deque->pos};
+    deque_cursor_peek(cursor, PyBytes_AS_STRING(message), size);
+  }
+  deque_advance(deque, size);
+  return message;
+}
+
 static PyObject* Unpacker_iternext(Unpacker* self) {
+  if (self->raw) {
+    return unpacker_next_raw(self);
+  }
   int parse_a_key = 0;
   // to allow passing length between switch cases
   union {
@@ -135,6 +273,9 @@ static PyObject* Unpacker_iternext(Unpacker* self) {
   } length;
   PyObject* parsed_object;
   char next_byte;
+  // `self->key_cache` and `self->value_cache` are read on every string,
+  // `ext_hook` may reinitialize `self` and release them
+  KeyCache* const unicode_cache = get_unicode_cache(self->state);
 parse_next:
   if (!deque_has_next_byte(&self->deque)) {
     return NULL;
@@ -283,10 +424,14 @@ parse_next_with_next_byte_set:
     length_str: {
       READ_A_DATA(length.str);
       if (parse_a_key != 0) {
-        parsed_object = as_string(self->state, data, length.str);
+        parsed_object = as_string(
+            self->key_cache != NULL ? self->key_cache : unicode_cache, data,
+            length.str);
         parse_a_key = 0;
+      } else if (self->value_cache != NULL) {
+        parsed_object = as_string(self->value_cache, data, length.str);
       } else {
-        parsed_object = PyUnicode_DecodeUTF8(data, length.str, NULL);
+        parsed_object = utf8_decode(data, length.str);
       }
 
       FREE_A_DATA(length.str);
@@ -311,10 +456,13 @@ parse_next_with_next_byte_set:
         if (deque_has_next_n_bytes(&self->deque, 1 + size_size + length.bin)) {
           deque_skip_size(&self->deque, size_size);
           if A_UNLIKELY(length.bin == 0) {
-            parsed_object = PyBytes_FromStringAndSize(NULL, length.bin);
+            parsed_object = self->bin_memoryview
+                                ? PyMemoryView_FromMemory("", 0, PyBUF_READ)
+                                : PyBytes_FromStringAndSize(NULL, length.bin);
           } else {
             READ_A_DATA(length.bin);
-            parsed_object = PyBytes_FromStringAndSize(data, length.bin);
+            parsed_object = unpacker_payload(self, data, length.bin,
+                                             allocated == NULL);
             FREE_A_DATA(length.bin);
           }
           if A_UNLIKELY(parsed_object == NULL) {
@@ -434,18 +582,33 @@ parse_next_with_next_byte_set:
     length_ext: {
       READ_A_DATA(length.ext + 1);
       char const code = data[0];
+      if (code == self->typed_arrays) {
+        parsed_object = typed_array_from_ext(self->state, data + 1, length.ext);
+        FREE_A_DATA(length.ext + 1);
+        if A_UNLIKELY(parsed_object == NULL) {
+          return NULL;
+        }
+        break;
+      }
       Ext* ext = PyObject_New(Ext, self->state->ext_type);
       if A_UNLIKELY(ext == NULL) {
         PyMem_Free(allocated);
         return NULL;  // Allocation failed, likely
       }
       ext->code = code;
-      ext->data = PyBytes_FromStringAndSize(data + 1, length.ext);
+      ext->view.obj = NULL;
+      ext->data =
+          unpacker_payload(self, data + 1, length.ext, allocated == NULL);
       if A_UNLIKELY(ext->data == NULL) {
         Py_DECREF(ext);
         PyMem_Free(allocated);
         return NULL;
       }
+      if A_UNLIKELY(data_view_init(&ext->view, ext->data, NULL) != 0) {
+        Py_DECREF(ext);
+        PyMem_Free(allocated);
+        return NULL;
+      }
       PyObject* new_ext;
       if A_LIKELY(self->ext_hook == NULL) {
         new_ext = Ext_default(ext, NULL);
@@ -584,14 +747,141 @@ parse_next_with_next_byte_set:
 
 // static struct PyModuleDef amsgpack_module;
 
+// makes own key cache of `self`, when any of the options is given
+// returns: -1 - failure (exception is set)
+//           0 - success
+static int unpacker_init_key_cache(Unpacker* self, PyObject* size_obj,
+                                   int ways, Py_ssize_t key_length,
+                                   PyObject* keys) {
+  Py_CLEAR(self->key_cache_capsule);
+  self->key_cache = NULL;
+  if (size_obj == Py_None && ways == 0 && key_length == 0 && keys == Py_None) {
+    return 0;
+  }
+  Py_ssize_t size = CACHE_TABLE_SIZE;
+  if (ways == 0) {
+    ways = 1;
+  }
+  if (key_length == 0) {
+    key_length = MAX_CACHE_LEN;
+  }
+  if A_UNLIKELY(ways != 1 && ways != 2 && ways != 4) {
+    PyErr_SetString(PyExc_ValueError, "`cache_ways` must be 1, 2 or 4");
+    return -1;
+  }
+  if (size_obj != Py_None) {
+    size = PyLong_AsSsize_t(size_obj);
+    if A_UNLIKELY(size == -1 && PyErr_Occurred()) {
+      return -1;
+    }
+    if A_UNLIKELY(size < ways || size > KEY_CACHE_MAX_SIZE ||
+                  (size & (size - 1)) != 0) {
+      PyErr_Format(PyExc_ValueError,
+                   "`cache_size` must be a power of two from `cache_ways` "
+                   "to %d",
+                   KEY_CACHE_MAX_SIZE);
+      return -1;
+    }
+  }
+  if A_UNLIKELY(key_length < 1 || key_length > KEY_CACHE_MAX_KEY_LENGTH) {
+    PyErr_Format(PyExc_ValueError, "`cache_key_length` must be from 1 to %d",
+                 KEY_CACHE_MAX_KEY_LENGTH);
+    return -1;
+  }
+  KeyCache* cache = key_cache_new(size, (unsigned int)ways, key_length,
+                                  self->state->key_cache_seed);
+  if A_UNLIKELY(cache == NULL) {
+    return -1;
+  }
+  cache->shared = 1;
+  PyObject* capsule = PyCapsule_New(cache, NULL, key_cache_capsule_free);
+  if A_UNLIKELY(capsule == NULL) {
+    key_cache_free(cache);
+    return -1;
+  }
+  if (keys != Py_None && key_cache_pin(cache, keys) != 0) {
+    Py_DECREF(capsule);
+    return -1;
+  }
+  self->key_cache = cache;
+  self->key_cache_capsule = capsule;
+  return 0;
+}
+
+// returns: -1 - failure (exception is set)
+//           0 - success
+static int unpacker_init_value_cache(Unpacker* self, int cache_values) {
+  Py_CLEAR(self->value_cache_capsule);
+  self->value_cache = NULL;
+  if (!cache_values) {
+    return 0;
+  }
+  KeyCache* cache = key_cache_new(VALUE_CACHE_SIZE, VALUE_CACHE_WAYS,
+                                  VALUE_CACHE_MAX_LEN,
+                                  self->state->key_cache_seed);
+  if A_UNLIKELY(cache == NULL) {
+    return -1;
+  }
+  cache->shared = 1;
+  PyObject* capsule = PyCapsule_New(cache, NULL, key_cache_capsule_free);
+  if A_UNLIKELY(capsule == NULL) {
+    key_cache_free(cache);
+    return -1;
+  }
+  if A_UNLIKELY(key_cache_admit_second(cache) != 0) {
+    Py_DECREF(capsule);
+    return -1;
+  }
+  self->value_cache = cache;
+  self->value_cache_capsule = capsule;
+  return 0;
+}
+
 static int Unpacker_init(Unpacker* self, PyObject* args, PyObject* kwargs) {
-  static char* keywords[] = {"tuple", "ext_hook", NULL};
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$pO:Unpacker", keywords,
-                                   &self->use_tuple, &self->ext_hook)) {
+  static char* keywords[] = {"tuple",
+                             "ext_hook",
+                             "typed_arrays",
+                             "bin_type",
+                             "cache_size",
+                             "cache_ways",
+                             "cache_key_length",
+                             "keys",
+                             "cache_values",
+                             "lazy",
+                             "raw",
+                             NULL};
+  PyObject* ext_hook = NULL;  // borrowed until every option is valid
+  PyObject* typed_arrays = NULL;
+  char const* bin_type = NULL;
+  PyObject* cache_size_obj = Py_None;
+  int cache_ways = 0;
+  Py_ssize_t cache_key_length = 0;
+  PyObject* keys = Py_None;
+  int cache_values = 0;
+  int lazy = 0;
+  int raw = 0;
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwargs, "|$pOOsOinOppp:Unpacker", keywords, &self->use_tuple,
+          &ext_hook, &typed_arrays, &bin_type, &cache_size_obj, &cache_ways,
+          &cache_key_length, &keys, &cache_values, &lazy, &raw)) {
     return -1;
   }
-  if A_UNLIKELY(self->ext_hook != NULL &&
-                Py_TYPE(self->ext_hook)->tp_call == NULL) {
+  self->lazy = lazy;
+  self->raw = raw;
+  if (bin_type == NULL || strcmp(bin_type, "bytes") == 0) {
+    self->bin_memoryview = 0;
+  } else if A_LIKELY(strcmp(bin_type, "memoryview") == 0) {
+    self->bin_memoryview = 1;
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    "`bin_type` must be 'bytes' or 'memoryview'");
+    return -1;
+  }
+  if A_UNLIKELY(typed_arrays_parse(&self->typed_arrays, typed_arrays, 0) !=
+                0) {
+    return -1;
+  }
+  if A_UNLIKELY(ext_hook != NULL && Py_TYPE(ext_hook)->tp_call == NULL) {
     PyErr_SetString(PyExc_TypeError, "`ext_hook` must be callable");
     return -1;
   }
@@ -601,24 +891,25 @@ static int Unpacker_init(Unpacker* self, PyObject* args, PyObject* kwargs) {
   if A_UNLIKELY(self->state == NULL) {
     return -1;
   };
-  Py_XINCREF(self->ext_hook);
+  if A_UNLIKELY(unpacker_init_key_cache(self, cache_size_obj, cache_ways,
+                                        cache_key_length, keys) != 0 ||
+                unpacker_init_value_cache(self, cache_values) != 0) {
+    return -1;
+  }
+  Py_XINCREF(ext_hook);
+  Py_XSETREF(self->ext_hook, ext_hook);
   return 0;
 }
 
 static PyObject* unpacker_feed(Unpacker* self, PyObject* obj) {
-  if A_UNLIKELY(PyBytes_CheckExact(obj) == 0) {
-    PyErr_Format(PyExc_TypeError, "a bytes object is required, not '%.100s'",
-                 Py_TYPE(obj)->tp_name);
-    return NULL;
-  }
   if A_UNLIKELY(deque_append(&self->deque, obj) < 0) {
-    return PyErr_NoMemory();
+    return NULL;
   }
   Py_RETURN_NONE;
 }
 
-static PyObject* unpacker_reset(Unpacker* self, PyObject* Py_UNUSED(unused)) {
-  Py_CLEAR(self->ext_hook);
+// releases queued bytes and objects of unfinished containers
+static void unpacker_clean(Unpacker* self) {
   deque_clean(&self->deque);
   while (self->parser.stack_length) {
     Stack* item = self->parser.stack + (--self->parser.stack_length);
@@ -628,47 +919,161 @@ static PyObject* unpacker_reset(Unpacker* self, PyObject* Py_UNUSED(unused)) {
     }
     memset(item, 0, sizeof(Stack));
   }
-  Py_RETURN_NONE;
 }
 
-static PyObject* unpacker_unpackb(Unpacker* self, PyObject* obj) {
-  if A_UNLIKELY(PyBytes_CheckExact(obj) == 0) {
-    PyObject* bytes_obj = PyBytes_FromObject(obj);
-    if (bytes_obj == NULL) {
-      PyErr_Format(PyExc_TypeError,
-                   "unpackb() argument 1 must be bytes, not %s",
-                   Py_TYPE(obj)->tp_name);
-      return NULL;
-    }
-    obj = bytes_obj;
-  } else {
-    Py_INCREF(obj);  // so we can safely decref it later in this function
+static PyObject* unpacker_skip(Unpacker* self, PyObject* args) {
+  Py_ssize_t count = 1;
+  if (!PyArg_ParseTuple(args, "|n:skip", &count)) {
+    return NULL;
   }
-  int const append_result = deque_append(&self->deque, obj);
-  Py_DECREF(obj);
-  if A_UNLIKELY(append_result < 0) {
+  if A_UNLIKELY(self->parser.stack_length != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "skip() can not be called inside of a message");
     return NULL;
   }
-  PyObject* ret = Unpacker_iternext(self);
+  Py_ssize_t skipped = 0;
+  for (; skipped < count; ++skipped) {
+    Py_ssize_t const size = deque_message_size(&self->deque);
+    if (size == SKIP_INCOMPLETE) {
+      break;
+    }
+    if A_UNLIKELY(size == SKIP_INVALID) {
+      PyErr_SetString(PyExc_ValueError,
+                      "amsgpack: 0xc1 byte must not be used");
+      return NULL;
+    }
+    deque_advance(&self->deque, size);
+  }
+  return PyLong_FromSsize_t(skipped);
+}
+
+static PyObject* unpacker_reset(Unpacker* self, PyObject* Py_UNUSED(unused)) {
+  Py_CLEAR(self->ext_hook);
+  unpacker_clean(self);
+  Py_RETURN_NONE;
+}
+
+// copies options of `self` to `unpacker` on the C stack, that parses one
+// object, so parsing is reentrant and one `Unpacker` is safe to share
+// between threads, like `amsgpack.unpackb` is
+static void unpacker_copy_options(Unpacker* unpacker, Unpacker const* self) {
+  unpacker->deque = (Deque){NULL, NULL, 0, NULL, 0, 0};
+  unpacker->parser.await_bytes = 0;
+  unpacker->parser.stack_length = 0;
+  unpacker->state = self->state;
+  unpacker->use_tuple = self->use_tuple;
+  unpacker->ext_hook = self->ext_hook;
+  unpacker->typed_arrays = self->typed_arrays;
+  unpacker->bin_memoryview = self->bin_memoryview;
+  unpacker->lazy = self->lazy;
+  unpacker->raw = self->raw;
+  unpacker->key_cache = self->key_cache;
+  unpacker->key_cache_capsule = self->key_cache_capsule;
+  unpacker->value_cache = self->value_cache;
+  unpacker->value_cache_capsule = self->value_cache_capsule;
+  Py_XINCREF(unpacker->ext_hook);  // the hook may reinitialize `self`
+  Py_XINCREF(unpacker->key_cache_capsule);
+  Py_XINCREF(unpacker->value_cache_capsule);
+}
+
+// returns the only object of `unpacker.deque` and releases the copy
+static PyObject* unpacker_parse_one(Unpacker* unpacker) {
+  PyObject* ret = Unpacker_iternext(unpacker);
   if (ret == NULL) {
     if A_UNLIKELY(PyErr_Occurred() == NULL) {
       PyErr_SetString(PyExc_ValueError, "Incomplete MessagePack format");
     }
-    goto error;
-  }
-  if A_UNLIKELY(self->deque.deque_first != NULL) {
+  } else if A_UNLIKELY(unpacker->deque.deque_first != NULL) {
     PyErr_SetString(PyExc_ValueError, "Extra data");
-    goto error;
+    Py_CLEAR(ret);
   }
-  unpacker_reset(self, NULL);
   return ret;
-error:
-  unpacker_reset(self, NULL);
-  return NULL;
+}
+
+static void unpacker_release_copy(Unpacker* unpacker) {
+  unpacker_clean(unpacker);
+  Py_XDECREF(unpacker->ext_hook);
+  Py_XDECREF(unpacker->key_cache_capsule);
+  Py_XDECREF(unpacker->value_cache_capsule);
+}
+
+// returns new object of `size` bytes at `start` of exported `obj`
+static PyObject* unpacker_unpack_part(Unpacker* self, PyObject* obj,
+                                      char const* start, Py_ssize_t size) {
+  Unpacker unpacker;
+  unpacker_copy_options(&unpacker, self);
+  PyObject* ret = NULL;
+  if A_LIKELY(deque_append_part(&unpacker.deque, obj, start, size) == 0) {
+    ret = unpacker_parse_one(&unpacker);
+  }
+  unpacker_release_copy(&unpacker);
+  return ret;
+}
+
+#include "lazy.h"
+#include "extract.h"
+
+static PyObject* unpacker_unpackb(Unpacker* self, PyObject* obj) {
+  if A_UNLIKELY(!PyBytes_CheckExact(obj) && !PyObject_CheckBuffer(obj)) {
+    PyErr_Format(PyExc_TypeError,
+                 "unpackb() argument 1 must be bytes-like object, not %s",
+                 Py_TYPE(obj)->tp_name);
+    return NULL;
+  }
+  if (self->lazy) {
+    PyObject* lazy = lazy_unpackb(self, obj);
+    if (lazy != Py_None) {
+      return lazy;  // a map, an array or NULL
+    }
+    Py_DECREF(lazy);  // not a container, unpacked as usual
+  }
+  Unpacker unpacker;
+  unpacker_copy_options(&unpacker, self);
+  PyObject* ret = NULL;
+  // the deque node holds the export of `obj`, nothing is copied
+  int const append_result = deque_append(&unpacker.deque, obj);
+  if A_LIKELY(append_result >= 0) {
+    ret = unpacker_parse_one(&unpacker);
+  }
+  unpacker_release_copy(&unpacker);
+  return ret;
+}
+
+static PyObject* unpacker_cache_info(Unpacker* self,
+                                     PyObject* Py_UNUSED(unused)) {
+  KeyCache* cache = self->key_cache != NULL ? self->key_cache
+                                            : get_unicode_cache(self->state);
+  if A_UNLIKELY(cache == NULL) {
+    Py_RETURN_NONE;  // GCOVR_EXCL_LINE the thread cache is not available
+  }
+  return key_cache_info(cache);
+}
+
+static PyObject* unpacker_value_cache_info(Unpacker* self,
+                                           PyObject* Py_UNUSED(unused)) {
+  if (self->value_cache == NULL) {
+    Py_RETURN_NONE;
+  }
+  return key_cache_info(self->value_cache);
+}
+
+static int Unpacker_traverse(Unpacker* self, visitproc visit, void* arg) {
+  Py_VISIT(Py_TYPE(self));
+  Py_VISIT(self->ext_hook);
+  return 0;
+}
+
+// `ext_hook` may reference lazy results, that reference the unpacker
+static int Unpacker_clear(Unpacker* self) {
+  Py_CLEAR(self->ext_hook);
+  return 0;
 }
 
 static void Unpacker_dealloc(Unpacker* self) {
+  PyObject_GC_UnTrack(self);
   Py_DECREF(unpacker_reset(self, NULL));
+  Py_CLEAR(self->key_cache_capsule);
+  Py_CLEAR(self->value_cache_capsule);
   Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -684,27 +1089,69 @@ static void Unpacker_dealloc(Unpacker* self) {
   Unpacker class
 */
 PyDoc_STRVAR(unpacker_feed_doc,
-             "feed($self, bytes, /)\n--\n\n"
-             "Append ``bytes`` to internal queue.");
+             "feed($self, data, /)\n--\n\n"
+             "Append ``data``, a bytes-like object, to internal queue. The "
+             "data is not copied, so ``bytearray`` can not be resized until "
+             "it is unpacked.");
 PyDoc_STRVAR(unpacker_unpackb_doc,
              "unpackb($self, data, /)\n--\n\n"
-             "Deserialize ``data`` (a ``bytes`` object) to a Python object. By "
-             "calling '__next__' one time and ensuring there's no more data");
+             "Deserialize ``data`` (a bytes-like object) to a Python object. "
+             "By calling '__next__' one time and ensuring there's no more "
+             "data");
 PyDoc_STRVAR(
     unpacker_reset_doc,
     "reset($self, /)\n--\n\n"
     "Cleans up internal queue, that was filled by :meth:`feed` method and "
     "and cleans up stack, that might've been filled by :meth:`__next__`");
 
+PyDoc_STRVAR(unpacker_skip_doc,
+             "skip($self, n=1, /)\n--\n\n"
+             "Drop up to ``n`` fed messages without unpacking them. Returns "
+             "the number of dropped messages, it is less than ``n`` when "
+             "the rest of the fed data is an incomplete message.");
+
+PyDoc_STRVAR(
+    unpacker_extract_doc,
+    "extract($self, data, paths, /, default=None)\n--\n\n"
+    "Return ``tuple`` of values at ``paths`` of the message ``data``. A path "
+    "is a ``tuple`` or ``list`` of map keys and array indices, ``()`` is the "
+    "whole message. Other parts are skipped without making Python objects, "
+    "and only the walked bytes are checked. The last pair of a repeated "
+    "map key is used, like in ``unpackb``, a missing path gives "
+    "``default``.");
+
+PyDoc_STRVAR(
+    unpacker_cache_info_doc,
+    "cache_info($self, /)\n--\n\n"
+    "Returns ``dict`` of the key cache: ``size``, ``ways``, ``key_length``, "
+    "``pinned`` keys and ``hits``, ``misses`` and ``evictions`` counters. "
+    "Without cache options the cache is shared by all unpackers of the "
+    "thread.");
+
+PyDoc_STRVAR(unpacker_value_cache_info_doc,
+             "value_cache_info($self, /)\n--\n\n"
+             "Returns ``dict`` of the ``cache_values=True`` cache, like "
+             ":meth:`cache_info`, or ``None``.");
+
 static PyMethodDef Unpacker_Methods[] = {
     {"feed", (PyCFunction)&unpacker_feed, METH_O, unpacker_feed_doc},
     {"unpackb", (PyCFunction)&unpacker_unpackb, METH_O, unpacker_unpackb_doc},
     {"reset", (PyCFunction)&unpacker_reset, METH_NOARGS, unpacker_reset_doc},
+    {"skip", (PyCFunction)&unpacker_skip, METH_VARARGS, unpacker_skip_doc},
+    {"extract", (PyCFunction)(void (*)(void))unpacker_extract,
+     METH_VARARGS | METH_KEYWORDS, unpacker_extract_doc},
+    {"cache_info", (PyCFunction)&unpacker_cache_info, METH_NOARGS,
+     unpacker_cache_info_doc},
+    {"value_cache_info", (PyCFunction)&unpacker_value_cache_info,
+     METH_NOARGS, unpacker_value_cache_info_doc},
     {NULL, NULL, 0, NULL}  // Sentinel
 };
 
 PyDoc_STRVAR(Unpacker_doc,
-             "Unpacker(tuple = False, ext_hook = None)\n"
+             "Unpacker(tuple = False, ext_hook = None, typed_arrays = None, "
+             "bin_type = 'bytes', cache_size = None, cache_ways = 1, "
+             "cache_key_length = 16, keys = None, cache_values = False, "
+             "lazy = False, raw = False)\n"
              "--\n\n"
              "Unpack bytes to python objects.\n"
              "\n"
@@ -713,6 +1160,42 @@ PyDoc_STRVAR(Unpacker_doc,
              "``amsgpack.unpackb`` function is created using::\n\n"
              "  unpackb = Unpacker().unpackb\n\n"
              "\n"
+             "*typed_arrays* is Ext code of typed arrays packed by "
+             "``Packer(typed_arrays=code)``, such Ext values are unpacked "
+             "as ``array.array``.\n"
+             "\n"
+             "With *bin_type* ``'memoryview'``, bin values and ``Ext.data`` "
+             "are read-only ``memoryview`` objects of the fed ``bytes``, "
+             "without copying. A view keeps the whole fed ``bytes`` alive. "
+             "Payloads split between fed ``bytes`` are copied. A payload "
+             "that is exactly one fed ``bytes`` object is returned without a "
+             "copy in both modes.\n"
+             "\n"
+             "Map keys are looked up in a key cache, so repeated keys are not "
+             "decoded again. By default it is shared, direct-mapped with 512 "
+             "entries and keys of up to 16 bytes. Any of *cache_size* (a "
+             "power of two), *cache_ways* (1, 2 or 4, replacing the least "
+             "recently used key), *cache_key_length* (up to 255) and *keys* "
+             "gives the unpacker its own cache. *keys* are ``str`` that are "
+             "never evicted, as many as fit their cache sets.\n"
+             "\n"
+             "With *cache_values* string values of up to 32 bytes are cached "
+             "too, in a separate 2-way table of 1024 entries. A value is "
+             "cached on its second sighting, so repeated values are shared "
+             "``str`` objects and unique values do not evict them.\n"
+             "\n"
+             "With *lazy* :meth:`unpackb` of a map or an array returns "
+             "read-only :class:`LazyMap` or :class:`LazyArray`. The message "
+             "is checked and indexed in one pass, items are unpacked on the "
+             "first access and kept. Nested maps and arrays are lazy too, "
+             "``materialize()`` unpacks the whole object. Other messages "
+             "and iteration over fed data are not affected.\n"
+             "\n"
+             "With *raw* messages are not unpacked, every message is "
+             "returned as ``bytes``, after its structure is checked. A "
+             "message that is a whole fed ``bytes`` object is returned "
+             "as is.\n"
+             "\n"
              "ext_hook example:\n"
              "\n"
              ""
@@ -735,6 +1218,8 @@ static PyType_Slot Unpacker_slots[] = {
     {Py_tp_new, PyType_GenericNew},
     {Py_tp_init, Unpacker_init},
     {Py_tp_dealloc, (destructor)Unpacker_dealloc},
+    {Py_tp_traverse, Unpacker_traverse},
+    {Py_tp_clear, Unpacker_clear},
     {Py_tp_methods, Unpacker_Methods},
     {Py_tp_iter, AnyUnpacker_iter},
     {Py_tp_iternext, (iternextfunc)Unpacker_iternext},
@@ -744,6 +1229,6 @@ END_NO_PEDANTIC
 static PyType_Spec Unpacker_spec = {
     .name = "amsgpack.Unpacker",
     .basicsize = sizeof(Unpacker),
-    .flags = Py_TPFLAGS_DEFAULT,
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
     .slots = Unpacker_slots,
 };
@@ -0,0 +1,228 @@
+#pragma once
+#include <Python.h>
+
+#include "simd.h"
+
+/*
+  UTF-8 encoding of non-ASCII `str` straight from its UCS1, UCS2 or UCS4
+  data. Unlike `PyUnicode_AsUTF8AndSize`, nothing is cached on the object,
+  so long-lived strings do not keep a UTF-8 copy after packing.
+*/
+
+// returns UTF-8 size of the string or -1 when it has surrogates,
+// that can not be encoded
+static Py_ssize_t ucs_utf8_length(int kind, void const* data,
+                                  Py_ssize_t length) {
+  Py_ssize_t size = length;
+  if (kind == PyUnicode_1BYTE_KIND) {
+    return size + count_non_ascii((uint8_t const*)data, length);
+  }
+  // branchless, so compilers vectorize the loops
+  int surrogates = 0;
+  if (kind == PyUnicode_2BYTE_KIND) {
+    Py_UCS2 const* ucs2 = (Py_UCS2 const*)data;
+    for (Py_ssize_t idx = 0; idx < length; ++idx) {
+      Py_UCS2 const ch = ucs2[idx];
+      size += (ch >= 0x80) + (ch >= 0x800);
+      surrogates |= (ch & 0xf800) == 0xd800;
+    }
+  } else {
+    Py_UCS4 const* ucs4 = (Py_UCS4 const*)data;
+    for (Py_ssize_t idx = 0; idx < length; ++idx) {
+      Py_UCS4 const ch = ucs4[idx];
+      size += (ch >= 0x80) + (ch >= 0x800) + (ch >= 0x10000);
+      surrogates |= (ch & 0xfffff800) == 0xd800;
+    }
+  }
+  if A_UNLIKELY(surrogates) {
+    return -1;
+  }
+  return size;
+}
+
+// writes `ch` to `out`, that has room for 4 bytes
+#define UCS_UTF8_PUT(ch)                              \
+  do {                                                \
+    if (ch < 0x80) {                                  \
+      *out++ = (uint8_t)ch;                           \
+    } else if (ch < 0x800) {                          \
+      out[0] = (uint8_t)(0xc0 | (ch >> 6));           \
+      out[1] = (uint8_t)(0x80 | (ch & 0x3f));         \
+      out += 2;                                       \
+    } else if (ch < 0x10000) {                        \
+      out[0] = (uint8_t)(0xe0 | (ch >> 12));          \
+      out[1] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));  \
+      out[2] = (uint8_t)(0x80 | (ch & 0x3f));         \
+      out += 3;                                       \
+    } else {                                          \
+      out[0] = (uint8_t)(0xf0 | (ch >> 18));          \
+      out[1] = (uint8_t)(0x80 | ((ch >> 12) & 0x3f)); \
+      out[2] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));  \
+      out[3] = (uint8_t)(0x80 | (ch & 0x3f));         \
+      out += 4;                                       \
+    }                                                 \
+  } while (0)
+
+// the same loop for UCS2 and UCS4, blocks of 16 characters are written
+// without checking the room for every character
+#define UCS_UTF8_ENCODE(ucs_type)                                      \
+  do {                                                                 \
+    ucs_type const* ucs = (ucs_type const*)data;                       \
+    while (idx + 16 <= length && out_end - out >= 16 * 4) {            \
+      for (Py_ssize_t const block_end = idx + 16; idx != block_end;) { \
+        Py_UCS4 const ch = ucs[idx++];                                 \
+        UCS_UTF8_PUT(ch);                                              \
+      }                                                                \
+    }                                                                  \
+    for (; idx < length; ++idx) {                                      \
+      Py_UCS4 const ch = ucs[idx];                                     \
+      Py_ssize_t const ch_size =                                       \
+          ch < 0x80 ? 1 : ch < 0x800 ? 2 : ch < 0x10000 ? 3 : 4;       \
+      if (out_end - out < ch_size) {                                   \
+        break;                                                         \
+      }                                                                \
+      UCS_UTF8_PUT(ch);                                                \
+    }                                                                  \
+  } while (0)
+
+// encodes characters starting at `*pos` while they fit into `capacity`
+// returns: number of written bytes, `*pos` is advanced
+static Py_ssize_t ucs_utf8_encode(char* dst, Py_ssize_t capacity, int kind,
+                                  void const* data, Py_ssize_t* pos,
+                                  Py_ssize_t length) {
+  uint8_t* out = (uint8_t*)dst;
+  uint8_t* const out_end = out + capacity;
+  Py_ssize_t idx = *pos;
+  if (kind == PyUnicode_1BYTE_KIND) {
+    Py_UCS1 const* ucs1 = (Py_UCS1 const*)data;
+    while (idx < length) {
+      // Latin-1 text is mostly ASCII, copy it in blocks
+      Py_ssize_t const ascii = ascii_prefix_length(
+          ucs1 + idx, Py_MIN(length - idx, out_end - out));
+      memcpy(out, ucs1 + idx, ascii);
+      out += ascii;
+      idx += ascii;
+      if (idx == length || out_end - out < 2) {
+        break;
+      }
+      Py_UCS1 const ch = ucs1[idx++];
+      out[0] = (uint8_t)(0xc0 | (ch >> 6));
+      out[1] = (uint8_t)(0x80 | (ch & 0x3f));
+      out += 2;
+    }
+  } else if (kind == PyUnicode_2BYTE_KIND) {
+    UCS_UTF8_ENCODE(Py_UCS2);
+  } else {
+    UCS_UTF8_ENCODE(Py_UCS4);
+  }
+  *pos = idx;
+  return (char*)out - dst;
+}
+
+#undef UCS_UTF8_PUT
+#undef UCS_UTF8_ENCODE
+
+/*
+  UTF-8 decoding of unpacked strings. A vectorized pass counts the
+  characters and finds the widest one, then a compact UCS1, UCS2 or UCS4
+  `str` is filled directly while the data is validated. Invalid data is
+  left to `PyUnicode_DecodeUTF8`, so errors are the same.
+*/
+
+// shorter strings are decoded by `PyUnicode_DecodeUTF8`, that is as fast
+// for them and returns shared one character strings
+#define UTF8_DECODE_MIN_LENGTH 16
+
+#define UTF8_IS_CONTINUATION(byte) (((byte) & 0xc0) == 0x80)
+
+// fills `ucs` with characters of `src`, ASCII runs are copied in blocks,
+// goes to `invalid` on invalid UTF-8. Every written character has its own
+// lead byte, so invalid data never writes past the counted characters
+#define UTF8_DECODE_INTO(ucs_type)                                        \
+  do {                                                                    \
+    ucs_type* out = (ucs_type*)ucs;                                       \
+    Py_ssize_t pos = 0;                                                   \
+    while (pos < length) {                                                \
+      uint8_t const lead = src[pos];                                      \
+      Py_ssize_t const left = length - pos;                               \
+      if (lead < 0x80) {                                                  \
+        Py_ssize_t const ascii = ascii_prefix_length(src + pos, left);    \
+        for (Py_ssize_t idx = 0; idx < ascii; ++idx) {                    \
+          out[idx] = src[pos + idx];                                      \
+        }                                                                 \
+        out += ascii;                                                     \
+        pos += ascii;                                                     \
+      } else if (lead >= 0xc2 && lead <= 0xdf) {                          \
+        if A_UNLIKELY(left < 2 || !UTF8_IS_CONTINUATION(src[pos + 1])) {  \
+          goto invalid;                                                   \
+        }                                                                 \
+        *out++ = (ucs_type)(((lead & 0x1f) << 6) | (src[pos + 1] & 0x3f)); \
+        pos += 2;                                                         \
+      } else if (lead >= 0xe0 && lead <= 0xef) {                          \
+        if A_UNLIKELY(left < 3 || !UTF8_IS_CONTINUATION(src[pos + 1]) ||  \
+                      !UTF8_IS_CONTINUATION(src[pos + 2]) ||              \
+                      (lead == 0xe0 && src[pos + 1] < 0xa0) ||            \
+                      (lead == 0xed && src[pos + 1] >= 0xa0)) {           \
+          goto invalid; /* overlong or surrogate */                       \
+        }                                                                 \
+        *out++ = (ucs_type)(((lead & 0x0f) << 12) |                       \
+                            ((src[pos + 1] & 0x3f) << 6) |                \
+                            (src[pos + 2] & 0x3f));                       \
+        pos += 3;                                                         \
+      } else if (lead >= 0xf0 && lead <= 0xf4) {                          \
+        if A_UNLIKELY(left < 4 || !UTF8_IS_CONTINUATION(src[pos + 1]) ||  \
+                      !UTF8_IS_CONTINUATION(src[pos + 2]) ||              \
+                      !UTF8_IS_CONTINUATION(src[pos + 3]) ||              \
+                      (lead == 0xf0 && src[pos + 1] < 0x90) ||            \
+                      (lead == 0xf4 && src[pos + 1] >= 0x90)) {           \
+          goto invalid; /* overlong or above U+10FFFF */                  \
+        }                                                                 \
+        *out++ = (ucs_type)(((lead & 0x07) << 18) |                       \
+                            ((src[pos + 1] & 0x3f) << 12) |               \
+                            ((src[pos + 2] & 0x3f) << 6) |                \
+                            (src[pos + 3] & 0x3f));                       \
+        pos += 4;                                                         \
+      } else {                                                            \
+        goto invalid;                                                     \
+      }                                                                   \
+    }                                                                     \
+  } while (0)
+
+// returns new `str` of UTF-8 `data` or NULL with exception set
+static PyObject* utf8_decode(char const* data, Py_ssize_t length) {
+#ifndef PYPY_VERSION
+  if (length >= UTF8_DECODE_MIN_LENGTH) {
+    uint8_t const* const src = (uint8_t const*)data;
+    uint8_t max_byte;
+    Py_ssize_t const chars =
+        length - count_utf8_continuations(src, length, &max_byte);
+    // the lead byte tells the range: C2 - C3 is Latin-1, up to EF is BMP
+    Py_UCS4 const max_char = max_byte < 0x80    ? 0x7f
+                             : max_byte <= 0xc3 ? 0xff
+                             : max_byte < 0xf0  ? 0xffff
+                                                : 0x10ffff;
+    PyObject* str = PyUnicode_New(chars, max_char);
+    if A_UNLIKELY(str == NULL) {
+      return NULL;
+    }
+    void* const ucs = PyUnicode_DATA(str);
+    if (max_char == 0x7f) {
+      memcpy(ucs, src, (size_t)length);
+    } else if (max_char == 0xff) {
+      UTF8_DECODE_INTO(Py_UCS1);
+    } else if (max_char == 0xffff) {
+      UTF8_DECODE_INTO(Py_UCS2);
+    } else {
+      UTF8_DECODE_INTO(Py_UCS4);
+    }
+    return str;
+  invalid:
+    Py_DECREF(str);
+  }
+#endif
+  return PyUnicode_DecodeUTF8(data, length, NULL);  // raises the error
+}
+
+#undef UTF8_IS_CONTINUATION
+#undef UTF8_DECODE_INTO
+#undef UTF8_DECODE_MIN_LENGTH
@@ -0,0 +1,135 @@
+#pragma once
+#include <Python.h>
+
+/*
+  Streaming XXH64, packed data is hashed by parts while it is written.
+  https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+*/
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+  uint64_t total_length;
+  uint64_t seed;
+  uint64_t acc[4];
+  uint8_t stripe[32];  // incomplete stripe
+  unsigned int stripe_size;
+} XXH64State;
+
+static inline uint64_t xxh64_rotl(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// little-endian loads, compilers turn them into a single `mov`
+static inline uint64_t xxh64_read64(uint8_t const* src) {
+  return (uint64_t)src[0] | ((uint64_t)src[1] << 8) |
+         ((uint64_t)src[2] << 16) | ((uint64_t)src[3] << 24) |
+         ((uint64_t)src[4] << 32) | ((uint64_t)src[5] << 40) |
+         ((uint64_t)src[6] << 48) | ((uint64_t)src[7] << 56);
+}
+
+static inline uint32_t xxh64_read32(uint8_t const* src) {
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  return xxh64_rotl(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t value) {
+  acc ^= xxh64_round(0, value);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void xxh64_init(XXH64State* state, uint64_t seed) {
+  state->total_length = 0;
+  state->seed = seed;
+  state->acc[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+  state->acc[1] = seed + XXH_PRIME64_2;
+  state->acc[2] = seed;
+  state->acc[3] = seed - XXH_PRIME64_1;
+  state->stripe_size = 0;
+}
+
+static inline void xxh64_consume_stripe(uint64_t acc[4], uint8_t const* src) {
+  acc[0] = xxh64_round(acc[0], xxh64_read64(src));
+  acc[1] = xxh64_round(acc[1], xxh64_read64(src + 8));
+  acc[2] = xxh64_round(acc[2], xxh64_read64(src + 16));
+  acc[3] = xxh64_round(acc[3], xxh64_read64(src + 24));
+}
+
+static void xxh64_update(XXH64State* state, char const* data,
+                         Py_ssize_t length) {
+  uint8_t const* src = (uint8_t const*)data;
+  uint8_t const* const end = src + length;
+  state->total_length += (uint64_t)length;
+  if (state->stripe_size != 0) {
+    unsigned int const fill =
+        (unsigned int)Py_MIN((Py_ssize_t)(32 - state->stripe_size), length);
+    memcpy(state->stripe + state->stripe_size, src, fill);
+    state->stripe_size += fill;
+    src += fill;
+    if (state->stripe_size != 32) {
+      return;
+    }
+    xxh64_consume_stripe(state->acc, state->stripe);
+    state->stripe_size = 0;
+  }
+  uint64_t acc[4] = {state->acc[0], state->acc[1], state->acc[2],
+                     state->acc[3]};
+  for (; end - src >= 32; src += 32) {
+    xxh64_consume_stripe(acc, src);
+  }
+  memcpy(state->acc, acc, sizeof(acc));
+  state->stripe_size = (unsigned int)(end - src);
+  memcpy(state->stripe, src, state->stripe_size);
+}
+
+static uint64_t xxh64_digest(XXH64State const* state) {
+  uint64_t hash;
+  if (state->total_length >= 32) {
+    uint64_t const* acc = state->acc;
+    hash = xxh64_rotl(acc[0], 1) + xxh64_rotl(acc[1], 7) +
+           xxh64_rotl(acc[2], 12) + xxh64_rotl(acc[3], 18);
+    hash = xxh64_merge_round(hash, acc[0]);
+    hash = xxh64_merge_round(hash, acc[1]);
+    hash = xxh64_merge_round(hash, acc[2]);
+    hash = xxh64_merge_round(hash, acc[3]);
+  } else {
+    hash = state->seed + XXH_PRIME64_5;
+  }
+  hash += state->total_length;
+  uint8_t const* src = state->stripe;
+  uint8_t const* const end = src + state->stripe_size;
+  for (; end - src >= 8; src += 8) {
+    hash ^= xxh64_round(0, xxh64_read64(src));
+    hash = xxh64_rotl(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (end - src >= 4) {
+    hash ^= (uint64_t)xxh64_read32(src) * XXH_PRIME64_1;
+    hash = xxh64_rotl(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    src += 4;
+  }
+  for (; src != end; ++src) {
+    hash ^= *src * XXH_PRIME64_5;
+    hash = xxh64_rotl(hash, 11) * XXH_PRIME64_1;
+  }
+  hash ^= hash >> 33;
+  hash *= XXH_PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= XXH_PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+#undef XXH_PRIME64_1
+#undef XXH_PRIME64_2
+#undef XXH_PRIME64_3
+#undef XXH_PRIME64_4
+#undef XXH_PRIME64_5
@@ -32,7 +32,8 @@ class RawTest(TestCase):
         with self.assertRaises(TypeError) as context:
             Raw("123")  # pyright: ignore [reportArgumentType]
         self.assertEqual(
-            str(context.exception), "Raw() argument 1 must be bytes, not str"
+            str(context.exception),
+            "Raw() argument 1 must be bytes-like object, not str",
         )
 
     def test_arguments_exception(self):
@@ -65,3 +66,15 @@ class RawTest(TestCase):
 
     def test_repr(self):
         self.assertEqual(repr(Raw(b"Aa")), "Raw(data=b'Aa')")
+
+    def test_buffer(self):
+        data = bytearray(b"\x92\xc2\xc3")
+        raw = Raw(memoryview(data))
+        self.assertEqual(packb(raw), b"\x92\xc2\xc3")
+        self.assertIs(Raw(data).data, data)
+        with self.assertRaises(BufferError):
+            data.append(1)  # exported while `Raw` lives
+        del raw
+        self.assertEqual(packb(Raw(data)), b"\x92\xc2\xc3")
+        with self.assertRaises(BufferError):
+            Raw(memoryview(data)[::2])
@@ -8,7 +8,8 @@ class ExtTest(TestCase):
         with self.assertRaises(TypeError) as context:
             Ext(127, "123")  # pyright: ignore [reportArgumentType]
         self.assertEqual(
-            str(context.exception), "Ext() argument 2 must be bytes, not str"
+            str(context.exception),
+            "Ext() argument 2 must be bytes-like object, not str",
         )
 
     def test_arguments_exception(self):
@@ -213,3 +214,53 @@ class UnpackExtTest(SequenceTestCase):
             context.exception.args,
             (Ext(1, b"\x00\x00\x00\x00\x01\x00\x00\x00"),),
         )
+
+
+class ExtBufferTest(SequenceTestCase):
+    def test_pack(self):
+        from array import array
+
+        expected = packb(Ext(5, b"\x01\x00\x00\x00\x02\x00\x00\x00"))
+        for data in (
+            bytearray(b"\x01\x00\x00\x00\x02\x00\x00\x00"),
+            memoryview(b"xx\x01\x00\x00\x00\x02\x00\x00\x00")[2:],
+            array("I", [1, 2]),
+        ):
+            with self.subTest(data=type(data)):
+                ext = Ext(5, data)
+                self.assertIs(ext.data, data)
+                self.assertEqual(packb(ext), expected)
+
+    def test_big(self):
+        data = bytearray(range(256)) * 300
+        self.assertEqual(packb(Ext(1, data)), packb(Ext(1, bytes(data))))
+
+    def test_timestamp(self):
+        ext = Ext(-1, memoryview(b"\x00\x00\x00\x01"))
+        self.assertTrue(ext.is_timestamp())
+        self.assertEqual(ext.to_timestamp(), Timestamp(1))
+
+    def test_eq(self):
+        self.assertEqual(Ext(1, bytearray(b"ab")), Ext(1, b"ab"))
+
+        class Bad(bytearray):
+            def __eq__(self, other: object) -> bool:
+                raise RuntimeError("eq")
+
+        with self.assertRaises(RuntimeError):
+            Ext(1, Bad(b"ab")) == Ext(1, b"ab")
+
+    def test_hash(self):
+        self.assertEqual(hash(Ext(1, memoryview(b"ab"))), hash(Ext(1, b"ab")))
+        with self.assertRaises(TypeError) as context:
+            hash(Ext(1, bytearray(b"x")))
+        self.assertEqual(
+            str(context.exception), "unhashable type: 'bytearray'"
+        )
+
+    def test_init_twice(self):
+        data = bytearray(b"ab")
+        ext = Ext(1, data)
+        ext.__init__(2, b"cd")
+        data.append(1)  # the first buffer is released
+        self.assertEqual(packb(ext), b"\xd5\x02cd")
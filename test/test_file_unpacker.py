@@ -20,6 +20,14 @@ class BadFileReadRaises:
         raise ValueError("Test Raise is handled")
 
 
+class MemoryViewFile:
+    def __init__(self, data: bytes):
+        self._data = BytesIO(data)
+
+    def read(self, size: int = -1):
+        return memoryview(bytearray(self._data.read(size)))
+
+
 class BadFileNotCallable:
     read = "string"
 
@@ -43,6 +51,13 @@ class FileUnpackerTest(TestCase):
         unpacker = amsgpack.FileUnpacker(buf, 10)
         self.assertEqual(list(unpacker), list(range(100)))
 
+    def test_read_returns_memoryview(self):
+        data = amsgpack.packb([b"bin", "str", 1.5]) * 3
+        unpacker = amsgpack.FileUnpacker(
+            MemoryViewFile(data), 4
+        )
+        self.assertEqual(list(unpacker), [[b"bin", "str", 1.5]] * 3)
+
     def test_file_is_none(self):
         with self.assertRaises(AttributeError) as context:
             amsgpack.FileUnpacker(None)  # pyright: ignore [reportArgumentType]
@@ -59,7 +74,7 @@ class FileUnpackerTest(TestCase):
             next(unpacker)
         self.assertEqual(
             str(context.exception),
-            "a bytes object is required, not 'str'",
+            "a bytes-like object is required, not 'str'",
         )
 
     def test_read_bad_args(self):
@@ -0,0 +1,72 @@
+from unittest import TestCase
+from tempfile import TemporaryDirectory
+from pathlib import Path
+from amsgpack import MappedFile, Unpacker, packb
+
+
+class MappedFileTest(TestCase):
+    messages = [{"id": idx, "data": b"x" * idx} for idx in range(100)]
+
+    def setUp(self):
+        self._tmp = TemporaryDirectory()
+        self.path = Path(self._tmp.name) / "log.msgpack"
+        self.index_path = Path(self._tmp.name) / "log.idx"
+        self.path.write_bytes(b"".join(map(packb, self.messages)))
+
+    def tearDown(self):
+        self._tmp.cleanup()
+
+    def test_random_access(self):
+        with MappedFile(self.path) as file:
+            self.assertEqual(len(file), 100)
+            self.assertEqual(file[42], self.messages[42])
+            self.assertEqual(file[-1], self.messages[-1])
+            self.assertEqual(file[10:13], self.messages[10:13])
+            self.assertEqual(file[::-40], self.messages[::-40])
+            self.assertEqual(list(file), self.messages)
+            self.assertEqual(file.raw(3), packb(self.messages[3]))
+            with self.assertRaises(IndexError):
+                file[100]
+            with self.assertRaises(IndexError):
+                file.raw(-101)
+
+    def test_incomplete_tail_and_empty(self):
+        with self.path.open("ab") as file:
+            file.write(packb([1, 2, 3])[:-1])
+        with MappedFile(self.path) as file:
+            self.assertEqual(len(file), 100)
+        self.path.write_bytes(b"")
+        with MappedFile(self.path) as file:
+            self.assertEqual(len(file), 0)
+            self.assertEqual(list(file), [])
+
+    def test_index(self):
+        with MappedFile(self.path, index_path=self.index_path) as file:
+            self.assertEqual(len(file), 100)
+        index = self.index_path.read_bytes()
+        self.assertEqual(len(index), 16 + 8 * 100)
+        with self.path.open("ab") as file:
+            file.write(packb("appended"))
+        with MappedFile(self.path, index_path=self.index_path) as file:
+            self.assertEqual(len(file), 101)
+            self.assertEqual(file[100], "appended")
+            self.assertEqual(file[99], self.messages[99])
+        self.assertEqual(len(self.index_path.read_bytes()), 16 + 8 * 101)
+
+    def test_stale_index(self):
+        with MappedFile(self.path, index_path=self.index_path):
+            pass
+        self.path.write_bytes(packb(1) + packb(2))
+        with MappedFile(self.path, index_path=self.index_path) as file:
+            self.assertEqual(list(file), [1, 2])
+        self.index_path.write_bytes(b"garbage")
+        with MappedFile(self.path, index_path=self.index_path) as file:
+            self.assertEqual(list(file), [1, 2])
+
+    def test_unpacker(self):
+        unpacker = Unpacker(bin_type="memoryview")
+        with MappedFile(self.path, unpacker=unpacker) as file:
+            message = file[5]
+            self.assertIsInstance(message["data"], memoryview)
+            self.assertEqual(message["data"], b"x" * 5)
+            del message
@@ -1,7 +1,19 @@
-from typing import Any, cast
+from dataclasses import dataclass, field
+from typing import Any, NamedTuple, cast
 from unittest import skipUnless
 from math import pi
-from amsgpack import packb, Ext, unpackb, Timestamp, Packer
+import os
+from amsgpack import (
+    CompiledPacker,
+    packb,
+    Ext,
+    unpackb,
+    Timestamp,
+    Packer,
+    PackBuffer,
+    Raw,
+    Unpacker,
+)
 from struct import pack
 from .test_amsgpack import SequenceTestCase
 from .failing_malloc import failing_malloc, AVAILABLE as FAILING_AVAILABLE
@@ -28,6 +40,55 @@ class PackbTest(SequenceTestCase):
         unicode = "Привет, ❤️"
         self.assertEqual(unpackb(packb(unicode)), unicode)
 
+    def test_non_ascii_kinds(self):
+        for char in ("é", "ÿ", "ж", "€", "\uffff", "😀", "\U0010ffff"):
+            for length in (1, 15, 16, 17, 31, 32, 33, 100, 0x10000):
+                for text in (char * length, "a" * length + char):
+                    with self.subTest(char=char, length=length):
+                        encoded = text.encode()
+                        self.assertEqual(
+                            packb(text)[-len(encoded) :], encoded
+                        )
+                        self.assertEqual(unpackb(packb(text)), text)
+
+    def test_utf8_is_not_cached(self):
+        from sys import getsizeof
+
+        for text in ("café" * 10, "Привет" * 10, "😀" * 10):
+            text = "".join(list(text))  # fresh object
+            size = getsizeof(text)
+            packb(text)
+            self.assertEqual(getsizeof(text), size)
+
+    def test_cached_utf8_is_used(self):
+        from ctypes import pythonapi, c_char_p, py_object
+
+        as_utf8 = pythonapi.PyUnicode_AsUTF8
+        as_utf8.argtypes, as_utf8.restype = [py_object], c_char_p
+        text = "".join(list("Привет"))
+        as_utf8(text)
+        self.assertEqual(packb(text), packb("Привет"))
+
+    def test_surrogates(self):
+        for text in ("\ud800", "a\udfff", "😀\ud800"):
+            with self.subTest(text=text):
+                with self.assertRaises(UnicodeEncodeError) as context:
+                    packb([text])
+                self.assertIn("surrogates not allowed", str(context.exception))
+
+    def test_non_ascii_dump_and_pack_into(self):
+        from io import BytesIO
+
+        text = "жё😀é" * 1000
+        file = BytesIO()
+        Packer().dump(text, file, chunk_size=64)
+        self.assertEqual(file.getvalue(), packb(text))
+        with self.assertRaises(ValueError):
+            Packer().pack_into(bytearray(100), text)
+        buffer = bytearray(len(packb(text)))
+        Packer().pack_into(buffer, text)
+        self.assertEqual(buffer, packb(text))
+
     def test_str8(self):
         unicode = "a" * 0
         self.assertEqual(unpackb(packb(unicode)), unicode)
@@ -145,9 +206,16 @@ class PackbTest(SequenceTestCase):
         self.assertEqual(str(context.exception), "Deeply nested object")
 
     @skipUnless(FAILING_AVAILABLE, "not failing available")
-    def test_initial_buffer_failure(self):
+    def test_buffer_failure(self):
+        value = "a" * 2000
         with self.assertRaises(MemoryError), failing_malloc(1023, "raw"):
-            packb(0)
+            packb(value)
+
+    def test_sizes_up_and_down(self):
+        packb = Packer().packb
+        for n in (0, 1000, 1030, 5000, 100000, 10, 3000, 70000, 5, 2000):
+            value = [b"x" * 100] * n
+            self.assertEqual(unpackb(packb(value)), value)
 
     def test_default_simple(self):
         from array import array
@@ -164,6 +232,26 @@ class PackbTest(SequenceTestCase):
         with self.assertRaises(ValueError):
             packb(...)
 
+    def test_default_result_is_released(self):
+        from sys import getrefcount
+
+        class Point:
+            pass
+
+        point = Point()
+        result = [1, 2]
+        packb = Packer(default=lambda _: result).packb  # pyright: ignore
+        refcounts = getrefcount(point), getrefcount(result)
+        self.assertEqual(
+            packb([point, point]), b"\x92\x92\x01\x02\x92\x01\x02"
+        )
+        self.assertEqual((getrefcount(point), getrefcount(result)), refcounts)
+
+    def test_fixext_inside_list(self):
+        self.assertEqual(
+            packb([1, Ext(1, b"1234")]), b"\x92\x01\xd6\x011234"
+        )
+
     def test_default_recursive(self):
         def default(ext: Ext) -> Ext:
             return ext
@@ -229,3 +317,1002 @@ class PackbIntTest(SequenceTestCase):
             exp = packb(val)
             ref = pack(">BI", 0xCE, val)
             self.assertEqual(exp, ref)
+
+
+class PackIntoTest(SequenceTestCase):
+    def test_bytearray(self):
+        buffer = bytearray(8)
+        self.assertEqual(Packer().pack_into(buffer, [1, "a"]), 4)
+        self.assertEqual(buffer, b"\x92\x01\xa1a\x00\x00\x00\x00")
+
+    def test_offset(self):
+        buffer = bytearray(b"\xff" * 4)
+        self.assertEqual(Packer().pack_into(buffer, True, offset=3), 1)
+        self.assertEqual(buffer, b"\xff\xff\xff\xc3")
+
+    def test_memoryview(self):
+        buffer = bytearray(3)
+        Packer().pack_into(memoryview(buffer)[1:], None)
+        self.assertEqual(buffer, b"\x00\xc0\x00")
+
+    def test_too_small(self):
+        with self.assertRaises(ValueError) as context:
+            Packer().pack_into(bytearray(8), "a" * 8)
+        self.assertEqual(str(context.exception), "Buffer is too small")
+
+    def test_offset_out_of_range(self):
+        with self.assertRaises(ValueError) as context:
+            Packer().pack_into(bytearray(8), 1, 9)
+        self.assertEqual(str(context.exception), "`offset` is out of range")
+        with self.assertRaises(ValueError) as context:
+            Packer().pack_into(bytearray(8), 1, -1)
+        self.assertEqual(
+            str(context.exception), "`offset` must be non-negative"
+        )
+
+    def test_readonly_buffer(self):
+        with self.assertRaises(BufferError):
+            Packer().pack_into(b"12345", 1)  # pyright: ignore
+
+    def test_pack_buffer_appends(self):
+        buffer = PackBuffer(capacity=0)
+        packer = Packer()
+        for i in range(1000):
+            packer.pack_into(buffer, i)
+        self.assertEqual(
+            bytes(buffer), b"".join(packb(i) for i in range(1000))
+        )
+        buffer.clear()
+        self.assertEqual(len(buffer), 0)
+        self.assertEqual(packer.pack_into(buffer, [1.5, "a"]), 12)
+        self.assertEqual(unpackb(buffer.view()), [1.5, "a"])
+
+    def test_pack_buffer_offset(self):
+        buffer = PackBuffer()
+        packer = Packer()
+        packer.pack_into(buffer, [1, 2, 3])
+        packer.pack_into(buffer, 4, offset=1)
+        self.assertEqual(bytes(buffer), b"\x93\x04")
+
+    def test_pack_buffer_failure_keeps_data(self):
+        buffer = PackBuffer()
+        packer = Packer()
+        packer.pack_into(buffer, 1)
+        with self.assertRaises(TypeError):
+            packer.pack_into(buffer, [2, 1j])  # pyright: ignore
+        self.assertEqual(bytes(buffer), b"\x01")
+
+    def test_pack_buffer_can_not_grow_while_viewed(self):
+        buffer = PackBuffer(capacity=16)
+        packer = Packer()
+        view = buffer.view()
+        packer.pack_into(buffer, b"small")
+        with self.assertRaises(BufferError):
+            packer.pack_into(buffer, b"x" * 100)
+        view.release()
+        self.assertEqual(packer.pack_into(buffer, b"x" * 100), 102)
+
+    def test_pack_buffer_reentrance(self):
+        buffer = PackBuffer()
+
+        def default(value: Any) -> Any:
+            return packer.pack_into(buffer, value.real)
+
+        packer = Packer(default=default)
+        with self.assertRaises(BufferError) as context:
+            packer.pack_into(buffer, 1j)
+        self.assertEqual(str(context.exception), "PackBuffer is in use")
+
+
+class PackbManyTest(SequenceTestCase):
+    values: list[Any] = [1, "a", None, [1.5] * 200, {"b": b"c" * 3000}]
+
+    def test_list(self):
+        res = Packer().packb_many(self.values)
+        self.assertEqual(res, [packb(value) for value in self.values])
+
+    def test_concat(self):
+        res = Packer().packb_many(iter(self.values), concat=True)
+        self.assertEqual(res, b"".join(packb(value) for value in self.values))
+
+    def test_offsets(self):
+        ref = [packb(value) for value in self.values]
+        ref_offsets = [0]
+        for message in ref[:-1]:
+            ref_offsets.append(ref_offsets[-1] + len(message))
+        for concat in (False, True):
+            res, offsets = Packer().packb_many(
+                self.values, concat=concat, offsets=True
+            )
+            self.assertEqual(res, b"".join(ref) if concat else ref)
+            self.assertEqual(offsets, ref_offsets)
+
+    def test_empty(self):
+        self.assertEqual(Packer().packb_many(()), [])
+        self.assertEqual(Packer().packb_many((), concat=True), b"")
+
+    def test_unserializable(self):
+        with self.assertRaises(TypeError):
+            Packer().packb_many([1, 1j])  # pyright: ignore
+        with self.assertRaises(TypeError):
+            Packer().packb_many([1, 1j], concat=True)  # pyright: ignore
+
+    def test_iterator_exception(self):
+        def values():
+            yield 1
+            raise ValueError("iterator failure")
+
+        with self.assertRaises(ValueError) as context:
+            Packer().packb_many(values())
+        self.assertEqual(str(context.exception), "iterator failure")
+
+    def test_not_iterable(self):
+        with self.assertRaises(TypeError):
+            Packer().packb_many(1)  # pyright: ignore
+
+
+class DumpTest(SequenceTestCase):
+    value: Any = {"a": [1.5] * 1000, "b": b"x" * 100000, "c": "y" * 3}
+
+    def test_bytes_io(self):
+        from io import BytesIO
+
+        file = BytesIO()
+        written = Packer().dump(self.value, file)
+        self.assertEqual(written, len(packb(self.value)))
+        self.assertEqual(file.getvalue(), packb(self.value))
+
+    def test_chunks(self):
+        chunks: list[bytes] = []
+
+        class File:
+            def write(self, data: memoryview) -> None:
+                chunks.append(bytes(data))
+
+        Packer().dump(self.value, File(), chunk_size=64)
+        self.assertEqual(b"".join(chunks), packb(self.value))
+        self.assertTrue(all(len(chunk) <= 64 for chunk in chunks[:-2]))
+        self.assertIn(b"x" * 100000, chunks)  # payload is not copied
+
+    def test_partial_write(self):
+        chunks: list[bytes] = []
+
+        class File:
+            def write(self, data: memoryview) -> int:
+                chunks.append(bytes(data[:7]))
+                return len(chunks[-1])
+
+        written = Packer().dump(self.value, File(), chunk_size=100)
+        self.assertEqual(written, len(packb(self.value)))
+        self.assertEqual(b"".join(chunks), packb(self.value))
+
+    def test_view_is_released(self):
+        views: list[memoryview] = []
+        Packer().dump([1, 2], type("File", (), {"write": views.append})())
+        with self.assertRaises(ValueError):
+            bytes(views[0])
+
+    def test_write_error(self):
+        views: list[memoryview] = []
+
+        class File:
+            def write(self, data: memoryview) -> None:
+                views.append(data)
+                raise OSError("disk full")
+
+        with self.assertRaises(OSError) as context:
+            Packer().dump(1, File())
+        self.assertEqual(str(context.exception), "disk full")
+        with self.assertRaises(ValueError):
+            bytes(views[0])
+
+    def test_write_returns_zero(self):
+        class File:
+            def write(self, data: memoryview) -> int:
+                return 0
+
+        with self.assertRaises(OSError) as context:
+            Packer().dump(1, File())
+        self.assertEqual(
+            str(context.exception), "Failed to write 1 bytes to the file"
+        )
+
+    def test_file_descriptor(self):
+        from tempfile import TemporaryFile
+
+        with TemporaryFile() as file:
+            Packer().dump(self.value, file.fileno(), chunk_size=1000)
+            file.seek(0)
+            self.assertEqual(file.read(), packb(self.value))
+
+    def test_bad_arguments(self):
+        with self.assertRaises(ValueError) as context:
+            Packer().dump(1, -1)
+        self.assertEqual(str(context.exception), "Invalid file descriptor")
+        with self.assertRaises(ValueError) as context:
+            Packer().dump(1, 1, chunk_size=10)
+        self.assertEqual(
+            str(context.exception), "`chunk_size` must be at least 64"
+        )
+        with self.assertRaises(AttributeError):
+            Packer().dump(1, None)  # pyright: ignore
+        for file in (True, False):
+            with self.subTest(file=file):
+                with self.assertRaises(TypeError) as context:
+                    Packer().dump(1, file)
+                self.assertEqual(
+                    str(context.exception),
+                    "`file` must be a file descriptor or have `write`",
+                )
+
+    def test_unserializable(self):
+        from io import BytesIO
+
+        with self.assertRaises(TypeError):
+            Packer().dump([1, 1j], BytesIO())  # pyright: ignore
+
+
+@dataclass
+class Point:
+    x: int
+    y: float
+    tags: list[str] = field(default_factory=list)
+
+
+class Pair(NamedTuple):
+    first: Any
+    second: Any
+
+
+class Slotted:
+    __slots__ = ("name", "__secret")
+
+    def __init__(self, name: str, secret: int):
+        self.name = name
+        self.__secret = secret
+
+
+class SlottedChild(Slotted):
+    __slots__ = "extra"
+
+    def __init__(self, name: str, secret: int, extra: Any):
+        super().__init__(name, secret)
+        self.extra = extra
+
+
+class StructsTest(SequenceTestCase):
+    def test_dataclass_map(self):
+        packb = Packer(structs="map").packb
+        self.assertEqual(
+            unpackb(packb(Point(1, 2.5, ["a"]))),
+            {"x": 1, "y": 2.5, "tags": ["a"]},
+        )
+
+    def test_dataclass_array(self):
+        packb = Packer(structs="array").packb
+        self.assertEqual(unpackb(packb(Point(1, 2.5))), [1, 2.5, []])
+
+    def test_named_tuple(self):
+        self.assertEqual(
+            unpackb(Packer(structs="map").packb(Pair(1, "b"))),
+            {"first": 1, "second": "b"},
+        )
+        self.assertEqual(
+            unpackb(Packer(structs="array").packb(Pair(1, "b"))), [1, "b"]
+        )
+
+    def test_slots(self):
+        packb = Packer(structs="map").packb
+        self.assertEqual(
+            unpackb(packb(SlottedChild("a", 2, None))),
+            {"name": "a", "_Slotted__secret": 2, "extra": None},
+        )
+
+    def test_nested(self):
+        packb = Packer(structs="map").packb
+        value = [Pair(Point(1, 2.0), {"k": Slotted("s", 3)})] * 3
+        expected = {
+            "first": {"x": 1, "y": 2.0, "tags": []},
+            "second": {"k": {"name": "s", "_Slotted__secret": 3}},
+        }
+        self.assertEqual(unpackb(packb(value)), [expected] * 3)
+
+    def test_same_bytes_as_dict(self):
+        packb = Packer(structs="map").packb
+        point = Point(1, 2.0, ["a"])
+        self.assertEqual(packb(point), packb(point.__dict__))
+
+    def test_plain_objects_use_default(self):
+        packb = Packer(default=repr, structs="map").packb
+        self.assertEqual(packb([object, 1j]), packb([repr(object), "1j"]))
+        with self.assertRaises(TypeError):
+            Packer(structs="map").packb(1j)
+
+    def test_disabled_by_default(self):
+        with self.assertRaises(TypeError):
+            packb(Point(1, 2.0))
+
+    def test_unset_slot(self):
+        slotted = Slotted.__new__(Slotted)
+        with self.assertRaises(AttributeError):
+            Packer(structs="map").packb([slotted])
+
+    def test_values_are_released(self):
+        from sys import getrefcount
+
+        value = [1, 2]
+        point = Point(1, 2.0, value)
+        before = getrefcount(value)
+        Packer(structs="map").packb([point] * 10)
+        self.assertEqual(getrefcount(value), before)
+        with self.assertRaises(TypeError):
+            Packer(structs="map").packb(Point(1, 2.0, [value, 1j]))
+        self.assertEqual(getrefcount(value), before)
+
+    def test_invalid_structs(self):
+        with self.assertRaises(ValueError) as context:
+            Packer(structs="dict")  # pyright: ignore
+        self.assertEqual(
+            str(context.exception),
+            "`structs` must be 'map', 'array' or None",
+        )
+
+    def test_invalid_structs_with_default(self):
+        from sys import getrefcount
+
+        def default(value: Any) -> Any:
+            return value
+
+        before = getrefcount(default)
+        with self.assertRaises(ValueError):
+            Packer(default=default, structs="dict")  # pyright: ignore
+        self.assertEqual(getrefcount(default), before)
+
+    def test_plans_are_collected(self):
+        from gc import collect
+        from weakref import ref
+
+        @dataclass
+        class Node:
+            value: int
+
+        packer = Packer(structs="map")
+        packer.packb(Node(1))
+        setattr(Node, "packer", packer)  # packer -> plans -> Node -> packer
+        node_type = ref(Node)
+        del Node, packer
+        collect()
+        self.assertIsNone(node_type())
+
+
+class TypedArraysTest(SequenceTestCase):
+    typecodes = "bhHiIlLqQfd"  # "B" is packed as bin
+
+    def test_as_array(self):
+        from array import array
+
+        packb = Packer(typed_arrays="array").packb
+        for typecode in self.typecodes:
+            for length in (0, 1, 17, 5000):
+                values = [(idx * 37) % 127 for idx in range(length)]
+                if typecode in "fd":
+                    values = [value / 4 for value in values]
+                elif typecode not in "BHILQ":
+                    values = [-value for value in values]
+                with self.subTest(typecode=typecode, length=length):
+                    value = array(typecode, values)
+                    expected = packb([float(v) for v in values])
+                    if typecode == "f":
+                        expected = packb(values).replace(b"\xcb", b"\xca")
+                        self.assertEqual(unpackb(packb(value)), values)
+                    elif typecode != "d":
+                        expected = packb(values)
+                    if typecode != "f":
+                        self.assertEqual(packb(value), expected)
+
+    def test_integer_limits(self):
+        from array import array
+
+        packb = Packer(typed_arrays="array").packb
+        values = [-(2**63), -(2**31), -1, 0, 2**63 - 1]
+        self.assertEqual(packb(array("q", values)), packb(values))
+        self.assertEqual(
+            packb(array("Q", [0, 2**64 - 1])),
+            b"\x92\x00\xcf\xff\xff\xff\xff\xff\xff\xff\xff",
+        )
+
+    def test_ext_round_trip(self):
+        from array import array
+
+        packb = Packer(typed_arrays=5).packb
+        unpackb = Unpacker(typed_arrays=5).unpackb
+        for typecode in self.typecodes:
+            for length in (0, 1, 3, 7, 15, 1000):
+                with self.subTest(typecode=typecode, length=length):
+                    value = array(typecode, (i % 100 for i in range(length)))
+                    result = unpackb(packb([value]))
+                    self.assertEqual(result, [value])
+                    self.assertEqual(result[0].itemsize, value.itemsize)
+
+    def test_ext_is_big_endian(self):
+        from array import array
+
+        packed = Packer(typed_arrays=5).packb(array("H", [1, 0x0203]))
+        self.assertEqual(packed, b"\xc7\x05\x05H\x00\x01\x02\x03")
+        ext = unpackb(packed)
+        self.assertEqual(ext, Ext(5, b"H\x00\x01\x02\x03"))
+
+    def test_memoryview(self):
+        from array import array
+
+        packb = Packer(typed_arrays="array").packb
+        view = memoryview(array("d", [1.0, 2.0, 3.0]))
+        self.assertEqual(packb(view), packb([1.0, 2.0, 3.0]))
+        self.assertEqual(packb(memoryview(b"abc")), packb(b"abc"))
+        self.assertEqual(packb(array("B", b"abc")), packb(b"abc"))
+
+    def test_explicit_byte_order(self):
+        import ctypes
+        from array import array
+
+        big_endian = (ctypes.c_double.__ctype_be__ * 3)(1.0, 2.0, 3.0)
+        little_endian = (ctypes.c_int16.__ctype_le__ * 2)(-1, 2)
+        for typed_arrays in ("array", 1):
+            packb = Packer(typed_arrays=typed_arrays).packb
+            with self.subTest(typed_arrays=typed_arrays):
+                self.assertEqual(
+                    packb(big_endian), packb(array("d", [1.0, 2.0, 3.0]))
+                )
+                self.assertEqual(
+                    packb(little_endian), packb(array("h", [-1, 2]))
+                )
+
+    def test_dump_is_chunked(self):
+        from array import array
+        from io import BytesIO
+
+        packer = Packer(typed_arrays=5)
+        value = array("d", range(100000))
+        file = BytesIO()
+        packer.dump(value, file, chunk_size=100)
+        self.assertEqual(file.getvalue(), packer.packb(value))
+
+    def test_non_contiguous(self):
+        view = memoryview(b"abcd")[::2]
+        with self.assertRaises(BufferError):
+            Packer(typed_arrays="array").packb(view)
+        packer = Packer(default=bytes, typed_arrays="array")
+        self.assertEqual(packer.packb(view), packb(b"ac"))
+
+    def test_multi_dimensional(self):
+        view = memoryview(bytes(range(6))).cast("B", (2, 3))
+        with self.assertRaises(TypeError) as context:
+            Packer(typed_arrays="array").packb(view)
+        self.assertEqual(
+            str(context.exception),
+            "Unsupported 'memoryview' object buffer of 2 dimensions",
+        )
+        packer = Packer(default=memoryview.tolist, typed_arrays="array")
+        self.assertEqual(packer.packb(view), packb([[0, 1, 2], [3, 4, 5]]))
+
+    def test_unsupported_format(self):
+        view = memoryview(b"ab").cast("?")
+        with self.assertRaises(TypeError) as context:
+            Packer(typed_arrays="array").packb(view)
+        self.assertEqual(
+            str(context.exception),
+            "Unsupported 'memoryview' object buffer format '?'",
+        )
+        packer = Packer(default=bytes, typed_arrays="array")
+        self.assertEqual(packer.packb(view), packb(b"ab"))
+
+    def test_disabled_by_default(self):
+        from array import array
+
+        with self.assertRaises(TypeError):
+            packb(array("d"))
+
+    def test_invalid_arguments(self):
+        for typed_arrays in ("map", -1, 128, 2**100, 1.0):
+            with self.subTest(typed_arrays=typed_arrays):
+                with self.assertRaises(ValueError):
+                    Packer(typed_arrays=typed_arrays)  # pyright: ignore
+        with self.assertRaises(ValueError) as context:
+            Unpacker(typed_arrays="array")  # pyright: ignore
+        self.assertEqual(
+            str(context.exception),
+            "`typed_arrays` must be Ext code between 0 and 127 or None",
+        )
+
+    def test_invalid_arguments_with_hooks(self):
+        from sys import getrefcount
+
+        def hook(*args: Any) -> Any:
+            return args
+
+        before = getrefcount(hook)
+        with self.assertRaises(ValueError):
+            Packer(default=hook, typed_arrays="map")  # pyright: ignore
+        with self.assertRaises(ValueError):
+            Unpacker(ext_hook=hook, typed_arrays=999)
+        self.assertEqual(getrefcount(hook), before)
+
+    def test_invalid_ext(self):
+        unpackb = Unpacker(typed_arrays=5).unpackb
+        for data in (b"", b"x", b"d\0\0"):
+            with self.subTest(data=data):
+                with self.assertRaises(ValueError) as context:
+                    unpackb(packb(Ext(5, data)))
+                self.assertEqual(
+                    str(context.exception), "Invalid typed array data"
+                )
+        self.assertEqual(unpackb(packb(Ext(6, b"d"))), Ext(6, b"d"))
+
+
+class NumberRunsTest(SequenceTestCase):
+    @staticmethod
+    def expected(values: list[Any]) -> bytes:
+        return b"\xdd" + pack(">I", len(values)) + b"".join(map(packb, values))
+
+    def check(self, values: list[Any]) -> None:
+        values = values + [None] * (0x10000 - len(values))
+        self.assertEqual(packb(values), self.expected(values))
+        self.assertEqual(packb(tuple(values)), self.expected(values))
+
+    def test_runs_in_the_middle(self):
+        self.check(["a", 1.5, 2.5, 3.5, "b", 1, 2, 3, None, 4, 5.5, 6])
+
+    def test_long_runs(self):
+        self.check([float(i) / 3 for i in range(1000)] + list(range(1000)))
+
+    def test_integer_widths(self):
+        values = [0, -1, -32, -33, 127, 128, 255, 256, 65535, 65536]
+        values += [-128, -129, -32768, -32769, 2**31, -(2**31) - 1]
+        values += [2**63 - 1, -(2**63), 4294967295, 4294967296]
+        self.check(values * 30)
+
+    def test_fixint_run(self):
+        self.check([i % 128 for i in range(1000)] + [-32, -1])
+
+    def test_bool_is_not_int(self):
+        self.check([1, True, False, 0, 1])
+
+    def test_overflow_inside_run(self):
+        with self.assertRaises(OverflowError):
+            packb([1, 2, 3, 2**64, 4])
+
+    def test_dump_chunks_are_bounded(self):
+        chunks: list[bytes] = []
+
+        class File:
+            def write(self, data: memoryview) -> None:
+                chunks.append(bytes(data))
+
+        value = [1.5] * 1000 + [2**40] * 1000
+        Packer().dump(value, File(), chunk_size=64)
+        self.assertEqual(b"".join(chunks), packb(value))
+        self.assertLessEqual(max(map(len, chunks)), 64)
+
+
+class SubclassesTest(SequenceTestCase):
+    def test_enums(self):
+        from enum import Enum, IntEnum, IntFlag
+
+        class Color(IntEnum):
+            RED = 1
+            BIG = 300
+
+        class Perm(IntFlag):
+            R = 4
+
+        class Name(str, Enum):
+            A = "a"
+            B = "бэ"
+
+        self.assertEqual(packb(Color.RED), b"\x01")
+        self.assertEqual(packb(Color.BIG), b"\xcd\x01\x2c")
+        self.assertEqual(packb(Perm.R), b"\x04")
+        self.assertEqual(packb(Name.A), b"\xa1a")
+        self.assertEqual(packb(Name.B), packb("бэ"))
+        self.assertEqual(packb({Name.A: Color.RED}), b"\x81\xa1a\x01")
+
+    def test_sequences(self):
+        class List(list[int]):
+            pass
+
+        class Float(float):
+            pass
+
+        self.assertEqual(packb(List([1, 2])), b"\x92\x01\x02")
+        self.assertEqual(packb(Float(1.5)), packb(1.5))
+        self.assertEqual(packb(set([1])), b"\x91\x01")
+        self.assertEqual(packb(frozenset()), b"\x90")
+
+    def test_mappings(self):
+        from collections import Counter, OrderedDict, defaultdict
+        from types import MappingProxyType
+
+        ordered = OrderedDict(a=1, b=2)
+        ordered.move_to_end("a")
+        self.assertEqual(packb(ordered), b"\x82\xa1b\x02\xa1a\x01")
+        self.assertEqual(packb(defaultdict(int, a=1)), b"\x81\xa1a\x01")
+        self.assertEqual(packb(Counter("aab")), b"\x82\xa1a\x02\xa1b\x01")
+        self.assertEqual(packb(MappingProxyType({1: 2})), b"\x81\x01\x02")
+
+    def test_bytes(self):
+        class Bytes(bytes):
+            pass
+
+        self.assertEqual(packb(Bytes(b"xy")), b"\xc4\x02xy")
+
+    def test_default_is_not_called(self):
+        from enum import IntEnum
+
+        class One(IntEnum):
+            ONE = 1
+
+        packb = Packer(default=repr).packb
+        self.assertEqual(packb([One.ONE, {2}]), b"\x92\x01\x91\x02")
+
+    def test_named_tuple_struct(self):
+        self.assertEqual(packb(Pair(1, 2)), b"\x92\x01\x02")
+        packer = Packer(structs="map")
+        self.assertEqual(
+            packer.packb(Pair(1, 2)), b"\x82\xa5first\x01\xa6second\x02"
+        )
+
+    def test_set_iteration_error(self):
+        class Bad(set[int]):
+            def __iter__(self):
+                raise ValueError("no iteration")
+
+        with self.assertRaises(ValueError):
+            packb(Bad())
+
+
+class PackbIovTest(SequenceTestCase):
+    def test_big_payloads_are_referenced(self):
+        blob = b"\x01" * 5000
+        array = bytearray(6000)
+        raw = Raw(packb("x" * 5000))
+        ext = Ext(3, b"y" * 9000)
+        value = [blob, "small", array, raw, ext, b"tail"]
+        iov = Packer().packb_iov(value)
+        self.assertEqual(b"".join(iov), packb(value))
+        self.assertEqual(len(iov), 8)
+        self.assertIs(iov[1], blob)
+        self.assertIs(iov[3], array)
+        self.assertIs(iov[4], raw.data)
+        self.assertIs(iov[6], ext.data)
+
+    def test_small_payloads_are_copied(self):
+        value = {"a": b"x" * 100, "b": Ext(1, b"1234")}
+        self.assertEqual(Packer().packb_iov(value), [packb(value)])
+
+    def test_threshold(self):
+        blob = b"abc"
+        iov = Packer().packb_iov([blob, blob], threshold=3)
+        self.assertEqual(iov, [b"\x92\xc4\x03", blob, b"\xc4\x03", blob])
+        self.assertIs(iov[1], blob)
+        iov = Packer().packb_iov(b"", threshold=0)
+        self.assertEqual(iov, [b"\xc4\x00", b""])
+
+    def test_payload_at_the_end(self):
+        blob = bytes(5000)
+        self.assertEqual(Packer().packb_iov(blob), [b"\xc5\x13\x88", blob])
+
+    def test_big_message(self):
+        value = [b"x" * 10] * 1000 + [bytes(5000)]
+        iov = Packer().packb_iov(value)
+        self.assertEqual(len(iov), 2)
+        self.assertEqual(b"".join(iov), packb(value))
+
+    def test_invalid_threshold(self):
+        with self.assertRaises(ValueError) as context:
+            Packer().packb_iov(1, threshold=-1)
+        self.assertEqual(
+            str(context.exception), "`threshold` must be non-negative"
+        )
+
+    def test_error_after_reference(self):
+        with self.assertRaises(TypeError):
+            Packer().packb_iov([bytes(5000), "x" * 2000, 1j])
+
+    @skipUnless(hasattr(os, "writev"), "os.writev is not available")
+    def test_writev(self):
+        value = {"image": bytes(range(256)) * 40, "id": 1}
+        read_fd, write_fd = os.pipe()
+        try:
+            iov = Packer().packb_iov(value)
+            written = os.writev(write_fd, iov)
+            self.assertEqual(os.read(read_fd, written), packb(value))
+        finally:
+            os.close(read_fd)
+            os.close(write_fd)
+
+
+class PackbWithDigestTest(SequenceTestCase):
+    def test_xxh64_reference(self):
+        packer = Packer()
+        self.assertEqual(
+            packer.packb_with_digest(Raw(b"")), (b"", 0xEF46DB3751D8E999)
+        )
+        self.assertEqual(
+            packer.packb_with_digest(Raw(b"abc")), (b"abc", 0x44BC2CF5AD770999)
+        )
+        text = b"Nobody inspects the spammish repetition"
+        self.assertEqual(
+            packer.packb_with_digest(Raw(text)), (text, 0xFBCEA83C8A378BF1)
+        )
+        self.assertEqual(
+            packer.packb_with_digest(Raw(b"abc"), seed=1),
+            (b"abc", 0xBEA9CA8199328908),
+        )
+
+    def test_structured(self):
+        value = [{"key": idx, "data": b"x" * idx} for idx in range(300)]
+        packer = Packer()
+        for _ in range(2):  # second time with the size hint
+            packed, digest = packer.packb_with_digest(value)
+            self.assertEqual(packed, packb(value))
+            self.assertEqual(digest, 0x1C0E3B9C66865FA)
+
+    def test_big_payloads(self):
+        value = [b"y" * 100000] * 3
+        packed, digest = Packer().packb_with_digest(value, seed=2**64 - 1)
+        self.assertEqual(packed, packb(value))
+        self.assertEqual(digest, 0x61F58CBD180EC13F)
+
+    def test_seed(self):
+        packer = Packer()
+        self.assertNotEqual(
+            packer.packb_with_digest("abc")[1],
+            packer.packb_with_digest("abc", seed=1)[1],
+        )
+        with self.assertRaises(TypeError):
+            packer.packb_with_digest("abc", 1)
+
+    def test_error(self):
+        with self.assertRaises(TypeError):
+            Packer().packb_with_digest([b"x" * 20000, 1j])
+
+
+class PackedSizeTest(SequenceTestCase):
+    values: list[Any] = [
+        None,
+        "",
+        "ascii",
+        "ünïcode" * 1000,
+        "😀" * 300,
+        b"x" * 100000,
+        bytearray(70000),
+        [1.5, 2**40, -3, True] * 100,
+        {"key": [{"nested": idx} for idx in range(1000)]},
+        Ext(5, b"ext" * 30000),
+        Raw(packb(list(range(3000)))),
+        {1, 2, 3},
+    ]
+
+    def test_equals_packb(self):
+        packer = Packer()
+        for value in self.values:
+            with self.subTest(value=type(value)):
+                self.assertEqual(packer.packed_size(value), len(packb(value)))
+
+    def test_max_size(self):
+        packer = Packer()
+        value = [b"x" * 1000] * 100
+        size = len(packb(value))
+        self.assertEqual(packer.packed_size(value, max_size=size), size)
+        for max_size in (0, 1000, size - 1):
+            with self.subTest(max_size=max_size):
+                with self.assertRaises(ValueError) as context:
+                    packer.packed_size(value, max_size=max_size)
+                self.assertEqual(
+                    str(context.exception), "Packed size exceeds `max_size`"
+                )
+        with self.assertRaises(ValueError):
+            packer.packed_size(value, max_size=-1)
+
+    def test_max_size_stops_early(self):
+        calls: list[int] = []
+
+        def default(value: object) -> str:
+            calls.append(1)
+            return "x" * 100
+
+        value = [object() for _ in range(1000)]
+        with self.assertRaises(ValueError):
+            Packer(default=default).packed_size(value, max_size=2000)
+        self.assertLess(len(calls), 100)
+
+    def test_error(self):
+        with self.assertRaises(TypeError):
+            Packer().packed_size([b"x" * 5000, 1j])
+
+    def test_presize(self):
+        packer = Packer(presize=True)
+        for value in self.values:
+            with self.subTest(value=type(value)):
+                self.assertEqual(packer.packb(value), packb(value))
+
+    def test_presize_default_grows(self):
+        sizes = iter([10, 10000])
+
+        def default(value: object) -> bytes:
+            return bytes(next(sizes))
+
+        packer = Packer(default=default, presize=True)
+        self.assertEqual(
+            packer.packb([b"x" * 2000, 1j]),
+            packb([b"x" * 2000, bytes(10000)]),
+        )
+
+
+class CompactFloatsTest(SequenceTestCase):
+    def test_float32(self):
+        packb = Packer(compact_floats=True).packb
+        self.assertEqual(packb(1.0), b"\xca?\x80\x00\x00")
+        self.assertEqual(packb(-0.0), b"\xca\x80\x00\x00\x00")
+        self.assertEqual(packb(0.1), b"\xcb?\xb9\x99\x99\x99\x99\x99\x9a")
+        self.assertEqual(packb(1e39), pack(">Bd", 0xCB, 1e39))
+        self.assertEqual(packb(float("inf")), b"\xcb\x7f\xf0" + bytes(6))
+        self.assertEqual(packb(3.4028234663852886e38), b"\xca\x7f\x7f\xff\xff")
+
+    def test_int(self):
+        packb = Packer(compact_floats="int").packb
+        self.assertEqual(packb(1.0), b"\x01")
+        self.assertEqual(packb(-0.0), b"\xca\x80\x00\x00\x00")
+        self.assertEqual(packb(0.5), b"\xca?\x00\x00\x00")
+        self.assertEqual(packb(-(2.0**31)), b"\xd2\x80\x00\x00\x00")
+        self.assertEqual(packb(2.0**32 - 1), b"\xce\xff\xff\xff\xff")
+        self.assertEqual(packb(2.0**32), b"\xcaO\x80\x00\x00")
+        self.assertEqual(unpackb(packb([2.0, 2.5])), [2, 2.5])
+
+    def test_disabled(self):
+        self.assertEqual(Packer(compact_floats=False).packb(1.0), packb(1.0))
+
+    def test_runs(self):
+        specials = [0.0, -0.0, 1.0, 0.5, 0.1, 2.0**32, 1e39, float("inf")]
+        values = [specials[idx * 7 % 8] for idx in range(1000)]
+        for compact_floats in (True, "int"):
+            packer = Packer(compact_floats=compact_floats)
+            for run in (values, values[:300] + [0.25] * 700, [0.1] * 300):
+                with self.subTest(compact_floats=compact_floats):
+                    expected = b"\xdc" + pack(">H", len(run))
+                    expected += b"".join(packer.packb(v) for v in run)
+                    self.assertEqual(packer.packb(run), expected)
+                    self.assertEqual(unpackb(packer.packb(run)), run)
+
+    def test_nan(self):
+        packed = Packer(compact_floats=True).packb([float("nan")] * 10)
+        self.assertEqual(len(packed), 91)
+
+    def test_invalid(self):
+        with self.assertRaises(ValueError) as context:
+            Packer(compact_floats="float32")  # type: ignore[arg-type]
+        self.assertEqual(
+            str(context.exception),
+            "`compact_floats` must be True, False or 'int'",
+        )
+
+    def test_invalid_with_default(self):
+        from sys import getrefcount
+
+        def default(value: Any) -> Any:
+            return value
+
+        class Bad:
+            def __bool__(self) -> bool:
+                raise TypeError("bool")
+
+        before = getrefcount(default)
+        for compact_floats in ("x", Bad()):
+            with self.subTest(compact_floats=compact_floats):
+                with self.assertRaises((ValueError, TypeError)):
+                    Packer(
+                        default=default,
+                        compact_floats=compact_floats,  # type: ignore
+                    )
+        self.assertEqual(getrefcount(default), before)
+
+
+class CompileTest(SequenceTestCase):
+    def test_message(self):
+        from datetime import datetime, timezone
+
+        compiled = Packer().compile(
+            {"id": int, "ts": datetime, "vals": [float] * 8, "tag": str}
+        )
+        self.assertEqual(compiled.length, 11)
+        ts = datetime(2024, 1, 1, tzinfo=timezone.utc)
+        vals = [idx / 3 for idx in range(8)]
+        self.assertEqual(
+            compiled.pack(1, ts, *vals, "tag"),
+            packb({"id": 1, "ts": ts, "vals": vals, "tag": "tag"}),
+        )
+
+    def test_constants(self):
+        compiled = Packer().compile(
+            ("v1", {1: bytes, None: [bool, 2.5]}, Raw(b"\xc0"), Ext(1, b"e"))
+        )
+        self.assertEqual(
+            compiled.pack(b"data", True),
+            packb(
+                ["v1", {1: b"data", None: [True, 2.5]}, None, Ext(1, b"e")]
+            ),
+        )
+
+    def test_fallback(self):
+        compiled = Packer().compile([int, float, str, bytes, bool, int])
+        values = [True, 1, "ünïcode", bytearray(b"x"), 0, 1.5]
+        self.assertEqual(compiled.pack(*values), packb(values))
+        values = [None] * 6
+        self.assertEqual(compiled.pack(*values), packb(values))
+
+    def test_lengths(self):
+        compiled = Packer().compile([str, bytes, [int] * 20])
+        for length in (0, 15, 16, 255, 256, 65535, 65536):
+            values = ["s" * length, b"b" * length, *range(20)]
+            with self.subTest(length=length):
+                self.assertEqual(
+                    compiled.pack(*values),
+                    packb([values[0], values[1], values[2:]]),
+                )
+
+    def test_big_map(self):
+        template = {f"key{idx}": int for idx in range(70000)}
+        compiled = Packer().compile(template)
+        values = list(range(70000))
+        self.assertEqual(
+            compiled.pack(*values), packb(dict(zip(template, values)))
+        )
+
+    def test_options(self):
+        def default(value: object) -> str:
+            return "default"
+
+        packer = Packer(default=default, compact_floats=True)
+        compiled = packer.compile({"a": float, "b": object, "c": complex})
+        self.assertEqual(
+            compiled.pack(1.0, 1j, 2j),
+            packer.packb({"a": 1.0, "b": 1j, "c": 2j}),
+        )
+
+    def test_errors(self):
+        compiled = Packer().compile([int, str])
+        with self.assertRaises(TypeError) as context:
+            compiled.pack(1)
+        self.assertEqual(
+            str(context.exception), "pack() takes 2 values (1 given)"
+        )
+        with self.assertRaises(TypeError):
+            compiled.pack(1, 1j)
+        with self.assertRaises(TypeError):
+            Packer().compile({"a": 1j})
+        with self.assertRaises(TypeError):
+            CompiledPacker()  # type: ignore[misc]
+
+    def test_recursion(self):
+        template: list[Any] = [int]
+        for _ in range(100000):
+            template = [template]
+        with self.assertRaises(RecursionError):
+            Packer().compile(template)
+
+    def test_cycle_is_collected(self):
+        from gc import collect
+        from weakref import ref
+
+        class Owner:
+            def default(self, value: Any) -> Any:
+                return repr(value)
+
+        owner = Owner()
+        # owner -> template -> packer -> bound `default` -> owner
+        packer = Packer(default=owner.default)
+        setattr(owner, "template", packer.compile([int]))
+        owner_ref = ref(owner)
+        del owner, packer
+        collect()
+        self.assertIsNone(owner_ref())
@@ -1,9 +1,13 @@
-from amsgpack import packb, Unpacker, Ext, unpackb
+from amsgpack import packb, Unpacker, Ext, unpackb, FileUnpacker
+from amsgpack import LazyMap, LazyArray, extract, scan, validate
+from collections.abc import Mapping, Sequence
 from typing import TypeAlias, cast
 from .failing_malloc import failing_malloc, AVAILABLE as FAILING_AVAILABLE
 from .test_amsgpack import SequenceTestCase
 from unittest import skipUnless
 from datetime import datetime, timezone
+from array import array
+from io import BytesIO
 
 RecursiveDict: TypeAlias = "dict[int, RecursiveDict | None]"
 
@@ -11,10 +15,10 @@ RecursiveDict: TypeAlias = "dict[int, RecursiveDict | None]"
 class UnpackerTest(SequenceTestCase):
     def test_unpacker_gets_no_argumens(self):
         with self.assertRaises(TypeError) as context:
-            Unpacker("what", "is", "that")  # pyright: ignore [reportCallIssue]
+            Unpacker(*"what is that?")  # pyright: ignore
         self.assertEqual(
             str(context.exception),
-            "Unpacker() takes at most 2 arguments (3 given)",
+            "Unpacker() takes at most 11 arguments (13 given)",
         )
         with self.assertRaises(TypeError) as context:
             Unpacker(what="is that")  # pyright: ignore [reportCallIssue]
@@ -34,9 +38,33 @@ class UnpackerTest(SequenceTestCase):
         with self.assertRaises(TypeError) as context:
             u.feed("")  # pyright: ignore [reportArgumentType]
         self.assertEqual(
-            str(context.exception), "a bytes object is required, not 'str'"
+            str(context.exception),
+            "a bytes-like object is required, not 'str'",
         )
 
+    def test_feed_buffers(self):
+        u = Unpacker()
+        u.feed(bytearray(b"\x92\xc4\x03ab"))
+        u.feed(memoryview(b"c\x01\xcd\x01"))
+        u.feed(array("B", b"\x00"))
+        self.safeSequenceEqual(u, ([b"abc", 1], 256))
+
+    def test_feed_keeps_export(self):
+        u = Unpacker()
+        data = bytearray(b"\xc4\x02a")
+        u.feed(data)
+        with self.assertRaises(BufferError):
+            data.extend(b"b")
+        u.feed(b"b")
+        self.assertEqual(next(u), b"ab")
+        data.extend(b"b")
+
+    def test_size_split_between_feeds(self):
+        u = Unpacker()
+        u.feed(b"\xc5\x01")
+        u.feed(b"\x00" + b"a" * 256)
+        self.assertEqual(next(u), b"a" * 256)
+
     def test_unpack_none(self):
         u = Unpacker()
         u.feed(b"\xc0")
@@ -205,6 +233,12 @@ class UnpackbTest(SequenceTestCase):
         one = unpackb(memoryview(b"\x01"))
         self.assertEqual(one, 1)
 
+    def test_buffers(self):
+        data = packb({"a": [1, 2.5, b"bin"]})
+        for buffer in (bytearray(data), memoryview(data), array("B", data)):
+            self.assertEqual(unpackb(buffer), {"a": [1, 2.5, b"bin"]})
+        self.assertEqual(unpackb(memoryview(data + b"\x01")[:-1])["a"][0], 1)
+
     def test_invalid_args(self):
         with self.assertRaises(TypeError) as context:
             unpackb(b"\xcc", 1)  # pyright: ignore [reportCallIssue]
@@ -221,7 +255,7 @@ class UnpackbTest(SequenceTestCase):
             unpackb("\xcc")  # pyright: ignore [reportArgumentType]
         self.assertEqual(
             str(context.exception),
-            "unpackb() argument 1 must be bytes, not str",
+            "unpackb() argument 1 must be bytes-like object, not str",
         )
 
     def test_extra_data(self):
@@ -236,6 +270,32 @@ class UnpackbTest(SequenceTestCase):
             str(context.exception), "Incomplete MessagePack format"
         )
 
+    def test_ext_hook_is_kept(self):
+        unpacker = Unpacker(ext_hook=lambda ext: ext.code)
+        data = packb(Ext(5, b"x"))
+        self.assertEqual(unpacker.unpackb(data), 5)
+        self.assertEqual(unpacker.unpackb(data), 5)
+
+    def test_reentrant(self):
+        def ext_hook(ext: Ext):
+            return unpacker.unpackb(ext.data)
+
+        unpacker = Unpacker(ext_hook=ext_hook)
+        inner = packb({"key": [1, 2]})
+        self.assertEqual(
+            unpacker.unpackb(packb([Ext(1, inner), "key"])),
+            [{"key": [1, 2]}, "key"],
+        )
+
+    def test_threads(self):
+        from concurrent.futures import ThreadPoolExecutor
+
+        value = [{f"key{idx}": idx, "same": [idx]} for idx in range(300)]
+        data = packb(value)
+        with ThreadPoolExecutor(4) as executor:
+            results = list(executor.map(unpackb, [data] * 40))
+        self.assertEqual(results, [value] * 40)
+
 
 class UnpackbIntTest(SequenceTestCase):
     def test_uint_8_only_ont_byte_is_available(self):
@@ -397,6 +457,32 @@ class UnpackbStrTest(SequenceTestCase):
         u.feed(b"\xdb\x00\x00\x00\x00")
         self.safeSequenceEqual(u, ("",) * 4)
 
+    def test_str_kinds(self):
+        # ASCII, Latin-1, BMP and astral characters around block sizes
+        for char in ("a", "\xe9", "\xff", "\u0100", "\u20ac", "\U0001f600"):
+            for length in (1, 15, 16, 17, 31, 32, 33, 100):
+                for prefix in ("", "ascii prefix " * 3):
+                    value = prefix + char * length + "."
+                    with self.subTest(char=char, length=length):
+                        self.assertEqual(unpackb(packb(value)), value)
+
+    def test_invalid_utf8(self):
+        for data in (
+            b"a" * 20 + b"\xc3",  # truncated
+            b"a" * 20 + b"\xc0\xaf",  # overlong
+            b"a" * 20 + b"\xed\xa0\x80",  # surrogate
+            b"a" * 20 + b"\xf4\x90\x80\x80",  # above U+10FFFF
+            b"\x80" + b"a" * 20,  # continuation byte first
+        ):
+            with self.subTest(data=data):
+                with self.assertRaises(UnicodeDecodeError) as context:
+                    unpackb(b"\xd9" + bytes((len(data),)) + data)
+                with self.assertRaises(UnicodeDecodeError) as expected:
+                    data.decode()
+                self.assertEqual(
+                    str(context.exception), str(expected.exception)
+                )
+
     def test_str_not_ready(self):
         u = Unpacker()
         u.feed(b"\xd9\x01")
@@ -440,3 +526,511 @@ class UnpackDateTimeTest(SequenceTestCase):
             unpackb(b"\xd7\xff\x00\x00\x00\x00\x1c9\xdfp"),
             datetime(1985, 1, 2, 23, 0, 0, tzinfo=timezone.utc),
         )
+
+
+class BinTypeTest(SequenceTestCase):
+    def test_default_is_bytes(self):
+        self.assertIs(type(Unpacker().unpackb(b"\xc4\x02ab")), bytes)
+
+    def test_memoryview(self):
+        data = b"\x92\xc4\x02ab\xc4\x00"
+        value = Unpacker(bin_type="memoryview").unpackb(data)
+        self.assertEqual(value, [b"ab", b""])
+        for item in value:
+            self.assertIsInstance(item, memoryview)
+            self.assertTrue(item.readonly)
+        self.assertIs(value[0].obj, data)
+
+    def test_keeps_source_alive(self):
+        u = Unpacker(bin_type="memoryview")
+        u.feed(bytes(b"\xc4\x03abc\xc0"))
+        view = next(u)
+        self.assertEqual(list(u), [None])
+        self.assertEqual(view.tobytes(), b"abc")
+
+    def test_split_payload_is_copied(self):
+        u = Unpacker(bin_type="memoryview")
+        u.feed(b"\xc4\x04ab")
+        u.feed(b"cd")
+        (view,) = list(u)
+        self.assertIsInstance(view, memoryview)
+        self.assertEqual(view, b"abcd")
+
+    def test_whole_fed_bytes_are_not_copied(self):
+        blob = bytes(range(200))
+        for bin_type in ("bytes", "memoryview"):
+            u = Unpacker(bin_type=bin_type)
+            u.feed(b"\xc4\xc8")
+            u.feed(blob)
+            (value,) = list(u)
+            if bin_type == "bytes":
+                self.assertIs(value, blob)
+            else:
+                self.assertIs(value.obj, blob)
+
+    def test_writable_source(self):
+        data = array("b", b"\xc4\x02ab")
+        view = Unpacker(bin_type="memoryview").unpackb(data)
+        self.assertTrue(view.readonly)
+        self.assertEqual(view.format, "B")
+        self.assertEqual(view, b"ab")
+
+    def test_ext_data(self):
+        ext = Unpacker(bin_type="memoryview").unpackb(b"\xd5\x01ab")
+        self.assertIsInstance(ext, Ext)
+        self.assertIsInstance(ext.data, memoryview)
+        self.assertEqual(ext, Ext(1, b"ab"))
+        self.assertEqual(packb(ext), b"\xd5\x01ab")
+
+    def test_invalid_bin_type(self):
+        with self.assertRaises(ValueError) as context:
+            Unpacker(bin_type="bytearray")  # type: ignore[arg-type]
+        self.assertEqual(
+            str(context.exception),
+            "`bin_type` must be 'bytes' or 'memoryview'",
+        )
+
+    def test_invalid_bin_type_with_ext_hook(self):
+        from sys import getrefcount
+
+        def ext_hook(ext: Ext) -> object:
+            return ext
+
+        before = getrefcount(ext_hook)
+        with self.assertRaises(ValueError):
+            Unpacker(ext_hook=ext_hook, bin_type="bad")  # type: ignore
+        with self.assertRaises(ValueError):
+            FileUnpacker(
+                BytesIO(), ext_hook=ext_hook, bin_type="bad"  # type: ignore
+            )
+        self.assertEqual(getrefcount(ext_hook), before)
+
+
+class KeyCacheTest(SequenceTestCase):
+    long_key = "request_correlation_id"
+
+    def test_shared_cache_info(self):
+        info = Unpacker().cache_info()
+        self.assertEqual(
+            (info["size"], info["ways"], info["key_length"], info["pinned"]),
+            (512, 1, 16, 0),
+        )
+
+    def test_long_keys(self):
+        # two ways, the hash is seeded and the keys may share a set
+        u = Unpacker(cache_ways=2, cache_key_length=255)
+        key = "k" * 200
+        data = packb({self.long_key: 1, key: 2})
+        first, second = u.unpackb(data), u.unpackb(data)
+        self.assertEqual(first, {self.long_key: 1, key: 2})
+        for a, b in zip(first, second):
+            self.assertIs(a, b)
+        info = u.cache_info()
+        self.assertEqual((info["hits"], info["misses"]), (2, 2))
+
+    def test_lru(self):
+        u = Unpacker(cache_size=2, cache_ways=2)
+        for key in "abaca":
+            u.unpackb(packb({key: None}))
+        info = u.cache_info()
+        self.assertEqual(
+            (info["hits"], info["misses"], info["evictions"]), (2, 3, 1)
+        )
+
+    def test_pinned_keys(self):
+        key = "".join(["request_", "correlation_id"])
+        u = Unpacker(
+            cache_size=4, cache_ways=4, cache_key_length=32, keys=[key]
+        )
+        for idx in range(100):
+            u.unpackb(packb({f"key{idx}": idx}))
+        (unpacked,) = u.unpackb(packb({self.long_key: 1}))
+        self.assertIs(unpacked, key)
+        info = u.cache_info()
+        self.assertEqual(info["pinned"], 1)
+        self.assertEqual(info["evictions"], 97)
+
+    def test_file_unpacker(self):
+        data = packb({self.long_key: 1}) * 3
+        u = FileUnpacker(BytesIO(data), cache_ways=2, cache_key_length=32)
+        self.assertEqual(list(u), [{self.long_key: 1}] * 3)
+
+    def test_invalid_options(self):
+        from sys import getrefcount
+
+        def ext_hook(ext: Ext) -> object:
+            return ext
+
+        before = getrefcount(ext_hook)
+        for options, message in (
+            ({"cache_ways": 3}, "`cache_ways` must be 1, 2 or 4"),
+            (
+                {"cache_size": 3},
+                "`cache_size` must be a power of two from `cache_ways` "
+                "to 1048576",
+            ),
+            (
+                {"cache_size": 2, "cache_ways": 4},
+                "`cache_size` must be a power of two from `cache_ways` "
+                "to 1048576",
+            ),
+            (
+                {"cache_key_length": 256},
+                "`cache_key_length` must be from 1 to 255",
+            ),
+            (
+                {"keys": ["k" * 17]},
+                "`keys` item of 17 bytes is longer than "
+                "`cache_key_length` (16)",
+            ),
+        ):
+            with self.subTest(options=options):
+                with self.assertRaises(ValueError) as context:
+                    Unpacker(**options)  # pyright: ignore
+                self.assertEqual(str(context.exception), message)
+                with self.assertRaises(ValueError):
+                    Unpacker(ext_hook=ext_hook, **options)  # pyright: ignore
+                with self.assertRaises(ValueError):
+                    FileUnpacker(
+                        BytesIO(), ext_hook=ext_hook, **options  # type: ignore
+                    )
+        self.assertEqual(getrefcount(ext_hook), before)
+        with self.assertRaises(TypeError) as context:
+            Unpacker(keys=[b"key"])  # type: ignore[list-item]
+        self.assertEqual(
+            str(context.exception), "`keys` items must be str, not bytes"
+        )
+
+
+class ValueCacheTest(SequenceTestCase):
+    def test_disabled_by_default(self):
+        u = Unpacker()
+        self.assertIsNone(u.value_cache_info())
+        first, second = u.unpackb(packb(["ok", "ok"]))
+        self.assertIsNot(first, second)
+
+    def test_second_sighting(self):
+        u = Unpacker(cache_values=True)
+        first, second, third = u.unpackb(packb(["ok", "ok", "ok"]))
+        self.assertIsNot(first, second)
+        self.assertIs(second, third)
+        info = u.value_cache_info()
+        assert info is not None
+        self.assertEqual(
+            (info["size"], info["ways"], info["key_length"]), (1024, 2, 32)
+        )
+        self.assertEqual((info["hits"], info["misses"]), (1, 2))
+
+    def test_shared_between_calls_and_maps(self):
+        u = Unpacker(cache_values=True)
+        data = packb({"status": "DELIVERED", "country": "FR"})
+        values = [tuple(u.unpackb(data).values()) for _ in range(3)]
+        self.assertEqual(values[0], ("DELIVERED", "FR"))
+        self.assertIs(values[1][0], values[2][0])
+        self.assertIs(values[1][1], values[2][1])
+
+    def test_long_values(self):
+        u = Unpacker(cache_values=True)
+        value = "v" * 33
+        self.assertEqual(u.unpackb(packb([value] * 3)), [value] * 3)
+        info = u.value_cache_info()
+        assert info is not None
+        self.assertEqual((info["hits"], info["misses"]), (0, 0))
+
+
+class LazyTest(SequenceTestCase):
+    value = {
+        "id": 7,
+        "tags": ["a", "b", {"deep": [1.5, None]}],
+        "blob": b"\x00\x01",
+        "ext": Ext(5, b"x"),
+        "name": "n" * 40,
+        3: True,
+    }
+
+    def test_map(self):
+        u = Unpacker(lazy=True)
+        lazy = u.unpackb(packb(self.value))
+        self.assertIsInstance(lazy, LazyMap)
+        self.assertIsInstance(lazy, Mapping)
+        self.assertEqual(len(lazy), 6)
+        self.assertEqual(lazy["id"], 7)
+        self.assertEqual(lazy[3], True)
+        self.assertIn("blob", lazy)
+        self.assertNotIn("missing", lazy)
+        self.assertEqual(lazy.get("missing", 1), 1)
+        self.assertIsNone(lazy.get("missing"))
+        self.assertEqual(lazy.get("blob"), b"\x00\x01")
+        with self.assertRaises(KeyError):
+            lazy["missing"]
+        self.assertEqual(list(lazy), list(self.value))
+        self.assertEqual(lazy.keys(), list(self.value))
+        self.assertEqual(lazy.values()[:3], list(self.value.values())[:3])
+        self.assertEqual(dict(lazy.items())["ext"], Ext(5, b"x"))
+        self.assertEqual(lazy, self.value)
+        self.assertEqual(lazy.materialize(), self.value)
+        self.assertEqual(repr(lazy), "<amsgpack.LazyMap of 6 pairs>")
+
+    def test_nested_and_memoized(self):
+        lazy = Unpacker(lazy=True).unpackb(packb(self.value))
+        tags = lazy["tags"]
+        self.assertIsInstance(tags, LazyArray)
+        self.assertIsInstance(tags, Sequence)
+        self.assertIs(lazy["tags"], tags)
+        self.assertIs(lazy["name"], lazy["name"])
+        self.assertEqual(len(tags), 3)
+        self.assertEqual(tags[-1]["deep"][0], 1.5)
+        self.assertEqual(tags[0:2], ["a", "b"])
+        self.assertEqual(tags[::-2][0], tags[2])
+        self.assertEqual(list(tags)[:2], ["a", "b"])
+        self.assertEqual(tags, ["a", "b", {"deep": [1.5, None]}])
+        self.assertEqual(tags.materialize(), self.value["tags"])
+        self.assertEqual(repr(tags), "<amsgpack.LazyArray of 3 items>")
+        with self.assertRaises(IndexError):
+            tags[3]
+        with self.assertRaises(TypeError):
+            tags["a"]
+        with self.assertRaises(TypeError):
+            hash(tags)
+
+    def test_options(self):
+        u = Unpacker(lazy=True, tuple=True, ext_hook=lambda ext: ext.code)
+        lazy = u.unpackb(memoryview(packb([[1, 2], Ext(3, b""), [4]])))
+        self.assertEqual(lazy[0][:], (1, 2))
+        self.assertEqual(lazy[1], 3)
+        self.assertEqual(lazy.materialize(), ((1, 2), 3, (4,)))
+        other = Unpacker(lazy=True, tuple=True).unpackb(packb([[1, 2], 3]))
+        self.assertNotEqual(lazy, other)
+        self.assertEqual(lazy[:2], other.materialize())
+
+    def test_repeated_keys(self):
+        data = b"\x82\xa1a\x01\xa1a\x02"
+        lazy = Unpacker(lazy=True).unpackb(data)
+        self.assertEqual(len(lazy), 1)
+        self.assertEqual(repr(lazy), "<amsgpack.LazyMap of 1 pairs>")
+        self.assertEqual(lazy["a"], 2)
+        self.assertEqual(lazy, unpackb(data))
+
+    def test_cycle_is_collected(self):
+        from gc import collect
+        from weakref import ref
+
+        class Owner:
+            def ext_hook(self, ext: Ext) -> object:
+                return self
+
+        for lazy_type in (LazyMap, LazyArray):
+            with self.subTest(lazy_type=lazy_type):
+                owner = Owner()
+                unpacker = Unpacker(lazy=True, ext_hook=owner.ext_hook)
+                data = packb([Ext(1, b"")] if lazy_type is LazyArray else {})
+                # owner -> lazy -> unpacker -> bound `ext_hook` -> owner
+                setattr(owner, "lazy", unpacker.unpackb(data))
+                if lazy_type is LazyArray:
+                    self.assertIs(getattr(owner, "lazy")[0], owner)
+                owner_ref = ref(owner)
+                del owner, unpacker
+                collect()
+                self.assertIsNone(owner_ref())
+
+    def test_not_containers(self):
+        u = Unpacker(lazy=True)
+        for value in (1, "str", None, b"bin"):
+            self.assertEqual(u.unpackb(packb(value)), value)
+        self.assertEqual(u.unpackb(b"\x80"), {})
+        self.assertEqual(u.unpackb(b"\x90"), [])
+
+    def test_invalid(self):
+        u = Unpacker(lazy=True)
+        for data, message in (
+            (b"\x92\x01", "Incomplete MessagePack format"),
+            (b"\xdc\x00", "Incomplete MessagePack format"),
+            (b"\x91\xc1", "amsgpack: 0xc1 byte must not be used"),
+            (b"\x91\x01\x01", "Extra data"),
+        ):
+            with self.subTest(data=data):
+                with self.assertRaises(ValueError) as context:
+                    u.unpackb(data)
+                self.assertEqual(str(context.exception), message)
+        lazy = u.unpackb(b"\x81\x91\x01\x01")
+        with self.assertRaises(TypeError):
+            len(lazy)
+        with self.assertRaises(TypeError):
+            repr(lazy)
+
+
+class ExtractTest(SequenceTestCase):
+    message = packb(
+        {
+            "user": {"id": 7, "name": "ann"},
+            "items": [{"sku": "A1"}, {"sku": "B2"}],
+            "payload": b"x" * 1000,
+            1: "one",
+            "é": "unicode",
+        }
+    )
+
+    def test_paths(self):
+        self.assertEqual(
+            extract(
+                self.message,
+                [
+                    ("user", "id"),
+                    ["items", 0, "sku"],
+                    ("items", -1, "sku"),
+                    (1,),
+                    ("é",),
+                    ("user",),
+                ],
+            ),
+            (7, "A1", "B2", "one", "unicode", {"id": 7, "name": "ann"}),
+        )
+        self.assertEqual(extract(b"\x01", [()]), (1,))
+        self.assertEqual(extract(b"\x01", []), ())
+
+    def test_missing(self):
+        paths = [
+            ("missing",),
+            ("user", "id", "deeper"),
+            ("items", 2),
+            ("items", "sku"),
+            ("user", 1),
+            (2,),
+        ]
+        self.assertEqual(extract(self.message, paths), (None,) * 6)
+        self.assertEqual(
+            extract(self.message, paths[:1], default=...), (...,)
+        )
+
+    def test_options_and_buffers(self):
+        u = Unpacker(tuple=True, bin_type="memoryview")
+        items, payload = u.extract(
+            bytearray(self.message), [("items",), ("payload",)]
+        )
+        self.assertEqual(items, ({"sku": "A1"}, {"sku": "B2"}))
+        self.assertIsInstance(payload, memoryview)
+        self.assertEqual(payload, b"x" * 1000)
+
+    def test_last_key_wins(self):
+        data = b"\x82\xa1a\x01\xa1a\x02"
+        self.assertEqual(extract(data, [("a",)]), (unpackb(data)["a"],))
+        self.assertEqual(extract(data, [("a",)]), (2,))
+
+    def test_errors(self):
+        for data, message in (
+            (b"", "Incomplete MessagePack format"),
+            (b"\x82\xa1a\x01", "Incomplete MessagePack format"),
+            (b"\x81\xc1\x01", "amsgpack: 0xc1 byte must not be used"),
+            (b"\xdc\x00", "Incomplete MessagePack format"),
+        ):
+            with self.subTest(data=data):
+                with self.assertRaises(ValueError) as context:
+                    extract(data, [("b",)])
+                self.assertEqual(str(context.exception), message)
+        with self.assertRaises(TypeError):
+            extract(self.message, ["user"])
+        with self.assertRaises(TypeError):
+            extract("str", [()])
+
+
+class ScanTest(SequenceTestCase):
+    messages = [
+        packb(value)
+        for value in (
+            1,
+            "str",
+            [1, -2, None, True, False] * 20,
+            {"a": [1.5, b"bin", Ext(1, b"x")]},
+            [],
+            {},
+            [[[[]]]],
+        )
+    ]
+
+    def nested(self, depth: int) -> bytes:
+        return b"\x91" * (depth - 1) + b"\x90"
+
+    def test_scan(self):
+        data = b"".join(self.messages)
+        ends: list[int] = []
+        for message in self.messages:
+            ends.append((ends[-1] if ends else 0) + len(message))
+        self.assertEqual(scan(data), ends)
+        self.assertEqual(scan(bytearray(data) + b"\x92\x01"), ends)
+        self.assertEqual(scan(memoryview(data)[: ends[1]]), ends[:2])
+        self.assertEqual(scan(b""), [])
+        self.assertEqual(validate(data), len(self.messages))
+        self.assertEqual(validate(b""), 0)
+
+    def test_large(self):
+        data = packb(list(range(-32, 128)) * 1000) * 4
+        self.assertEqual(len(scan(data)), 4)
+        self.assertEqual(validate(data), 4)
+
+    def test_errors(self):
+        for data, message in (
+            (b"\x92\x01", "Incomplete MessagePack format"),
+            (b"\x01\xdc\x00", "Incomplete MessagePack format"),
+            (b"\x93\x01\x02\xc1", "amsgpack: 0xc1 byte must not be used"),
+            (self.nested(33), "Deeply nested object"),
+        ):
+            with self.subTest(data=data):
+                with self.assertRaises(ValueError) as context:
+                    validate(data)
+                self.assertEqual(str(context.exception), message)
+        with self.assertRaises(ValueError) as context:
+            unpackb(self.nested(33))
+        self.assertEqual(str(context.exception), "Deeply nested object")
+        self.assertEqual(validate(self.nested(32)), 1)
+        self.assertEqual(validate(self.nested(2), max_depth=2), 1)
+        with self.assertRaises(ValueError):
+            scan(self.nested(3), max_depth=2)
+        with self.assertRaises(ValueError):
+            scan(b"", max_depth=33)
+        with self.assertRaises(TypeError):
+            scan("str")  # type: ignore[arg-type]
+
+    def test_skip(self):
+        u = Unpacker()
+        u.feed(b"".join(self.messages[:3]))
+        self.assertEqual(u.skip(2), 2)
+        self.assertEqual(next(u), [1, -2, None, True, False] * 20)
+        self.assertEqual(u.skip(), 0)
+        message = self.messages[3]
+        u.feed(message[:3])
+        self.assertEqual(u.skip(), 0)
+        u.feed(message[3:5])
+        u.feed(message[5:] + b"\x05")
+        self.assertEqual(u.skip(), 1)
+        self.assertEqual(list(u), [5])
+        u.feed(b"\x92\x01")
+        self.assertEqual(list(u), [])
+        with self.assertRaises(ValueError):
+            u.skip()
+        u.reset()
+        u.feed(b"\xc1")
+        with self.assertRaises(ValueError):
+            u.skip()
+
+    def test_raw(self):
+        u = Unpacker(raw=True)
+        for message in self.messages:
+            u.feed(message)
+        self.assertEqual(list(u), self.messages)
+        whole = packb([1, 2])
+        u.feed(whole)
+        self.assertIs(next(u), whole)
+        data = b"".join(self.messages)
+        for idx in range(0, len(data), 3):
+            u.feed(data[idx : idx + 3])
+        self.assertEqual(list(u), self.messages)
+        self.assertEqual(u.unpackb(b"\x91\x01"), b"\x91\x01")
+        u.feed(b"\xc1")
+        with self.assertRaises(ValueError):
+            next(u)
+
+    def test_file_raw(self):
+        data = b"".join(self.messages)
+        self.assertEqual(
+            list(FileUnpacker(BytesIO(data), 5, raw=True)), self.messages
+        )